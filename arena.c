@@ -0,0 +1,124 @@
+/**
+ * @file arena.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of the arena allocator, a list of large blocks that
+ * allocations are taken from in order.
+*/
+#include "arena.h"
+#include <stdlib.h>
+
+/** Usual size for a block of arena memory.  Larger requests get a block
+    of their own. */
+#define BLOCK_SIZE 65536
+
+/** Every allocation is rounded up to a multiple of this, so it's aligned
+    for pointers, ints and Values. */
+#define ALIGNMENT 16
+
+/** One block of memory obtained from malloc. */
+typedef struct BlockStruct {
+  /** Next block in the arena. */
+  struct BlockStruct *next;
+
+  /** Number of bytes of storage in this block. */
+  size_t size;
+} Block;
+
+/** Size of the block header, padded so the storage after it is aligned. */
+#define HEADER_SIZE ( ( sizeof( Block ) + ALIGNMENT - 1 ) & ~(size_t) ( ALIGNMENT - 1 ) )
+
+/** Storage for allocations in the given block, right after its header. */
+#define BLOCK_MEM( block ) ( (unsigned char *) ( block ) + HEADER_SIZE )
+
+// Hidden representation for the arena.
+struct ArenaStruct {
+  /** All the blocks in the arena, in the order they're used. */
+  Block *first;
+
+  /** Block we're currently allocating from, or NULL if none yet. */
+  Block *current;
+
+  /** Number of bytes used in the current block. */
+  size_t used;
+
+  /** Allocations since the last reset, and the bytes they asked for. */
+  long count;
+  size_t bytes;
+};
+
+Arena *makeArena()
+{
+  Arena *arena = (Arena *) malloc( sizeof( Arena ) );
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->used = 0;
+  arena->count = 0;
+  arena->bytes = 0;
+  return arena;
+}
+
+/** Make a new block with room for at least the given number of bytes.
+    @param size number of bytes needed.
+    @return new block.
+*/
+static Block *makeBlock( size_t size )
+{
+  if ( size < BLOCK_SIZE )
+    size = BLOCK_SIZE;
+  Block *block = (Block *) malloc( HEADER_SIZE + size );
+  block->next = NULL;
+  block->size = size;
+  return block;
+}
+
+void *arenaAlloc( Arena *arena, size_t size )
+{
+  arena->count++;
+  arena->bytes += size;
+  size = ( size + ALIGNMENT - 1 ) & ~(size_t) ( ALIGNMENT - 1 );
+
+  // Move on to the next block if this one is full, reusing a block from
+  // before the last reset if it's big enough.
+  if ( !arena->current || arena->used + size > arena->current->size ) {
+    Block **link = arena->current ? &arena->current->next : &arena->first;
+    while ( *link && ( *link )->size < size )
+      link = &( *link )->next;
+
+    if ( !*link )
+      *link = makeBlock( size );
+
+    arena->current = *link;
+    arena->used = 0;
+  }
+
+  void *ptr = BLOCK_MEM( arena->current ) + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+void arenaUsage( Arena const *arena, long *count, size_t *bytes )
+{
+  *count = arena->count;
+  *bytes = arena->bytes;
+}
+
+void resetArena( Arena *arena )
+{
+  // Start over from the first block.
+  arena->current = NULL;
+  arena->used = 0;
+  arena->count = 0;
+  arena->bytes = 0;
+}
+
+void freeArena( Arena *arena )
+{
+  Block *block = arena->first;
+  while ( block ) {
+    Block *next = block->next;
+    free( block );
+    block = next;
+  }
+
+  free( arena );
+}
@@ -0,0 +1,52 @@
+/**
+  @file arena.h
+  @author Sean Hinton (sahinto2)
+
+  Arena allocator for the syntax tree.  Memory is carved out of large
+  blocks, and everything allocated from an arena is released at once
+  when the arena is reset, instead of being freed one object at a time.
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/** Short name for the arena, its representation is hidden in arena.c. */
+typedef struct ArenaStruct Arena;
+
+/** Make a new, empty arena.
+    @return new, dynamically allocated arena.  The caller must eventually
+    free it with freeArena().
+*/
+Arena *makeArena();
+
+/** Allocate a block of memory from the arena.  The memory is suitably
+    aligned for any of our objects, and it stays valid until the arena
+    is reset or freed.
+    @param arena arena to allocate from.
+    @param size number of bytes needed.
+    @return pointer to the new memory.
+*/
+void *arenaAlloc( Arena *arena, size_t size );
+
+/** Report how much the arena has handed out since it was made or last
+    reset.
+    @param arena arena to report on.
+    @param count returns the number of allocations.
+    @param bytes returns the number of bytes asked for.
+*/
+void arenaUsage( Arena const *arena, long *count, size_t *bytes );
+
+/** Release everything allocated from the arena, all at once.  The blocks
+    the arena got from malloc are kept to be used again.
+    @param arena arena to reset.
+*/
+void resetArena( Arena *arena );
+
+/** Free the arena and all the memory allocated from it.
+    @param arena arena to free.
+*/
+void freeArena( Arena *arena );
+
+#endif
@@ -0,0 +1,314 @@
+/**
+ * @file batch.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of batch mode.  Workers claim programs one at a time
+ * from a shared counter, so a worker that finishes early just takes the
+ * next program instead of waiting on the others.
+*/
+
+// For open_memstream(), clock_gettime() and sysconf().
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "interp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+/** One program in the batch, and what happened when it ran. */
+typedef struct {
+  /** Name of the program's source file. */
+  char *name;
+
+  /** Everything the program printed. */
+  char *output;
+
+  /** Number of characters of output. */
+  size_t outputLen;
+
+  /** True if the program ran without an error. */
+  bool ok;
+
+  /** Message to report if it didn't. */
+  char *message;
+
+  /** How long the program took to run, in seconds. */
+  double latency;
+} Script;
+
+/** State shared by all the workers in a batch. */
+typedef struct {
+  /** Every program in the batch, in the order their output goes. */
+  Script *scripts;
+
+  /** Number of programs. */
+  int count;
+
+  /** Index of the next program nobody has claimed. */
+  int next;
+
+  /** Protects next. */
+  pthread_mutex_t lock;
+
+  /** How to run the programs. */
+  BatchOptions const *opts;
+} Batch;
+
+/** Current time in seconds, from a monotonic clock. */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Make a dynamically allocated copy of a string.
+    @param str string to copy.
+    @return the copy.
+*/
+static char *copyString( char const *str )
+{
+  char *copy = (char *) malloc( strlen( str ) + 1 );
+  return strcpy( copy, str );
+}
+
+/** Add a program to the end of a batch.
+    @param batch batch to add to.
+    @param cap capacity of the batch's list, updated if it grows.
+    @param name name of the program, copied by this function.
+*/
+static void addScript( Batch *batch, int *cap, char const *name )
+{
+  if ( batch->count >= *cap ) {
+    *cap *= DOUBLE_CAP;
+    batch->scripts = (Script *) realloc( batch->scripts,
+                                         *cap * sizeof( Script ) );
+  }
+
+  Script *script = batch->scripts + batch->count++;
+  script->name = copyString( name );
+  script->output = NULL;
+  script->outputLen = 0;
+  script->ok = false;
+  script->message = NULL;
+  script->latency = 0;
+}
+
+/** Comparison function for sorting programs by name. */
+static int compareScripts( void const *a, void const *b )
+{
+  return strcmp( ( (Script const *) a )->name, ( (Script const *) b )->name );
+}
+
+/** Fill in the list of programs from a directory or a list file.
+    @param batch batch to fill in.
+    @param source directory or list file to read.
+    @return true if the source could be read.
+*/
+static bool findScripts( Batch *batch, char const *source )
+{
+  int cap = INIT_CAP;
+  batch->scripts = (Script *) malloc( cap * sizeof( Script ) );
+  batch->count = 0;
+
+  struct stat info;
+  if ( stat( source, &info ) != 0 ) {
+    perror( source );
+    return false;
+  }
+
+  if ( S_ISDIR( info.st_mode ) ) {
+    DIR *dir = opendir( source );
+    if ( !dir ) {
+      perror( source );
+      return false;
+    }
+
+    // Every regular file in the directory is a program.
+    struct dirent *entry;
+    while ( ( entry = readdir( dir ) ) ) {
+      char path[ strlen( source ) + strlen( entry->d_name ) + 2 ];
+      sprintf( path, "%s/%s", source, entry->d_name );
+      if ( stat( path, &info ) == 0 && S_ISREG( info.st_mode ) )
+        addScript( batch, &cap, path );
+    }
+    closedir( dir );
+
+    qsort( batch->scripts, batch->count, sizeof( Script ), compareScripts );
+    return true;
+  }
+
+  FILE *fp = fopen( source, "r" );
+  if ( !fp ) {
+    perror( source );
+    return false;
+  }
+
+  // Otherwise, it lists one program per line, skipping blank lines.
+  char *line = NULL;
+  size_t lineCap = 0;
+  ssize_t len;
+  while ( ( len = getline( &line, &lineCap, fp ) ) >= 0 ) {
+    while ( len > 0 && ( line[ len - 1 ] == '\n' || line[ len - 1 ] == '\r' ) )
+      line[ --len ] = '\0';
+    if ( len > 0 )
+      addScript( batch, &cap, line );
+  }
+  free( line );
+  fclose( fp );
+  return true;
+}
+
+/** Run one program, collecting its output.
+    @param interp the worker's context.
+    @param script program to run.
+    @param opts how to run it.
+*/
+static void runScript( Interp *interp, Script *script,
+                       BatchOptions const *opts )
+{
+  double start = now();
+
+  FILE *fp = fopen( script->name, "r" );
+  if ( !fp ) {
+    script->message = copyString( "can't open program" );
+    return;
+  }
+
+  FILE *out = open_memstream( &script->output, &script->outputLen );
+  setInterpOutput( interp, out );
+
+  Environment *env = makeEnvironment();
+  script->ok = interpRunFile( interp, fp, env, opts->vm ) == INTERP_OK;
+  if ( !script->ok )
+    script->message = copyString( interpError( interp ) );
+  freeEnvironment( env );
+
+  // Everything was written when the program finished, so the context
+  // can let go of the stream.
+  setInterpOutput( interp, stdout );
+  fclose( out );
+  fclose( fp );
+  script->latency = now() - start;
+}
+
+/** Start routine for a worker, running programs until there are none
+    left.
+    @param arg the batch.
+    @return NULL.
+*/
+static void *worker( void *arg )
+{
+  Batch *batch = (Batch *) arg;
+
+  // Every worker reuses its own context, with its own arena and output
+  // buffer, for all the programs it runs.
+  Interp *interp = makeInterp();
+  setInterpValueSemantics( interp, batch->opts->valueSemantics );
+  setCurrentInterp( interp );
+
+  while ( true ) {
+    pthread_mutex_lock( &batch->lock );
+    int i = batch->next++;
+    pthread_mutex_unlock( &batch->lock );
+
+    if ( i >= batch->count )
+      break;
+    runScript( interp, batch->scripts + i, batch->opts );
+  }
+
+  freeInterp( interp );
+  return NULL;
+}
+
+/** Comparison function for sorting latencies. */
+static int compareDoubles( void const *a, void const *b )
+{
+  double x = *(double const *) a;
+  double y = *(double const *) b;
+  return x < y ? -1 : x > y;
+}
+
+/** Report throughput and per-program latency for a batch.
+    @param batch batch that was run.
+    @param elapsed time for the whole batch, in seconds.
+*/
+static void reportTiming( Batch const *batch, double elapsed )
+{
+  fprintf( stderr, "batch: %d programs in %.3f ms, %.1f programs/sec\n",
+           batch->count, elapsed * 1000,
+           elapsed > 0 ? batch->count / elapsed : 0 );
+  if ( batch->count == 0 )
+    return;
+
+  double *latency = (double *) malloc( batch->count * sizeof( double ) );
+  for ( int i = 0; i < batch->count; i++ )
+    latency[ i ] = batch->scripts[ i ].latency;
+  qsort( latency, batch->count, sizeof( double ), compareDoubles );
+
+  // Nearest-rank percentiles.
+  int percent[] = { 50, 90, 99 };
+  int percents = sizeof( percent ) / sizeof( percent[ 0 ] );
+  fprintf( stderr, "latency:" );
+  for ( int i = 0; i < percents; i++ ) {
+    int rank = ( percent[ i ] * batch->count + 99 ) / 100;
+    fprintf( stderr, " p%d %.3f ms,", percent[ i ],
+             latency[ rank - 1 ] * 1000 );
+  }
+  fprintf( stderr, " max %.3f ms\n", latency[ batch->count - 1 ] * 1000 );
+  free( latency );
+}
+
+bool runBatch( char const *source, BatchOptions const *opts )
+{
+  Batch batch;
+  batch.next = 0;
+  batch.opts = opts;
+  pthread_mutex_init( &batch.lock, NULL );
+
+  bool ok = findScripts( &batch, source );
+  if ( ok ) {
+    double start = now();
+
+    // No point in having more workers than programs.
+    int jobs = opts->jobs < batch.count ? opts->jobs : batch.count;
+    pthread_t thread[ jobs > 0 ? jobs : 1 ];
+    for ( int i = 0; i < jobs; i++ )
+      if ( pthread_create( thread + i, NULL, worker, &batch ) != 0 ) {
+        perror( "pthread_create" );
+        exit( EXIT_FAILURE );
+      }
+    for ( int i = 0; i < jobs; i++ )
+      pthread_join( thread[ i ], NULL );
+
+    double elapsed = now() - start;
+
+    // Write every program's results, in order.
+    for ( int i = 0; i < batch.count; i++ ) {
+      Script *script = batch.scripts + i;
+      fwrite( script->output, 1, script->outputLen, stdout );
+      if ( !script->ok ) {
+        fflush( stdout );
+        fprintf( stderr, "%s: %s\n", script->name, script->message );
+        ok = false;
+      }
+    }
+    fflush( stdout );
+
+    if ( opts->timing )
+      reportTiming( &batch, elapsed );
+  }
+
+  for ( int i = 0; i < batch.count; i++ ) {
+    free( batch.scripts[ i ].name );
+    free( batch.scripts[ i ].output );
+    free( batch.scripts[ i ].message );
+  }
+  free( batch.scripts );
+  pthread_mutex_destroy( &batch.lock );
+  return ok;
+}
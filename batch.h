@@ -0,0 +1,42 @@
+/**
+  @file batch.h
+  @author Sean Hinton (sahinto2)
+
+  Batch mode for the interpret command, running many independent
+  programs in one process on a pool of worker threads.  Each worker has
+  its own interpreter context, and each program's output is collected
+  separately, then written in the order the programs were given.
+*/
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdbool.h>
+
+/** Options for a batch of programs. */
+typedef struct {
+  /** Number of worker threads. */
+  int jobs;
+
+  /** True if programs should run on the VM. */
+  bool vm;
+
+  /** True for value semantics. */
+  bool valueSemantics;
+
+  /** True if throughput and latency should be reported on standard
+      error when the batch is done. */
+  bool timing;
+} BatchOptions;
+
+/** Run every program in a batch.  Each program's output goes to
+    standard output, and errors go to standard error prefixed with the
+    name of the program that failed.
+    @param source a directory, in which case every file in it is run in
+    order by name, or a file listing the programs to run, one per line.
+    @param opts how to run the programs.
+    @return true if every program ran without an error.
+*/
+bool runBatch( char const *source, BatchOptions const *opts );
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * @file copybench.c
+ * Benchmark for copy-heavy programs under reference and value semantics.
+ * Each program named on the command line is run with both semantics,
+ * in the tree-walking evaluator and in the VM, and the time for each run
+ * is reported.  The programs' own output is thrown away.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../interp.h"
+
+/** Current time in seconds, from a monotonic clock. */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Run a program from start to finish, the same way interpret does.
+    @param name name of the program file.
+    @param vm true if statements should be run on the VM.
+    @param values true for value semantics.
+    @return how long it took, in seconds.
+*/
+static double timeProgram( char const *name, bool vm, bool values )
+{
+  FILE *fp = fopen( name, "r" );
+  if ( !fp ) {
+    perror( name );
+    exit( EXIT_FAILURE );
+  }
+
+  // Throw the program's output away.
+  FILE *out = fopen( "/dev/null", "w" );
+
+  double start = now();
+  Interp *interp = makeInterp();
+  setInterpOutput( interp, out );
+  setInterpValueSemantics( interp, values );
+  Environment *env = makeEnvironment();
+  if ( interpRunFile( interp, fp, env, vm ) != INTERP_OK ) {
+    fprintf( stderr, "%s: %s\n", name, interpError( interp ) );
+    exit( EXIT_FAILURE );
+  }
+  freeEnvironment( env );
+  freeInterp( interp );
+  double elapsed = now() - start;
+
+  fclose( out );
+  fclose( fp );
+  return elapsed;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 2 ) {
+    fprintf( stderr, "usage: copybench <program-file>...\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  for ( int i = 1; i < argc; i++ )
+    for ( int values = 0; values < 2; values++ )
+      for ( int vm = 0; vm < 2; vm++ ) {
+        double t = timeProgram( argv[ i ], vm, values );
+        printf( "%s: %s semantics, %s: %.1f ms\n", argv[ i ],
+                values ? "value" : "reference", vm ? "vm" : "tree",
+                t * 1000 );
+      }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file envbench.c
+ * Microbenchmark for the Environment representations in value.c.  It's
+ * built once for each backend (see the envbench target in the Makefile),
+ * and reports the average time for setVariable() and lookupVariable()
+ * with 10, 100 and 10,000 variables.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../value.h"
+
+// Name of the backend this copy of the benchmark was built with.
+#if defined( ENV_HASH )
+#define BACKEND "hash"
+#elif defined( ENV_LIST )
+#define BACKEND "list"
+#else
+#define BACKEND "slots"
+#endif
+
+// Roughly how many operations to time for each environment size.
+#define TOTAL_OPS 20000000L
+
+// Cap on the number of operations for the list, so it finishes.
+#define LIST_OPS 200000000L
+
+/** Current time in seconds, from a monotonic clock. */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Time lookups and assignments in an environment with n variables.
+    @param n number of variables.
+*/
+static void run( int n )
+{
+  // Make a symbol for each variable, like the parser would.
+  Symbol *syms = (Symbol *) malloc( n * sizeof( Symbol ) );
+  for ( int i = 0; i < n; i++ ) {
+    syms[ i ].slot = i;
+    snprintf( syms[ i ].name, sizeof( syms[ i ].name ), "var_%d", i );
+    syms[ i ].hash = hashName( syms[ i ].name, strlen( syms[ i ].name ) );
+  }
+
+  // Visit variables in a scattered order, so we're not just measuring
+  // the first few entries.
+  int *order = (int *) malloc( n * sizeof( int ) );
+  for ( int i = 0; i < n; i++ )
+    order[ i ] = i;
+  srand( 1 );
+  for ( int i = n - 1; i > 0; i-- ) {
+    int j = rand() % ( i + 1 );
+    int t = order[ i ];
+    order[ i ] = order[ j ];
+    order[ j ] = t;
+  }
+
+  // The list is quadratic, so give it fewer rounds at large sizes.
+  long ops = TOTAL_OPS;
+#ifdef ENV_LIST
+  if ( ops * n > LIST_OPS )
+    ops = LIST_OPS / n;
+#endif
+  long rounds = ops / n > 0 ? ops / n : 1;
+
+  Environment *env = makeEnvironment();
+  double start = now();
+  for ( long r = 0; r < rounds; r++ )
+    for ( int i = 0; i < n; i++ )
+      setVariable( env, &syms[ order[ i ] ], (Value){ IntType, .ival = i } );
+  double setTime = now() - start;
+
+  long sum = 0;
+  start = now();
+  for ( long r = 0; r < rounds; r++ )
+    for ( int i = 0; i < n; i++ )
+      sum += lookupVariable( env, &syms[ order[ i ] ] ).ival;
+  double getTime = now() - start;
+
+  double count = (double) rounds * n;
+  printf( "%-6s %6d vars  set %8.2f ns  lookup %8.2f ns  (check %ld)\n",
+          BACKEND, n, setTime / count * 1e9, getTime / count * 1e9, sum );
+
+  freeEnvironment( env );
+  free( order );
+  free( syms );
+}
+
+int main()
+{
+  int sizes[] = { 10, 100, 10000 };
+  for ( int i = 0; i < sizeof( sizes ) / sizeof( sizes[ 0 ] ); i++ )
+    run( sizes[ i ] );
+
+  return EXIT_SUCCESS;
+}
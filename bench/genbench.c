@@ -0,0 +1,175 @@
+/**
+ * @file genbench.c
+ * Generator for the benchmark workloads run by make bench.  Each one is
+ * a scaled-up version of a kind of program in the test corpus: long
+ * runs of push statements like prog-14, deeply nested loops, building a
+ * long string by concatenation, comparing big sequences, and scripts
+ * with lots of variables.  The size of every workload is multiplied by
+ * the scale given on the command line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/** Longest path we'll make for a workload. */
+#define PATH_LEN 1024
+
+/** Depth of the nested loops workload. */
+#define NEST_DEPTH 6
+
+/** Number of variables in the variable-heavy workload. */
+#define VAR_COUNT 200
+
+/** State of the random number generator, so every run makes the same
+    programs. */
+static unsigned long seed = 1;
+
+/** Return a pseudo-random number from 0 to 999. */
+static int nextRandom()
+{
+  seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+  return (int) ( ( seed >> 33 ) % 1000 );
+}
+
+/** Open a workload file for writing, exiting if we can't.
+    @param dir directory the workloads go in.
+    @param name name of the workload.
+    @return stream to write the program to.
+*/
+static FILE *openWorkload( char const *dir, char const *name )
+{
+  char path[ PATH_LEN ];
+  snprintf( path, sizeof( path ), "%s/%s.txt", dir, name );
+  FILE *fp = fopen( path, "w" );
+  if ( !fp ) {
+    perror( path );
+    exit( EXIT_FAILURE );
+  }
+  return fp;
+}
+
+/** Long runs of push statements with literal values, like prog-14, then
+    a loop that adds them up.  This is mostly parsing. */
+static void genPush( char const *dir, int scale )
+{
+  FILE *fp = openWorkload( dir, "push" );
+  fprintf( fp, "# Generated by genbench: long runs of push.\n" );
+  fprintf( fp, "list = [];\n" );
+  for ( int i = 0; i < 100000 * scale; i++ )
+    fprintf( fp, "push list, %d;\n", nextRandom() );
+
+  fprintf( fp, "i = 0;\ntotal = 0;\n"
+           "while ( i < len list ) {\n"
+           "  total = total + ( list[ i ] );\n"
+           "  i = i + 1;\n"
+           "}\n"
+           "print total;\nprint \"\\n\";\n" );
+  fclose( fp );
+}
+
+/** Loops nested several deep, with a counter in the innermost one. */
+static void genNested( char const *dir, int scale )
+{
+  FILE *fp = openWorkload( dir, "nested" );
+  fprintf( fp, "# Generated by genbench: deeply nested loops.\n" );
+  fprintf( fp, "count = 0;\n" );
+
+  for ( int d = 0; d < NEST_DEPTH; d++ ) {
+    // The outermost loop is the one that grows with the scale.
+    int limit = d == 0 ? 16 * scale : 8;
+    fprintf( fp, "%*si%d = 0;\n", 2 * d, "", d );
+    fprintf( fp, "%*swhile ( i%d < %d ) {\n", 2 * d, "", d, limit );
+  }
+  fprintf( fp, "%*scount = count + 1;\n", 2 * NEST_DEPTH, "" );
+  for ( int d = NEST_DEPTH - 1; d >= 0; d-- ) {
+    fprintf( fp, "%*si%d = i%d + 1;\n", 2 * d + 2, "", d, d );
+    fprintf( fp, "%*s}\n", 2 * d, "" );
+  }
+
+  fprintf( fp, "print count;\nprint \"\\n\";\n" );
+  fclose( fp );
+}
+
+/** A long string built up a piece at a time. */
+static void genConcat( char const *dir, int scale )
+{
+  FILE *fp = openWorkload( dir, "concat" );
+  fprintf( fp, "# Generated by genbench: large string concatenation.\n" );
+  fprintf( fp, "s = \"\";\n"
+           "i = 0;\n"
+           "while ( i < %d ) {\n"
+           "  s = s + \"abcdefgh\";\n"
+           "  t = s + \"!\";\n"
+           "  i = i + 1;\n"
+           "}\n"
+           "print len t;\nprint \"\\n\";\n", 10000 * scale );
+  fclose( fp );
+}
+
+/** Comparing big sequences that differ only near the end. */
+static void genCompare( char const *dir, int scale )
+{
+  FILE *fp = openWorkload( dir, "compare" );
+  fprintf( fp, "# Generated by genbench: big sequence compares.\n" );
+  fprintf( fp, "a = [ 7 ] * 100000;\n"
+           "b = [ 7 ] * 100000;\n"
+           "b[ 99998 ] = 8;\n"
+           "same = 0;\n"
+           "less = 0;\n"
+           "i = 0;\n"
+           "while ( i < %d ) {\n"
+           "  same = same + ( a == b );\n"
+           "  less = less + ( a < b );\n"
+           "  i = i + 1;\n"
+           "}\n"
+           "print same;\nprint \" \";\nprint less;\nprint \"\\n\";\n",
+           2000 * scale );
+  fclose( fp );
+}
+
+/** A script that uses lots of different variables. */
+static void genVars( char const *dir, int scale )
+{
+  FILE *fp = openWorkload( dir, "vars" );
+  fprintf( fp, "# Generated by genbench: lots of variables.\n" );
+  for ( int v = 0; v < VAR_COUNT; v++ )
+    fprintf( fp, "v%d = %d;\n", v, nextRandom() );
+
+  fprintf( fp, "total = 0;\n"
+           "i = 0;\n"
+           "while ( i < %d ) {\n", 5000 * scale );
+  for ( int v = 0; v < VAR_COUNT; v++ )
+    fprintf( fp, "  total = total + v%d;\n", v );
+  fprintf( fp, "  v%d = v%d + 1;\n", VAR_COUNT - 1, VAR_COUNT - 1 );
+  fprintf( fp, "  i = i + 1;\n"
+           "}\n"
+           "print total;\nprint \"\\n\";\n" );
+  fclose( fp );
+}
+
+int main( int argc, char *argv[] )
+{
+  int scale = 1;
+  if ( argc < 2 || argc > 3 ||
+       ( argc == 3 && ( sscanf( argv[ 2 ], "%d", &scale ) != 1 ||
+                        scale < 1 ) ) ) {
+    fprintf( stderr, "usage: genbench <directory> [scale]\n" );
+    return EXIT_FAILURE;
+  }
+
+  char const *dir = argv[ 1 ];
+  if ( mkdir( dir, 0777 ) != 0 && errno != EEXIST ) {
+    perror( dir );
+    return EXIT_FAILURE;
+  }
+
+  genPush( dir, scale );
+  genNested( dir, scale );
+  genConcat( dir, scale );
+  genCompare( dir, scale );
+  genVars( dir, scale );
+  return EXIT_SUCCESS;
+}
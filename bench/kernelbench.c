@@ -0,0 +1,137 @@
+/**
+ * @file kernelbench.c
+ * Microbenchmark for the bulk kernels in kernel.c.  Each kernel is
+ * timed against the plain loop it replaced in ops.c, value.c and
+ * output.c, on sequences of 1,000, 10,000 and 100,000 elements, and the
+ * average time per element is reported.  The loops worked on ints, so
+ * the kernels are timed on four-byte elements.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../kernel.h"
+
+// Roughly how many elements to process for each size.
+#define TOTAL_ELEMENTS 400000000L
+
+/** Current time in seconds, from a monotonic clock. */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The loops the kernels replaced.  They're called through pointers, so
+// the compiler can't specialize them for the benchmark or hoist them out
+// of the timing loops.
+
+/** Element by element comparison, from equalsValues() and lessValues(). */
+static int loopMismatch( int const *a, int const *b, int n )
+{
+  for ( int i = 0; i < n; i++ )
+    if ( a[ i ] != b[ i ] )
+      return i;
+  return n;
+}
+
+/** One int at a time, from repeatSequence() without the memcpy. */
+static void loopFill( int *dest, int val, int n )
+{
+  for ( int i = 0; i < n; i++ )
+    dest[ i ] = val;
+}
+
+/** Narrowing for print, from writeChars(). */
+static void loopNarrow( char *dest, int const *src, int n )
+{
+  for ( int i = 0; i < n; i++ )
+    dest[ i ] = (char) src[ i ];
+}
+
+static int (*volatile mismatchLoop)( int const *, int const *, int ) =
+  loopMismatch;
+static void (*volatile fillLoop)( int *, int, int ) = loopFill;
+static void (*volatile narrowLoop)( char *, int const *, int ) = loopNarrow;
+
+/** Print one line of results.
+    @param name name of the operation.
+    @param n number of elements.
+    @param loop seconds for the plain loop.
+    @param kernel seconds for the kernel.
+    @param rounds number of times each ran.
+*/
+static void report( char const *name, int n, double loop, double kernel,
+                    long rounds )
+{
+  double scale = 1e9 / ( (double) rounds * n );
+  printf( "%-8s %7d elements: loop %.3f ns/elem, kernel %.3f ns/elem, "
+          "%.1fx\n", name, n, loop * scale, kernel * scale, loop / kernel );
+}
+
+/** Time every kernel on arrays of n elements.
+    @param n number of elements.
+*/
+static void run( int n )
+{
+  int *a = (int *) malloc( n * sizeof( int ) );
+  int *b = (int *) malloc( n * sizeof( int ) );
+  char *chars = (char *) malloc( n );
+  for ( int i = 0; i < n; i++ )
+    a[ i ] = b[ i ] = i * 7 + 300;
+
+  long rounds = TOTAL_ELEMENTS / n;
+  long check = 0;
+
+  // Comparing identical sequences has to look at every element.
+  double start = now();
+  for ( long r = 0; r < rounds; r++ )
+    check += mismatchLoop( a, b, n );
+  double loop = now() - start;
+  start = now();
+  for ( long r = 0; r < rounds; r++ )
+    check -= kernelMismatch( a, b, n, sizeof( int ) );
+  report( "compare", n, loop, now() - start, rounds );
+
+  start = now();
+  for ( long r = 0; r < rounds; r++ )
+    fillLoop( b, (int) r, n );
+  loop = now() - start;
+  start = now();
+  for ( long r = 0; r < rounds; r++ )
+    kernelFill( b, (int) r, n, sizeof( int ) );
+  report( "fill", n, loop, now() - start, rounds );
+
+  start = now();
+  for ( long r = 0; r < rounds; r++ )
+    narrowLoop( chars, a, n );
+  loop = now() - start;
+  check += chars[ n - 1 ];
+  start = now();
+  for ( long r = 0; r < rounds; r++ )
+    kernelNarrow( chars, a, n, sizeof( int ) );
+  report( "narrow", n, loop, now() - start, rounds );
+  check -= chars[ n - 1 ];
+
+  // Make sure both versions got the same answers.
+  if ( check != 0 || b[ 0 ] != (int) ( rounds - 1 ) ) {
+    fprintf( stderr, "kernels don't match the loops\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  free( a );
+  free( b );
+  free( chars );
+}
+
+int main()
+{
+  printf( "kernels: %s\n", kernelName() );
+  run( 1000 );
+  run( 10000 );
+  run( 100000 );
+  return EXIT_SUCCESS;
+}
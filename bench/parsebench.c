@@ -0,0 +1,113 @@
+/**
+ * @file parsebench.c
+ * Throughput benchmark for the tokenizer and parser.  It concatenates the
+ * program files named on the command line, repeating them until there's
+ * a few megabytes of source, then reports how fast parseToken() and
+ * parseStmt() get through it, in megabytes per second.  The programs
+ * must be free of syntax errors, since those exit the parser.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../parse.h"
+#include "../arena.h"
+
+// Roughly how much source to parse on each pass.
+#define TARGET_BYTES ( 8L * 1024 * 1024 )
+
+// Number of passes to time.  We report the fastest.
+#define PASSES 5
+
+/** Current time in seconds, from a monotonic clock. */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Append the contents of a file to the source we're building.
+    @param dest file being built.
+    @param name name of the file to copy.
+    @return number of bytes copied.
+*/
+static long appendFile( FILE *dest, char const *name )
+{
+  FILE *fp = fopen( name, "r" );
+  if ( !fp ) {
+    perror( name );
+    exit( EXIT_FAILURE );
+  }
+
+  char buf[ 4096 ];
+  long total = 0;
+  size_t n;
+  while ( ( n = fread( buf, 1, sizeof( buf ), fp ) ) > 0 ) {
+    fwrite( buf, 1, n, dest );
+    total += n;
+  }
+
+  // Make sure the next file starts on its own line.
+  fputc( '\n', dest );
+  fclose( fp );
+  return total + 1;
+}
+
+/** Parse the whole source once.
+    @param fp source file, positioned anywhere.
+    @param arena arena the syntax trees are allocated from.
+    @return number of statements parsed.
+*/
+static long parseAll( FILE *fp, Arena *arena )
+{
+  rewind( fp );
+  Tokenizer *tz = makeTokenizer( fp );
+  long count = 0;
+  Token tok;
+  while ( parseToken( tz, &tok ) ) {
+    Stmt *stmt = parseStmt( &tok, tz );
+    stmt->destroy( stmt );
+    resetArena( arena );
+    count++;
+  }
+  freeTokenizer( tz );
+  return count;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 2 ) {
+    fprintf( stderr, "usage: parsebench <program-file>...\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  // Build the source, going through the programs until it's big enough.
+  FILE *fp = tmpfile();
+  long size = 0;
+  while ( size < TARGET_BYTES )
+    for ( int i = 1; i < argc; i++ )
+      size += appendFile( fp, argv[ i ] );
+  fflush( fp );
+
+  Arena *arena = makeArena();
+  setSyntaxArena( arena );
+
+  double best = 0;
+  long count = 0;
+  for ( int p = 0; p < PASSES; p++ ) {
+    double start = now();
+    count = parseAll( fp, arena );
+    double elapsed = now() - start;
+    if ( p == 0 || elapsed < best )
+      best = elapsed;
+  }
+
+  printf( "parse: %.1f MB, %ld statements, %.1f MB/s\n",
+          size / 1e6, count, size / 1e6 / best );
+
+  freeArena( arena );
+  fclose( fp );
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file runbench.c
+ * Runner for the benchmark workloads.  Each program named on the command
+ * line is run with the interpreter a few times, reporting its best wall
+ * time, its peak resident set size and the number of sequences it made
+ * (from --stats).  The results can also be written to a tab-separated
+ * file, and two of those files, from different commits, can be compared.
+*/
+
+// For wait4() and struct rusage.
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/** Number of times each program runs, unless we're told otherwise. */
+#define DEFAULT_RUNS 3
+
+/** Most programs a results file can have. */
+#define MAX_RESULTS 256
+
+/** Longest program name we keep. */
+#define NAME_LEN 256
+
+/** How much slower a program can get before the comparison flags it. */
+#define SLOWER 1.10
+
+/** Measurements for one program. */
+typedef struct {
+  char name[ NAME_LEN ];
+
+  /** Best wall time, in milliseconds. */
+  double ms;
+
+  /** Peak resident set size, in kilobytes. */
+  long rss;
+
+  /** Sequences the program made. */
+  long sequences;
+} Result;
+
+/** Current time in seconds, from a monotonic clock. */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Run a program once, with its output thrown away.
+    @param interp path to the interpreter.
+    @param prog program to run.
+    @param result where to put the measurements.
+    @return true if the program ran successfully.
+*/
+static bool runOnce( char const *interp, char const *prog, Result *result )
+{
+  int pipefd[ 2 ];
+  if ( pipe( pipefd ) != 0 ) {
+    perror( "pipe" );
+    exit( EXIT_FAILURE );
+  }
+
+  double start = now();
+  pid_t pid = fork();
+  if ( pid == 0 ) {
+    // The program's output goes nowhere, and its stats come back to us.
+    int null = open( "/dev/null", O_WRONLY );
+    dup2( null, STDOUT_FILENO );
+    dup2( pipefd[ 1 ], STDERR_FILENO );
+    close( pipefd[ 0 ] );
+    execl( interp, interp, "--stats", prog, (char *) NULL );
+    perror( interp );
+    _exit( EXIT_FAILURE );
+  }
+  close( pipefd[ 1 ] );
+
+  // Read whatever it reports, looking for the number of sequences.
+  FILE *stats = fdopen( pipefd[ 0 ], "r" );
+  char line[ NAME_LEN ];
+  result->sequences = -1;
+  while ( fgets( line, sizeof( line ), stats ) )
+    sscanf( line, "sequences: %ld made", &result->sequences );
+  fclose( stats );
+
+  int status;
+  struct rusage usage;
+  wait4( pid, &status, 0, &usage );
+  result->ms = ( now() - start ) * 1000;
+  result->rss = usage.ru_maxrss;
+  return WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+}
+
+/** Read a results file written by a previous run.
+    @param path file to read.
+    @param results where to put the results.
+    @return number of results read.
+*/
+static int readResults( char const *path, Result *results )
+{
+  FILE *fp = fopen( path, "r" );
+  if ( !fp ) {
+    perror( path );
+    exit( EXIT_FAILURE );
+  }
+
+  int count = 0;
+  char line[ NAME_LEN * 2 ];
+  while ( count < MAX_RESULTS && fgets( line, sizeof( line ), fp ) ) {
+    Result *r = results + count;
+    if ( line[ 0 ] != '#' &&
+         sscanf( line, "%255s %lf %ld %ld", r->name, &r->ms, &r->rss,
+                 &r->sequences ) == 4 )
+      count++;
+  }
+
+  fclose( fp );
+  return count;
+}
+
+/** Compare two results files, reporting the change for every program
+    that's in both.
+    @param oldPath results from before.
+    @param newPath results from after.
+    @return true if nothing got noticeably slower.
+*/
+static bool compare( char const *oldPath, char const *newPath )
+{
+  static Result before[ MAX_RESULTS ], after[ MAX_RESULTS ];
+  int oldCount = readResults( oldPath, before );
+  int newCount = readResults( newPath, after );
+
+  bool ok = true;
+  printf( "%-28s %10s %10s %7s %9s %9s\n", "program", "old ms", "new ms",
+          "time", "old KB", "new KB" );
+  for ( int i = 0; i < newCount; i++ )
+    for ( int j = 0; j < oldCount; j++ )
+      if ( strcmp( after[ i ].name, before[ j ].name ) == 0 ) {
+        double ratio = after[ i ].ms / before[ j ].ms;
+        printf( "%-28s %10.2f %10.2f %6.2fx %9ld %9ld%s\n", after[ i ].name,
+                before[ j ].ms, after[ i ].ms, ratio, before[ j ].rss,
+                after[ i ].rss, ratio > SLOWER ? "  slower" : "" );
+        if ( ratio > SLOWER )
+          ok = false;
+      }
+
+  return ok;
+}
+
+/** Print a usage message then exit unsuccessfully. */
+static void usage()
+{
+  fprintf( stderr,
+           "usage: runbench [--runs=N] [--out=FILE] <interpreter> "
+           "<program>...\n"
+           "       runbench --compare <old-results> <new-results>\n" );
+  exit( EXIT_FAILURE );
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc == 4 && strcmp( argv[ 1 ], "--compare" ) == 0 )
+    return compare( argv[ 2 ], argv[ 3 ] ) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  int runs = DEFAULT_RUNS;
+  char const *out = NULL;
+  int arg = 1;
+  while ( arg < argc && strncmp( argv[ arg ], "--", 2 ) == 0 ) {
+    if ( strncmp( argv[ arg ], "--runs=", 7 ) == 0 ) {
+      if ( sscanf( argv[ arg ] + 7, "%d", &runs ) != 1 || runs < 1 )
+        usage();
+    } else if ( strncmp( argv[ arg ], "--out=", 6 ) == 0 ) {
+      out = argv[ arg ] + 6;
+    } else {
+      usage();
+    }
+    arg++;
+  }
+  if ( argc - arg < 2 )
+    usage();
+
+  char const *interp = argv[ arg++ ];
+  FILE *fp = NULL;
+  if ( out ) {
+    fp = fopen( out, "w" );
+    if ( !fp ) {
+      perror( out );
+      return EXIT_FAILURE;
+    }
+    fprintf( fp, "# program\twall_ms\tpeak_rss_kb\tsequences\n" );
+  }
+
+  bool ok = true;
+  printf( "%-28s %10s %9s %10s\n", "program", "ms", "peak KB", "sequences" );
+  for ( ; arg < argc; arg++ ) {
+    // Keep the fastest run.
+    Result best;
+    for ( int r = 0; r < runs; r++ ) {
+      Result result;
+      if ( !runOnce( interp, argv[ arg ], &result ) ) {
+        fprintf( stderr, "%s: failed\n", argv[ arg ] );
+        ok = false;
+        break;
+      }
+      if ( r == 0 || result.ms < best.ms )
+        best = result;
+    }
+    if ( !ok )
+      break;
+
+    snprintf( best.name, sizeof( best.name ), "%s", argv[ arg ] );
+    printf( "%-28s %10.2f %9ld %10ld\n", best.name, best.ms, best.rss,
+            best.sequences );
+    if ( fp )
+      fprintf( fp, "%s\t%.3f\t%ld\t%ld\n", best.name, best.ms, best.rss,
+               best.sequences );
+  }
+
+  if ( fp )
+    fclose( fp );
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,193 @@
+/**
+  @file context.h
+  @author Sean Hinton (sahinto2)
+
+  Representation of an interpreter context, shared by the modules of the
+  interpreter but hidden from embedding code.  Every thread has a
+  current context, and the parser, evaluators and output all work with
+  the state in it.
+*/
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <setjmp.h>
+
+#include "interp.h"
+#include "value.h"
+#include "arena.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "parse.h"
+#include "memory.h"
+
+/** Size of the output buffer in each context. */
+#define OUTPUT_SIZE 65536
+
+/** Largest error message, including the null terminator. */
+#define MAX_MESSAGE 128
+
+struct InterpStruct {
+  /** Current line of the source being tokenized, starting from 1. */
+  int lineCount;
+
+  /** Every variable name seen in this context, in an open-addressed
+      hash table.  See parse.c. */
+  Symbol **symbols;
+
+  /** Number of symbols, which is also the next unused slot. */
+  int symbolCount;
+
+  /** Number of entries in the symbol table, zero or a power of two. */
+  int symbolCap;
+
+  /** Stacks for the parser, made the first time it's used, or NULL. */
+  ParseState *parser;
+
+  /** Arena that new expressions and statements are allocated from. */
+  Arena *arena;
+
+  /** Arena made on demand if nobody chose one, owned by the context. */
+  Arena *defaultArena;
+
+  /** Arena for the statements run by interpRunFile(), kept so its blocks
+      are reused by the next file run in the same context. */
+  Arena *runArena;
+
+  /** Number of x = x + constant assignments given a fused version. */
+  int fusedIncrements;
+
+  /** Number of i < len a comparisons given a fused version. */
+  int fusedLengthTests;
+
+  /** Number of a[ i ] indexes given a fused version. */
+  int fusedIndexes;
+
+  /** Number of operators on literals replaced by their value. */
+  int foldedConstants;
+
+  /** Bytes of storage sequences have for their elements right now, and
+      the most they've had at once. */
+  long elementBytes;
+  long maxElementBytes;
+
+  /** Bytes the same sequences would need with an int for every element,
+      now and at most, to show what narrow elements are saving. */
+  long intElementBytes;
+  long maxIntElementBytes;
+
+  /** Sequence headers freed and kept for reuse, linked by their owner
+      fields, and how many there are. */
+  Sequence *spareSequences;
+  int spareCount;
+
+  /** Number of sequences made and freed in this context. */
+  long sequencesMade;
+  long sequencesFreed;
+
+  /** Counts for each kind of memory (see memory.h), and the bytes used
+      by all of them now and at most. */
+  MemCount memory[ MEM_KINDS ];
+  long memoryBytes;
+  long maxMemoryBytes;
+
+  /** If we're keeping track of sequences that haven't been freed, an
+      open-addressed table of their headers, otherwise NULL. */
+  Sequence **liveSequences;
+
+  /** Number of sequences in the table, and entries in it (a power of
+      two). */
+  int liveCount;
+  int liveCap;
+
+  /** True if programs run in the tree-walking evaluator are being
+      profiled. */
+  bool profiling;
+
+  /** Counts collected by profiling, made the first time it's turned on,
+      or NULL. */
+  Profile *profile;
+
+  /** Environment images loaded in this context, kept mapped because
+      sequences use their elements where they are. */
+  Snapshot *snapshots;
+
+  /** Directory holding the compiled script cache, or NULL if programs
+      loaded in this context are always parsed. */
+  char const *cacheDir;
+
+  /** True if assigning a sequence should behave like copying it. */
+  bool valueSemantics;
+
+  /** Where printed output goes. */
+  FILE *out;
+
+  /** Output that hasn't been written yet. */
+  char buffer[ OUTPUT_SIZE ];
+
+  /** Number of characters in the buffer. */
+  int bufferLen;
+
+  /** True if output should be written after every print. */
+  bool unbuffered;
+
+  /** Value stack for the VM, reused from one run to the next. */
+  Value *stack;
+
+  /** Number of values the stack has room for. */
+  int stackCap;
+
+  /** End of the part of the VM's stack in use when it last called
+      something that might report an error, or NULL if it isn't
+      running.  See releaseStack() in vm.h. */
+  Value *stackTop;
+
+  /** Sequences held on to by evaluations in progress (see holdValue()
+      in ops.h), so the ones an error unwinds past can be released. */
+  Sequence **held;
+  int heldLen;
+  int heldCap;
+
+  /** Where to go when there's an error, or NULL to print it and exit. */
+  jmp_buf *onError;
+
+  /** Kind of the last error. */
+  InterpStatus status;
+
+  /** Message for the last error. */
+  char message[ MAX_MESSAGE ];
+};
+
+/** Return the current thread's context.  If the thread hasn't chosen
+    one, it gets a default context, which writes any buffered output at
+    exit.
+    @return the current context.
+*/
+Interp *currentInterp();
+
+/** Report an error in the current context.  Any buffered output is
+    written first.  If the context has somewhere to go on an error, this
+    jumps there.  Otherwise, it prints the message and exits.
+    @param status kind of error.
+    @param format printf-style format for the message, followed by its
+    arguments.
+*/
+void raiseError( InterpStatus status, char const *format, ... )
+#if defined( __GNUC__ )
+  __attribute__(( noreturn, format( printf, 2, 3 ) ))
+#endif
+  ;
+
+/** Pass the error being handled on to the next place to go, after
+    cleaning up.  Code that catches an error just to free resources
+    calls this when it's done.
+*/
+void reraiseError()
+#if defined( __GNUC__ )
+  __attribute__(( noreturn ))
+#endif
+  ;
+
+#endif
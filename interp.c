@@ -0,0 +1,397 @@
+/**
+ * @file interp.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of interpreter contexts and the embedding interface.
+ * Each entry point makes its context current for the calling thread and
+ * catches errors raised while it parses or runs a program.
+*/
+#include "context.h"
+#include "parse.h"
+#include "vm.h"
+#include "ops.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+/** Storage class for a variable with a separate copy in every thread. */
+#if defined( __GNUC__ )
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+// Context chosen by the current thread, or NULL if it hasn't chosen one.
+static THREAD_LOCAL Interp *current = NULL;
+
+// Context for code that uses the interpreter's modules without choosing
+// a context, made the first time it's needed.
+static Interp *defaultInterp = NULL;
+
+//////////////////////////////////////////////////////////////////////
+// Contexts
+
+Interp *makeInterp()
+{
+  Interp *interp = (Interp *) malloc( sizeof( Interp ) );
+  interp->lineCount = 1;
+  interp->symbols = NULL;
+  interp->symbolCount = 0;
+  interp->symbolCap = 0;
+  interp->parser = NULL;
+  interp->arena = NULL;
+  interp->defaultArena = NULL;
+  interp->runArena = NULL;
+  interp->fusedIncrements = 0;
+  interp->fusedLengthTests = 0;
+  interp->fusedIndexes = 0;
+  interp->foldedConstants = 0;
+  interp->elementBytes = interp->maxElementBytes = 0;
+  interp->intElementBytes = interp->maxIntElementBytes = 0;
+  interp->spareSequences = NULL;
+  interp->spareCount = 0;
+  interp->sequencesMade = interp->sequencesFreed = 0;
+  memset( interp->memory, 0, sizeof( interp->memory ) );
+  interp->memoryBytes = interp->maxMemoryBytes = 0;
+  interp->liveSequences = NULL;
+  interp->liveCount = interp->liveCap = 0;
+  interp->profiling = false;
+  interp->profile = NULL;
+  interp->snapshots = NULL;
+  interp->cacheDir = NULL;
+  interp->valueSemantics = false;
+  interp->out = stdout;
+  interp->bufferLen = 0;
+  interp->unbuffered = false;
+  interp->stack = NULL;
+  interp->stackCap = 0;
+  interp->stackTop = NULL;
+  interp->held = NULL;
+  interp->heldLen = interp->heldCap = 0;
+  interp->onError = NULL;
+  interp->status = INTERP_OK;
+  interp->message[ 0 ] = '\0';
+  return interp;
+}
+
+void freeInterp( Interp *interp )
+{
+  Interp *previous = setCurrentInterp( interp );
+  flushOutput();
+  setCurrentInterp( previous == interp ? NULL : previous );
+
+  // Free every symbol, see internName() in parse.c.
+  for ( int i = 0; i < interp->symbolCap; i++ )
+    free( interp->symbols[ i ] );
+  free( interp->symbols );
+
+  if ( interp->defaultArena )
+    freeArena( interp->defaultArena );
+  if ( interp->runArena )
+    freeArena( interp->runArena );
+  free( interp->stack );
+  free( interp->held );
+  freeParseState( interp->parser );
+  freeMemStats( interp );
+  freeSpareSequences( interp->spareSequences );
+  if ( interp->profile )
+    freeProfile( interp->profile );
+  freeSnapshots( interp->snapshots );
+  free( interp );
+}
+
+/** Write the default context's output when the program exits. */
+static void flushDefault()
+{
+  setCurrentInterp( defaultInterp );
+  flushOutput();
+}
+
+Interp *currentInterp()
+{
+  if ( current )
+    return current;
+
+  if ( !defaultInterp ) {
+    defaultInterp = makeInterp();
+    atexit( flushDefault );
+  }
+  return defaultInterp;
+}
+
+Interp *setCurrentInterp( Interp *interp )
+{
+  Interp *previous = current;
+  current = interp;
+  return previous;
+}
+
+void raiseError( InterpStatus status, char const *format, ... )
+{
+  Interp *interp = currentInterp();
+
+  va_list args;
+  va_start( args, format );
+  vsnprintf( interp->message, MAX_MESSAGE, format, args );
+  va_end( args );
+  interp->status = status;
+
+  // Output printed before the error should come out before it.
+  flushOutput();
+  reraiseError();
+}
+
+void reraiseError()
+{
+  Interp *interp = currentInterp();
+  if ( interp->onError )
+    longjmp( *interp->onError, 1 );
+
+  fprintf( stderr, "%s\n", interp->message );
+  exit( EXIT_FAILURE );
+}
+
+void setInterpOutput( Interp *interp, FILE *out )
+{
+  interp->out = out;
+}
+
+void setInterpUnbuffered( Interp *interp, bool enable )
+{
+  interp->unbuffered = enable;
+}
+
+void setInterpValueSemantics( Interp *interp, bool enable )
+{
+  interp->valueSemantics = enable;
+}
+
+void setInterpProfile( Interp *interp, bool enable )
+{
+  if ( enable && !interp->profile )
+    interp->profile = makeProfile();
+  interp->profiling = enable;
+}
+
+void setInterpCache( Interp *interp, char const *dir )
+{
+  interp->cacheDir = dir;
+}
+
+void setInterpMemStats( Interp *interp, bool enable )
+{
+  trackSequences( interp, enable );
+}
+
+char const *interpError( Interp const *interp )
+{
+  return interp->message;
+}
+
+void interpPrintStats( Interp const *interp, FILE *fp )
+{
+  fprintf( fp, "fused increments: %d\n", interp->fusedIncrements );
+  fprintf( fp, "fused length tests: %d\n", interp->fusedLengthTests );
+  fprintf( fp, "fused indexes: %d\n", interp->fusedIndexes );
+  fprintf( fp, "folded constants: %d\n", interp->foldedConstants );
+  fprintf( fp, "element storage: peak %ld bytes, %ld saved by narrow "
+           "elements\n", interp->maxElementBytes,
+           interp->maxIntElementBytes - interp->maxElementBytes );
+  fprintf( fp, "sequences: %ld made, %ld freed\n", interp->sequencesMade,
+           interp->sequencesFreed );
+}
+
+void interpPrintMemStats( Interp const *interp, FILE *fp )
+{
+  printMemStats( interp, fp );
+}
+
+void interpPrintProfile( Interp const *interp, FILE *source, FILE *fp )
+{
+  if ( interp->profile )
+    printProfile( interp->profile, source, fp );
+  fprintf( fp, "sequences: %ld made, %ld freed\n", interp->sequencesMade,
+           interp->sequencesFreed );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Running programs
+
+/** Start an entry point, making the context current and clearing its
+    last error.
+    @param interp context for the entry point.
+    @return the context that was current before.
+*/
+static Interp *enter( Interp *interp )
+{
+  Interp *previous = setCurrentInterp( interp );
+  interp->status = INTERP_OK;
+  interp->message[ 0 ] = '\0';
+  return previous;
+}
+
+/** Free the temporary values an error left behind, on the VM's stack
+    and held by the tree-walking evaluator.  The stack goes first, since
+    a value on it might also be held.
+    @param interp context the error was raised in.
+    @param held number of sequences that were held when the entry point
+    started.
+*/
+static void releaseTemporaries( Interp *interp, int held )
+{
+  releaseStack( interp );
+  releaseHeld( interp, held );
+}
+
+/** Finish an entry point, writing out buffered output and restoring
+    the context that was current before.
+    @param interp context for the entry point.
+    @param previous context returned by enter().
+    @return the status of the entry point.
+*/
+static InterpStatus leave( Interp *interp, Interp *previous )
+{
+  flushOutput();
+  setCurrentInterp( previous );
+  return interp->status;
+}
+
+InterpStatus interpRunFile( Interp *interp, FILE *fp, Environment *env,
+                            bool vm )
+{
+  Interp *previous = enter( interp );
+  interp->lineCount = 1;
+
+  // Each statement gets its own tree, in an arena we reset after it runs.
+  if ( !interp->runArena )
+    interp->runArena = makeArena();
+  Arena *arena = interp->runArena;
+  Arena *oldArena = setSyntaxArena( arena );
+  Tokenizer *tz = makeTokenizer( fp );
+
+  // Current statement and its code, so we can free them after an error.
+  Stmt *volatile stmt = NULL;
+  Code *volatile code = NULL;
+
+  jmp_buf onError;
+  jmp_buf *oldError = interp->onError;
+  interp->onError = &onError;
+  int held = interp->heldLen;
+
+  if ( setjmp( onError ) == 0 ) {
+    Token tok;
+    while ( parseToken( tz, &tok ) ) {
+      stmt = parseStmt( &tok, tz );
+
+      // Run the statement, either directly or as compiled code.
+      if ( vm ) {
+        code = compileStmt( stmt );
+        runCode( code, env );
+        freeCode( code );
+        code = NULL;
+      } else {
+        specializeStmt( stmt, env );
+        if ( interp->profiling )
+          profileStmt( stmt, interp->profile );
+        stmt->execute( stmt, env );
+      }
+
+      // Delete the statement, then reuse its memory for the next one.
+      stmt->destroy( stmt );
+      stmt = NULL;
+      countArenaFreed( arena );
+      resetArena( arena );
+    }
+  } else {
+    releaseTemporaries( interp, held );
+    if ( code )
+      freeCode( code );
+    if ( stmt )
+      stmt->destroy( stmt );
+  }
+
+  interp->onError = oldError;
+  freeTokenizer( tz );
+  setSyntaxArena( oldArena );
+  countArenaFreed( arena );
+  resetArena( arena );
+  return leave( interp, previous );
+}
+
+InterpStatus interpLoad( Interp *interp, FILE *fp, Program **prog )
+{
+  Interp *previous = enter( interp );
+  interp->lineCount = 1;
+
+  jmp_buf onError;
+  jmp_buf *oldError = interp->onError;
+  interp->onError = &onError;
+  int held = interp->heldLen;
+
+  *prog = NULL;
+  if ( setjmp( onError ) == 0 )
+    *prog = interp->cacheDir ? loadCachedProgram( fp, interp->cacheDir )
+      : loadProgram( fp );
+  else
+    releaseTemporaries( interp, held );
+
+  interp->onError = oldError;
+  return leave( interp, previous );
+}
+
+InterpStatus interpRun( Interp *interp, Program *prog, Environment *env,
+                        bool vm )
+{
+  Interp *previous = enter( interp );
+
+  jmp_buf onError;
+  jmp_buf *oldError = interp->onError;
+  interp->onError = &onError;
+  int held = interp->heldLen;
+
+  if ( setjmp( onError ) == 0 )
+    runProgram( prog, env, vm );
+  else
+    releaseTemporaries( interp, held );
+
+  interp->onError = oldError;
+  return leave( interp, previous );
+}
+
+InterpStatus interpSaveEnv( Interp *interp, Environment *env,
+                            char const *path )
+{
+  Interp *previous = enter( interp );
+
+  jmp_buf onError;
+  jmp_buf *oldError = interp->onError;
+  interp->onError = &onError;
+  int held = interp->heldLen;
+
+  if ( setjmp( onError ) == 0 )
+    saveSnapshot( env, path );
+  else
+    releaseTemporaries( interp, held );
+
+  interp->onError = oldError;
+  return leave( interp, previous );
+}
+
+InterpStatus interpLoadEnv( Interp *interp, Environment *env,
+                            char const *path )
+{
+  Interp *previous = enter( interp );
+
+  jmp_buf onError;
+  jmp_buf *oldError = interp->onError;
+  interp->onError = &onError;
+  int held = interp->heldLen;
+
+  if ( setjmp( onError ) == 0 )
+    loadSnapshot( env, path );
+  else
+    releaseTemporaries( interp, held );
+
+  interp->onError = oldError;
+  return leave( interp, previous );
+}
@@ -0,0 +1,210 @@
+/**
+  @file interp.h
+  @author Sean Hinton (sahinto2)
+
+  Embedding interface for the interpreter, built as libinterp.  All the
+  state the interpreter needs while it parses and runs a program lives
+  in an Interp context, so separate threads can each run programs at the
+  same time, one context per thread.  Errors in a program are returned
+  as a status, with a message available from interpError(), instead of
+  exiting.
+*/
+
+#ifndef _INTERP_H_
+#define _INTERP_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "value.h"
+#include "program.h"
+
+/** Short name for an interpreter context, its representation is hidden
+    from embedding code. */
+typedef struct InterpStruct Interp;
+
+/** Result of parsing or running a program. */
+typedef enum {
+  /** Everything worked. */
+  INTERP_OK,
+
+  /** The program isn't well formed, the error is in the source. */
+  INTERP_SYNTAX_ERROR,
+
+  /** The program was well formed, but failed while it was running. */
+  INTERP_RUNTIME_ERROR
+} InterpStatus;
+
+/** Make a new interpreter context, with output going to standard output.
+    @return new, dynamically allocated context.  The caller must
+    eventually free it with freeInterp().
+*/
+Interp *makeInterp();
+
+/** Free a context, writing any output it still has buffered.  Programs
+    it loaded must be freed first.
+    @param interp context to free.
+*/
+void freeInterp( Interp *interp );
+
+/** Make the given context the current one for this thread.  The entry
+    points below do this themselves, but sequences and environments made
+    or freed outside them (freeEnvironment(), for example) are counted
+    and recycled in the current context, so a thread with a context of
+    its own should make it current first.
+    @param interp context to use, or NULL for the default one.
+    @return the context that was current before, so it can be restored.
+*/
+Interp *setCurrentInterp( Interp *interp );
+
+/** Choose where a context writes the output of print statements.
+    @param interp context to change.
+    @param out stream for output.
+*/
+void setInterpOutput( Interp *interp, FILE *out );
+
+/** Choose whether a context writes its output after every print
+    statement, rather than when its buffer fills.
+    @param interp context to change.
+    @param enable true to write after every print.
+*/
+void setInterpUnbuffered( Interp *interp, bool enable );
+
+/** Choose whether assigning a sequence copies it (value semantics) or
+    makes another reference to it, the default.
+    @param interp context to change.
+    @param enable true for value semantics.
+*/
+void setInterpValueSemantics( Interp *interp, bool enable );
+
+/** Choose whether programs run in a context with the tree-walking
+    evaluator are profiled, counting how many times each part of them
+    runs and how long it takes.  The counts are kept until the context is
+    freed (see interpPrintProfile()).  Bytecode isn't profiled.
+    @param interp context to change.
+    @param enable true to profile.
+*/
+void setInterpProfile( Interp *interp, bool enable );
+
+/** Choose a directory for a cache of compiled scripts, so a program
+    loaded with interpLoad() isn't parsed again if its source hasn't
+    changed since it was cached (see loadCachedProgram()).
+    @param interp context to change.
+    @param dir cache directory, or NULL to always parse.  The context
+    keeps the pointer, so the string has to outlive it.
+*/
+void setInterpCache( Interp *interp, char const *dir );
+
+/** Choose whether a context keeps track of every sequence it makes that
+    hasn't been freed yet, so interpPrintMemStats() can report the ones
+    left over as leaks.  Memory is counted either way; this just adds a
+    table lookup each time a sequence is made or freed.
+    @param interp context to change.
+    @param enable true to keep track.
+*/
+void setInterpMemStats( Interp *interp, bool enable );
+
+/** Parse and run a program one top-level statement at a time, the way
+    the interpret command does by default.  Statements before an error
+    have already run when it's reported.  If the source is a pipe,
+    terminal or socket, each statement runs as soon as it arrives, and
+    output is written whenever we have to wait for more of the source.
+    @param interp context to run in.
+    @param fp source of the program.
+    @param env environment for the program's variables.  It should only
+    be used with this context.
+    @param vm true to run each statement as compiled code on the VM.
+    @return INTERP_OK if the whole program ran.
+*/
+InterpStatus interpRunFile( Interp *interp, FILE *fp, Environment *env,
+                            bool vm );
+
+/** Parse a whole program, so it can be run any number of times.
+    @param interp context to parse in.  The program's variables are
+    resolved in this context, so the program should only be run in it.
+    @param fp source of the program.
+    @param prog returns the new program, if the status is INTERP_OK.  It
+    must eventually be freed with freeProgram().
+    @return INTERP_OK, or INTERP_SYNTAX_ERROR.
+*/
+InterpStatus interpLoad( Interp *interp, FILE *fp, Program **prog );
+
+/** Run a program parsed by interpLoad().
+    @param interp context the program was loaded in.
+    @param prog program to run.
+    @param env environment for the program's variables.
+    @param vm true to run the program on the VM.
+    @return INTERP_OK, or INTERP_RUNTIME_ERROR.
+*/
+InterpStatus interpRun( Interp *interp, Program *prog, Environment *env,
+                        bool vm );
+
+/** Save every variable in an environment to an image file, so a later
+    run can start from the same state with interpLoadEnv() instead of
+    running the statements that built it.  Sequences shared by several
+    variables are saved once and still shared when they're loaded.
+    @param interp context the environment was used with.
+    @param env environment to save.
+    @param path file to write the image to.
+    @return INTERP_OK, or INTERP_RUNTIME_ERROR if the image can't be
+    written.
+*/
+InterpStatus interpSaveEnv( Interp *interp, Environment *env,
+                            char const *path );
+
+/** Give the variables saved in an image file by interpSaveEnv() their
+    values in an environment.  The image is mapped into memory and
+    sequences use their elements right where they are until they're
+    changed, so loading takes time for the number of sequences, not
+    their length.  The image stays mapped until the context is freed, so
+    the environment has to be freed first.
+    @param interp context to load in.  The variables are resolved in
+    it, so the environment should only be used in this context.
+    @param env environment to load into.
+    @param path image file to load.
+    @return INTERP_OK, or INTERP_RUNTIME_ERROR if the file can't be read
+    or isn't an image.
+*/
+InterpStatus interpLoadEnv( Interp *interp, Environment *env,
+                            char const *path );
+
+/** Return the message for the last error in a context, in the same form
+    the interpret command prints it.
+    @param interp context to look at.
+    @return message for the last error, or an empty string if there
+    hasn't been one.
+*/
+char const *interpError( Interp const *interp );
+
+/** Print counters describing how the programs parsed in a context were
+    optimized, such as how many times each peephole rewrite fired, how
+    much storage the elements of their sequences took, and how many
+    sequences they made.
+    @param interp context to report on.
+    @param fp stream to print the counters to.
+*/
+void interpPrintStats( Interp const *interp, FILE *fp );
+
+/** Print how much memory each kind of object has used in a context:
+    syntax tree nodes, sequence headers, sequence elements and
+    environments, with the number of allocations, frees and growths and
+    the most bytes in use at once.  If the context is keeping track of
+    sequences (see setInterpMemStats()), this is followed by the ones
+    that haven't been freed, so environments and programs should be freed
+    first.
+    @param interp context to report on.
+    @param fp stream to print the report to.
+*/
+void interpPrintMemStats( Interp const *interp, FILE *fp );
+
+/** Print the profile collected in a context, the lines of the program
+    that took the most time first, along with the number of sequences
+    made and freed.
+    @param interp context to report on.
+    @param source program the profile is for, to show the text of each
+    line, or NULL to show just line numbers.
+    @param fp stream to print the report to.
+*/
+void interpPrintProfile( Interp const *interp, FILE *source, FILE *fp );
+
+#endif
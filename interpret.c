@@ -5,59 +5,276 @@
  * This is the top level component of the parser program that reads in lines of input.
  * It reads in lines of input until no more lines are found.
  * It is also responsible for controlling the lifecycle of the environment of variables.
+ * Everything else comes from libinterp, through the interface in interp.h.
 */
 
+// For clock_gettime() and sysconf().
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "value.h"
-#include "syntax.h"
-#include "parse.h"
+#include "interp.h"
+#include "batch.h"
 
 
-#define ARGS 2
 /** Print a usage message then exit unsuccessfully. */
 void usage()
 {
-  fprintf( stderr, "usage: interpret <program-file>\n" );
+  fprintf( stderr,
+           "usage: interpret [--vm] [--value-semantics] [--unbuffered] "
+           "[--time] [--runs=N]\n"
+           "                 [--stats] [--mem-stats] [--profile] "
+           "[--load-env=FILE]\n"
+           "                 [--save-env=FILE] [--cache=DIR] "
+           "<program-file|->\n"
+           "       interpret --batch [--jobs=N] [--vm] [--value-semantics] "
+           "[--time] <directory|list-file>\n"
+           "With --runs=N for more than one run, or --cache, the whole "
+           "program is parsed\n"
+           "before any of it runs, so a syntax error stops it before it "
+           "prints anything.\n" );
   exit( EXIT_FAILURE );
 }
 
+/** Current time in seconds, from a monotonic clock. */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Names of the environment images a run starts from and saves to. */
+typedef struct {
+  /** Image to load before the program runs, or NULL. */
+  char const *load;
+
+  /** Image to save the variables to after it runs, or NULL. */
+  char const *save;
+} EnvFiles;
+
+/** Run a program in a new environment, starting from a saved image and
+    saving the environment at the end if we're asked to.
+    @param interp context to run the program in.
+    @param files images to load and save.
+    @param run function that runs the program, interpRunFile() or
+    interpRun() wrapped to take the same parameters.
+    @param data whatever the function needs to find the program.
+    @param vm true if the program should run on the VM.
+    @return status of the first thing that failed, or INTERP_OK.
+*/
+static InterpStatus runInEnvironment( Interp *interp, EnvFiles const *files,
+                                      InterpStatus (*run)( Interp *interp,
+                                                           void *data,
+                                                           Environment *env,
+                                                           bool vm ),
+                                      void *data, bool vm )
+{
+  Environment *env = makeEnvironment();
+  InterpStatus status = INTERP_OK;
+  if ( files->load )
+    status = interpLoadEnv( interp, env, files->load );
+  if ( status == INTERP_OK )
+    status = run( interp, data, env, vm );
+  if ( status == INTERP_OK && files->save )
+    status = interpSaveEnv( interp, env, files->save );
+  freeEnvironment( env );
+  return status;
+}
+
+/** Run a program a statement at a time, for runInEnvironment(). */
+static InterpStatus runFile( Interp *interp, void *data, Environment *env,
+                             bool vm )
+{
+  return interpRunFile( interp, (FILE *) data, env, vm );
+}
+
+/** Run a whole program, for runInEnvironment(). */
+static InterpStatus runLoaded( Interp *interp, void *data, Environment *env,
+                               bool vm )
+{
+  return interpRun( interp, (Program *) data, env, vm );
+}
+
+/** Parse the whole program before running any of it, then run it one or
+    more times, each with a fresh environment.
+    @param interp context to run the program in.
+    @param fp source of the program.
+    @param files images each run loads and saves.
+    @param vm true if the program should run on the VM.
+    @param runs number of times to run the program.
+    @param timing true if we should report how long parsing and running
+    took, on standard error.
+    @return status of loading or running the program.
+*/
+static InterpStatus runWholeProgram( Interp *interp, FILE *fp,
+                                     EnvFiles const *files, bool vm,
+                                     int runs, bool timing )
+{
+  double start = now();
+  Program *prog;
+  InterpStatus status = interpLoad( interp, fp, &prog );
+  if ( status != INTERP_OK )
+    return status;
+  double parsed = now();
+
+  for ( int i = 0; status == INTERP_OK && i < runs; i++ )
+    status = runInEnvironment( interp, files, runLoaded, prog, vm );
+  double finished = now();
+
+  if ( timing && status == INTERP_OK ) {
+    fprintf( stderr, "parse: %.3f ms\n", ( parsed - start ) * 1000 );
+    fprintf( stderr, "execute: %.3f ms", ( finished - parsed ) * 1000 );
+    if ( runs > 1 )
+      fprintf( stderr, " (%.3f ms per run)",
+               ( finished - parsed ) * 1000 / runs );
+    fprintf( stderr, "\n" );
+  }
+
+  freeProgram( prog );
+  return status;
+}
+
 int main( int argc, char *argv[] )
 {
-  // Open the program's source.
-  if ( argc != ARGS )
-  
+  // Context holding the interpreter's state.  It's current for the whole
+  // run, so freeing environments is counted in it too.
+  Interp *interp = makeInterp();
+  setCurrentInterp( interp );
+
+  // Should we compile each statement to bytecode and run it on the VM?
+  bool vm = false;
+
+  // Should assigning a sequence copy it?
+  bool values = false;
+
+  // Should we report parse and execution time?
+  bool timing = false;
+
+  // How many times to run the program.
+  int runs = 1;
+
+  // Should we report how the program was optimized?
+  bool stats = false;
+
+  // Should we report how much memory the program used, and what it
+  // didn't free?
+  bool memStats = false;
+
+  // Should we report where the program spent its time?
+  bool profile = false;
+
+  // Environment images to start from and save to.
+  EnvFiles files = { NULL, NULL };
+
+  // Directory for the compiled script cache, or NULL.
+  char const *cache = NULL;
+
+  // Are we running a whole batch of programs, and with how many threads?
+  bool batch = false;
+  long jobs = sysconf( _SC_NPROCESSORS_ONLN );
+
+  // Look for options before the program file.
+  int arg = 1;
+  while ( arg < argc && strncmp( argv[ arg ], "--", 2 ) == 0 ) {
+    if ( strcmp( argv[ arg ], "--vm" ) == 0 )
+      vm = true;
+    else if ( strcmp( argv[ arg ], "--value-semantics" ) == 0 )
+      values = true;
+    else if ( strcmp( argv[ arg ], "--unbuffered" ) == 0 )
+      setInterpUnbuffered( interp, true );
+    else if ( strcmp( argv[ arg ], "--time" ) == 0 )
+      timing = true;
+    else if ( strcmp( argv[ arg ], "--stats" ) == 0 )
+      stats = true;
+    else if ( strcmp( argv[ arg ], "--mem-stats" ) == 0 )
+      memStats = true;
+    else if ( strcmp( argv[ arg ], "--profile" ) == 0 )
+      profile = true;
+    else if ( strncmp( argv[ arg ], "--load-env=", 11 ) == 0 )
+      files.load = argv[ arg ] + 11;
+    else if ( strncmp( argv[ arg ], "--save-env=", 11 ) == 0 )
+      files.save = argv[ arg ] + 11;
+    else if ( strncmp( argv[ arg ], "--cache=", 8 ) == 0 )
+      cache = argv[ arg ] + 8;
+    else if ( strncmp( argv[ arg ], "--runs=", 7 ) == 0 ) {
+      char extra;
+      if ( sscanf( argv[ arg ] + 7, "%d%c", &runs, &extra ) != 1 || runs < 1 )
+        usage();
+    } else if ( strcmp( argv[ arg ], "--batch" ) == 0 )
+      batch = true;
+    else if ( strncmp( argv[ arg ], "--jobs=", 7 ) == 0 ) {
+      char extra;
+      if ( sscanf( argv[ arg ] + 7, "%ld%c", &jobs, &extra ) != 1 || jobs < 1 )
+        usage();
+    } else
+      usage();
+    arg++;
+  }
+
+  // Only the tree-walking evaluator can be profiled.
+  if ( arg != argc - 1 || ( profile && ( vm || batch ) ) )
+    usage();
+
+  if ( batch && ( files.load || files.save || cache || memStats ) )
     usage();
-  
-  FILE *fp = fopen( argv[ 1 ], "r" );
+
+  if ( batch ) {
+    BatchOptions opts = { jobs > 0 ? jobs : 1, vm, values, timing };
+    freeInterp( interp );
+    return runBatch( argv[ arg ], &opts ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  setInterpValueSemantics( interp, values );
+  setInterpProfile( interp, profile );
+  setInterpCache( interp, cache );
+  setInterpMemStats( interp, memStats );
+
+  // Open the program's source, a dash means it's streamed on standard
+  // input.
+  bool streamed = strcmp( argv[ arg ], "-" ) == 0;
+  FILE *fp = streamed ? stdin : fopen( argv[ arg ], "r" );
   if ( !fp ) {
-    perror( argv[ 1 ] );
+    perror( argv[ arg ] );
     exit( EXIT_FAILURE );
   }
 
-  // Environment, for storing variable values.
-  Environment *env = makeEnvironment();
-  
-  // Parse one statement at a time, then run each statement
-  // using the same Environment.
-  char tok[ MAX_TOKEN + 1 ];
-  while ( parseToken( tok, fp ) ) {
-    // Parse the next input statement.
-    Stmt *stmt = parseStmt( tok, fp );
-
-    // Run the statement.
-    stmt->execute( stmt, env );
-
-    // Delete the statement.
-    stmt->destroy( stmt );
+  InterpStatus status;
+  if ( runs > 1 || cache ) {
+    // Repeated runs and the cache need the whole program parsed up
+    // front.
+    status = runWholeProgram( interp, fp, &files, vm, runs, timing );
+  } else {
+    // Parse one statement at a time, then run each statement
+    // using the same Environment.  Parsing and running are mixed
+    // together, so they're timed together.
+    double start = now();
+    status = runInEnvironment( interp, &files, runFile, fp, vm );
+    if ( timing && status == INTERP_OK )
+      fprintf( stderr, "parse and execute: %.3f ms\n",
+               ( now() - start ) * 1000 );
+  }
+
+  // We're done, close the input file.  Errors are reported once
+  // everything the program printed has been written.
+  if ( profile )
+    interpPrintProfile( interp, fp, stderr );
+  if ( !streamed )
+    fclose( fp );
+  if ( stats )
+    interpPrintStats( interp, stderr );
+  if ( memStats )
+    interpPrintMemStats( interp, stderr );
+  if ( status != INTERP_OK ) {
+    fprintf( stderr, "%s\n", interpError( interp ) );
+    exit( EXIT_FAILURE );
   }
-  
-  // We're done, close the input file and free the environment.
-  fclose( fp );
-  freeEnvironment( env );
 
+  freeInterp( interp );
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,347 @@
+/**
+ * @file kernel.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of the bulk kernels.  Each kernel has a plain version,
+ * used for the elements left over at the end and on machines without
+ * vector instructions, and vector versions chosen when each kernel runs.
+*/
+#include "kernel.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Pick the vector instructions we can compile for.
+#if !defined( KERNEL_SCALAR ) && defined( __GNUC__ ) && defined( __x86_64__ )
+#define KERNEL_X86
+#include <immintrin.h>
+#elif !defined( KERNEL_SCALAR ) && defined( __ARM_NEON ) && defined( __aarch64__ )
+#define KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Plain versions
+
+// Comparing is done a byte at a time, whatever the element width.  The
+// first byte that differs is in the first element that differs.
+
+/** Plain version of kernelMismatch(), on bytes starting from a given
+    index. */
+static int mismatchScalar( unsigned char const *a, unsigned char const *b,
+                           int i, int n )
+{
+  while ( i < n && a[ i ] == b[ i ] )
+    i++;
+  return i;
+}
+
+/** Plain version of kernelFill(), starting from a given element. */
+static void fillScalar( void *dest, int val, int i, int n, int width )
+{
+  if ( width == 2 ) {
+    for ( ; i < n; i++ )
+      ( (int16_t *) dest )[ i ] = (int16_t) val;
+  } else {
+    for ( ; i < n; i++ )
+      ( (int32_t *) dest )[ i ] = val;
+  }
+}
+
+/** Plain version of kernelNarrow(), starting from a given element. */
+static void narrowScalar( char *dest, void const *src, int i, int n,
+                          int width )
+{
+  if ( width == 2 ) {
+    for ( ; i < n; i++ )
+      dest[ i ] = (char) ( (int16_t const *) src )[ i ];
+  } else {
+    for ( ; i < n; i++ )
+      dest[ i ] = (char) ( (int32_t const *) src )[ i ];
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// x86 versions
+
+#if defined( KERNEL_X86 )
+
+/** True if the CPU can run the AVX2 versions.  SSE2 is part of every
+    x86-64 CPU, so it's the fallback. */
+static bool hasAVX2()
+{
+  return __builtin_cpu_supports( "avx2" );
+}
+
+__attribute__(( target( "avx2" ) ))
+static int mismatchAVX2( unsigned char const *a, unsigned char const *b,
+                         int n )
+{
+  int i = 0;
+  for ( ; i + 32 <= n; i += 32 ) {
+    __m256i va = _mm256_loadu_si256( (__m256i const *) ( a + i ) );
+    __m256i vb = _mm256_loadu_si256( (__m256i const *) ( b + i ) );
+    unsigned mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8( va, vb ) );
+    if ( mask != 0xFFFFFFFFu )
+      return i + __builtin_ctz( ~mask );
+  }
+  return mismatchScalar( a, b, i, n );
+}
+
+static int mismatchSSE2( unsigned char const *a, unsigned char const *b,
+                         int n )
+{
+  int i = 0;
+  for ( ; i + 16 <= n; i += 16 ) {
+    __m128i va = _mm_loadu_si128( (__m128i const *) ( a + i ) );
+    __m128i vb = _mm_loadu_si128( (__m128i const *) ( b + i ) );
+    unsigned mask = _mm_movemask_epi8( _mm_cmpeq_epi8( va, vb ) );
+    if ( mask != 0xFFFFu )
+      return i + __builtin_ctz( ~mask );
+  }
+  return mismatchScalar( a, b, i, n );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void fillAVX2( void *dest, int val, int n, int width )
+{
+  __m256i v = width == 2 ? _mm256_set1_epi16( (short) val )
+                         : _mm256_set1_epi32( val );
+  int step = 32 / width;
+  int i = 0;
+  for ( ; i + step <= n; i += step )
+    _mm256_storeu_si256( (__m256i *) ( (char *) dest + i * width ), v );
+  fillScalar( dest, val, i, n, width );
+}
+
+static void fillSSE2( void *dest, int val, int n, int width )
+{
+  __m128i v = width == 2 ? _mm_set1_epi16( (short) val )
+                         : _mm_set1_epi32( val );
+  int step = 16 / width;
+  int i = 0;
+  for ( ; i + step <= n; i += step )
+    _mm_storeu_si128( (__m128i *) ( (char *) dest + i * width ), v );
+  fillScalar( dest, val, i, n, width );
+}
+
+// The pack instructions saturate, so every element is masked down to
+// its low byte first.  Then packing can't change any of them.
+
+__attribute__(( target( "avx2" ) ))
+static void narrowAVX2( char *dest, int32_t const *src, int n )
+{
+  __m256i low = _mm256_set1_epi32( 0xFF );
+
+  // Packing works within each 128-bit half, this puts the groups of four
+  // back in order.
+  __m256i order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+  int i = 0;
+  for ( ; i + 32 <= n; i += 32 ) {
+    __m256i a = _mm256_and_si256(
+      _mm256_loadu_si256( (__m256i const *) ( src + i ) ), low );
+    __m256i b = _mm256_and_si256(
+      _mm256_loadu_si256( (__m256i const *) ( src + i + 8 ) ), low );
+    __m256i c = _mm256_and_si256(
+      _mm256_loadu_si256( (__m256i const *) ( src + i + 16 ) ), low );
+    __m256i d = _mm256_and_si256(
+      _mm256_loadu_si256( (__m256i const *) ( src + i + 24 ) ), low );
+    __m256i bytes = _mm256_packus_epi16( _mm256_packs_epi32( a, b ),
+                                         _mm256_packs_epi32( c, d ) );
+    _mm256_storeu_si256( (__m256i *) ( dest + i ),
+                         _mm256_permutevar8x32_epi32( bytes, order ) );
+  }
+  narrowScalar( dest, src, i, n, 4 );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void narrowShortsAVX2( char *dest, int16_t const *src, int n )
+{
+  __m256i low = _mm256_set1_epi16( 0xFF );
+  int i = 0;
+  for ( ; i + 32 <= n; i += 32 ) {
+    __m256i a = _mm256_and_si256(
+      _mm256_loadu_si256( (__m256i const *) ( src + i ) ), low );
+    __m256i b = _mm256_and_si256(
+      _mm256_loadu_si256( (__m256i const *) ( src + i + 16 ) ), low );
+
+    // Same problem with the halves, but here they're groups of eight.
+    __m256i bytes = _mm256_permute4x64_epi64( _mm256_packus_epi16( a, b ),
+                                              0xD8 );
+    _mm256_storeu_si256( (__m256i *) ( dest + i ), bytes );
+  }
+  narrowScalar( dest, src, i, n, 2 );
+}
+
+static void narrowSSE2( char *dest, int32_t const *src, int n )
+{
+  __m128i low = _mm_set1_epi32( 0xFF );
+  int i = 0;
+  for ( ; i + 16 <= n; i += 16 ) {
+    __m128i a = _mm_and_si128(
+      _mm_loadu_si128( (__m128i const *) ( src + i ) ), low );
+    __m128i b = _mm_and_si128(
+      _mm_loadu_si128( (__m128i const *) ( src + i + 4 ) ), low );
+    __m128i c = _mm_and_si128(
+      _mm_loadu_si128( (__m128i const *) ( src + i + 8 ) ), low );
+    __m128i d = _mm_and_si128(
+      _mm_loadu_si128( (__m128i const *) ( src + i + 12 ) ), low );
+    __m128i bytes = _mm_packus_epi16( _mm_packs_epi32( a, b ),
+                                      _mm_packs_epi32( c, d ) );
+    _mm_storeu_si128( (__m128i *) ( dest + i ), bytes );
+  }
+  narrowScalar( dest, src, i, n, 4 );
+}
+
+static void narrowShortsSSE2( char *dest, int16_t const *src, int n )
+{
+  __m128i low = _mm_set1_epi16( 0xFF );
+  int i = 0;
+  for ( ; i + 16 <= n; i += 16 ) {
+    __m128i a = _mm_and_si128(
+      _mm_loadu_si128( (__m128i const *) ( src + i ) ), low );
+    __m128i b = _mm_and_si128(
+      _mm_loadu_si128( (__m128i const *) ( src + i + 8 ) ), low );
+    _mm_storeu_si128( (__m128i *) ( dest + i ), _mm_packus_epi16( a, b ) );
+  }
+  narrowScalar( dest, src, i, n, 2 );
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// ARM versions
+
+#if defined( KERNEL_NEON )
+
+static int mismatchNEON( unsigned char const *a, unsigned char const *b,
+                         int n )
+{
+  int i = 0;
+  for ( ; i + 16 <= n; i += 16 ) {
+    uint8x16_t same = vceqq_u8( vld1q_u8( a + i ), vld1q_u8( b + i ) );
+    if ( vminvq_u8( same ) == 0 )
+      break;
+  }
+  return mismatchScalar( a, b, i, n );
+}
+
+static void fillNEON( void *dest, int val, int n, int width )
+{
+  int i = 0;
+  if ( width == 2 ) {
+    int16x8_t v = vdupq_n_s16( (int16_t) val );
+    for ( ; i + 8 <= n; i += 8 )
+      vst1q_s16( (int16_t *) dest + i, v );
+  } else {
+    int32x4_t v = vdupq_n_s32( val );
+    for ( ; i + 4 <= n; i += 4 )
+      vst1q_s32( (int32_t *) dest + i, v );
+  }
+  fillScalar( dest, val, i, n, width );
+}
+
+static void narrowNEON( char *dest, int32_t const *src, int n )
+{
+  int i = 0;
+  for ( ; i + 8 <= n; i += 8 ) {
+    // The narrowing moves keep the low half of each element.
+    int16x8_t halves = vcombine_s16( vmovn_s32( vld1q_s32( src + i ) ),
+                                     vmovn_s32( vld1q_s32( src + i + 4 ) ) );
+    vst1_s8( (int8_t *) ( dest + i ), vmovn_s16( halves ) );
+  }
+  narrowScalar( dest, src, i, n, 4 );
+}
+
+static void narrowShortsNEON( char *dest, int16_t const *src, int n )
+{
+  int i = 0;
+  for ( ; i + 8 <= n; i += 8 )
+    vst1_s8( (int8_t *) ( dest + i ), vmovn_s16( vld1q_s16( src + i ) ) );
+  narrowScalar( dest, src, i, n, 2 );
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Choosing a version
+
+int kernelMismatch( void const *a, void const *b, int n, int width )
+{
+  // Views of the same elements are trivially the same.
+  if ( a == b )
+    return n;
+
+  unsigned char const *x = (unsigned char const *) a;
+  unsigned char const *y = (unsigned char const *) b;
+  int bytes = n * width;
+#if defined( KERNEL_X86 )
+  int i = hasAVX2() ? mismatchAVX2( x, y, bytes )
+                    : mismatchSSE2( x, y, bytes );
+#elif defined( KERNEL_NEON )
+  int i = mismatchNEON( x, y, bytes );
+#else
+  int i = mismatchScalar( x, y, 0, bytes );
+#endif
+  return i / width;
+}
+
+void kernelFill( void *dest, int val, int n, int width )
+{
+  // The C library already does bytes as fast as anything.
+  if ( width == 1 ) {
+    memset( dest, val, n );
+    return;
+  }
+
+#if defined( KERNEL_X86 )
+  if ( hasAVX2() )
+    fillAVX2( dest, val, n, width );
+  else
+    fillSSE2( dest, val, n, width );
+#elif defined( KERNEL_NEON )
+  fillNEON( dest, val, n, width );
+#else
+  fillScalar( dest, val, 0, n, width );
+#endif
+}
+
+void kernelNarrow( char *dest, void const *src, int n, int width )
+{
+  // Bytes are already narrow.
+  if ( width == 1 ) {
+    memcpy( dest, src, n );
+    return;
+  }
+
+#if defined( KERNEL_X86 )
+  if ( width == 2 ) {
+    if ( hasAVX2() )
+      narrowShortsAVX2( dest, src, n );
+    else
+      narrowShortsSSE2( dest, src, n );
+  } else {
+    if ( hasAVX2() )
+      narrowAVX2( dest, src, n );
+    else
+      narrowSSE2( dest, src, n );
+  }
+#elif defined( KERNEL_NEON )
+  if ( width == 2 )
+    narrowShortsNEON( dest, src, n );
+  else
+    narrowNEON( dest, src, n );
+#else
+  narrowScalar( dest, src, 0, n, width );
+#endif
+}
+
+char const *kernelName()
+{
+#if defined( KERNEL_X86 )
+  return hasAVX2() ? "avx2" : "sse2";
+#elif defined( KERNEL_NEON )
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
@@ -0,0 +1,51 @@
+/**
+  @file kernel.h
+  @author Sean Hinton (sahinto2)
+
+  Bulk operations on the elements of sequences, which are stored one,
+  two or four bytes each (see Sequence in value.h).  On x86
+  the best version for the CPU is chosen when each one runs, AVX2 if
+  the CPU has it and SSE2 otherwise.  ARM builds use NEON, and anything
+  else gets plain loops.  Build with -DKERNEL_SCALAR to use the plain
+  loops everywhere.
+*/
+
+#ifndef _KERNEL_H_
+#define _KERNEL_H_
+
+/** Find the first place where two arrays of elements the same width
+    differ.
+    @param a first array.
+    @param b second array.
+    @param n number of elements in each.
+    @param width bytes per element, 1, 2 or 4.
+    @return index of the first element that isn't the same in both, or
+    n if they're identical.
+*/
+int kernelMismatch( void const *a, void const *b, int n, int width );
+
+/** Fill an array of elements with copies of one value.
+    @param dest array to fill.
+    @param val value to store in every element.  It has to fit in the
+    element width.
+    @param n number of elements to fill.
+    @param width bytes per element, 1, 2 or 4.
+*/
+void kernelFill( void *dest, int val, int n, int width );
+
+/** Narrow an array of elements to chars, keeping the low byte of each,
+    the way a sequence is printed.
+    @param dest where to put the chars.
+    @param src elements to narrow.
+    @param n number of elements.
+    @param width bytes per element, 1, 2 or 4.
+*/
+void kernelNarrow( char *dest, void const *src, int n, int width );
+
+/** Return the name of the instruction set the kernels are using on
+    this CPU, for benchmarks and diagnostics.
+    @return "avx2", "sse2", "neon" or "scalar".
+*/
+char const *kernelName();
+
+#endif
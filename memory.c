@@ -0,0 +1,236 @@
+/**
+ * @file memory.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of counted allocation, and the table of sequences that
+ * haven't been freed.  The table is open-addressed with linear probing,
+ * keyed by the address of each header.
+*/
+#include "memory.h"
+#include "context.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Initial number of entries in the table of sequences (a power of
+    two). */
+#define INITIAL_LIVE 64
+
+/** Most leaked sequences described one at a time in the report. */
+#define MAX_LEAKS 10
+
+/** Names of the kinds of memory, for the report. */
+static char const *const kindNames[ MEM_KINDS ] = {
+  [ MEM_NODE ] = "syntax nodes",
+  [ MEM_HEADER ] = "sequence headers",
+  [ MEM_ELEMENTS ] = "sequence elements",
+  [ MEM_ENVIRONMENT ] = "environments",
+};
+
+/** Add to the bytes in use for one kind of memory, and for all of them.
+    @param interp context doing the counting.
+    @param count counts for the kind of memory.
+    @param bytes bytes to add, negative when memory is freed.
+*/
+static void countBytes( Interp *interp, MemCount *count, long bytes )
+{
+  count->bytes += bytes;
+  if ( count->bytes > count->maxBytes )
+    count->maxBytes = count->bytes;
+
+  interp->memoryBytes += bytes;
+  if ( interp->memoryBytes > interp->maxMemoryBytes )
+    interp->maxMemoryBytes = interp->memoryBytes;
+}
+
+void countAlloc( MemKind kind, size_t size )
+{
+  Interp *interp = currentInterp();
+  interp->memory[ kind ].allocs++;
+  countBytes( interp, &interp->memory[ kind ], (long) size );
+}
+
+void *countedMalloc( MemKind kind, size_t size )
+{
+  countAlloc( kind, size );
+  return malloc( size );
+}
+
+void *countedCalloc( MemKind kind, size_t n, size_t size )
+{
+  countAlloc( kind, n * size );
+  return calloc( n, size );
+}
+
+void *countedRealloc( MemKind kind, void *ptr, size_t oldSize, size_t size )
+{
+  Interp *interp = currentInterp();
+  interp->memory[ kind ].reallocs++;
+  countBytes( interp, &interp->memory[ kind ], (long) size - (long) oldSize );
+  return realloc( ptr, size );
+}
+
+void countGrowth( MemKind kind )
+{
+  currentInterp()->memory[ kind ].reallocs++;
+}
+
+void countFree( MemKind kind, size_t size )
+{
+  Interp *interp = currentInterp();
+  interp->memory[ kind ].frees++;
+  countBytes( interp, &interp->memory[ kind ], -(long) size );
+}
+
+void countedFree( MemKind kind, void *ptr, size_t size )
+{
+  countFree( kind, size );
+  free( ptr );
+}
+
+void countArenaFreed( Arena const *arena )
+{
+  long count;
+  size_t bytes;
+  arenaUsage( arena, &count, &bytes );
+
+  Interp *interp = currentInterp();
+  interp->memory[ MEM_NODE ].frees += count;
+  countBytes( interp, &interp->memory[ MEM_NODE ], -(long) bytes );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sequences that haven't been freed
+
+/** Return the position a sequence's header hashes to in the table.
+    @param seq header to look for.
+    @param mask table size minus one.
+    @return where to start looking.
+*/
+static unsigned hashSequence( Sequence const *seq, unsigned mask )
+{
+  // Headers are aligned, so the low bits don't tell them apart.
+  return (unsigned) ( ( (uintptr_t) seq >> 4 ) * 2654435761u ) & mask;
+}
+
+/** Put a header in the table, which has room for it.
+    @param table the table.
+    @param cap number of entries in the table.
+    @param seq header to add.
+*/
+static void insertSequence( Sequence **table, int cap, Sequence *seq )
+{
+  unsigned mask = cap - 1;
+  unsigned pos = hashSequence( seq, mask );
+  while ( table[ pos ] )
+    pos = ( pos + 1 ) & mask;
+  table[ pos ] = seq;
+}
+
+void trackSequences( Interp *interp, bool enable )
+{
+  if ( enable && !interp->liveSequences ) {
+    interp->liveCap = INITIAL_LIVE;
+    interp->liveCount = 0;
+    interp->liveSequences = (Sequence **) calloc( interp->liveCap,
+                                                  sizeof( Sequence * ) );
+  } else if ( !enable ) {
+    freeMemStats( interp );
+  }
+}
+
+void addLiveSequence( Interp *interp, Sequence *seq )
+{
+  // Keep the table at most half full.
+  if ( ( interp->liveCount + 1 ) * DOUBLE_CAP > interp->liveCap ) {
+    int cap = interp->liveCap * DOUBLE_CAP;
+    Sequence **table = (Sequence **) calloc( cap, sizeof( Sequence * ) );
+    for ( int i = 0; i < interp->liveCap; i++ )
+      if ( interp->liveSequences[ i ] )
+        insertSequence( table, cap, interp->liveSequences[ i ] );
+    free( interp->liveSequences );
+    interp->liveSequences = table;
+    interp->liveCap = cap;
+  }
+
+  insertSequence( interp->liveSequences, interp->liveCap, seq );
+  interp->liveCount++;
+}
+
+void removeLiveSequence( Interp *interp, Sequence *seq )
+{
+  Sequence **table = interp->liveSequences;
+  unsigned mask = interp->liveCap - 1;
+  unsigned pos = hashSequence( seq, mask );
+  while ( table[ pos ] && table[ pos ] != seq )
+    pos = ( pos + 1 ) & mask;
+
+  // Sequences made before we started keeping track aren't in the table.
+  if ( !table[ pos ] )
+    return;
+
+  table[ pos ] = NULL;
+  interp->liveCount--;
+
+  // Entries after the one we removed might have probed past it, so they
+  // go back in, to close the gap.
+  pos = ( pos + 1 ) & mask;
+  while ( table[ pos ] ) {
+    Sequence *moved = table[ pos ];
+    table[ pos ] = NULL;
+    insertSequence( table, interp->liveCap, moved );
+    pos = ( pos + 1 ) & mask;
+  }
+}
+
+void freeMemStats( Interp *interp )
+{
+  free( interp->liveSequences );
+  interp->liveSequences = NULL;
+  interp->liveCount = interp->liveCap = 0;
+}
+
+/** Comparison function for listing leaked sequences, shortest first,
+    then by reference count, so the report is the same every run.
+*/
+static int compareLeaks( void const *a, void const *b )
+{
+  Sequence const *s1 = *(Sequence *const *) a;
+  Sequence const *s2 = *(Sequence *const *) b;
+  if ( s1->len != s2->len )
+    return s1->len < s2->len ? -1 : 1;
+  return s1->ref < s2->ref ? -1 : s1->ref > s2->ref;
+}
+
+void printMemStats( Interp const *interp, FILE *fp )
+{
+  fprintf( fp, "memory: peak %ld bytes, %ld bytes live\n",
+           interp->maxMemoryBytes, interp->memoryBytes );
+  for ( int k = 0; k < MEM_KINDS; k++ ) {
+    MemCount const *count = &interp->memory[ k ];
+    fprintf( fp, "%s: %ld allocated, %ld freed, %ld grown, peak %ld bytes\n",
+             kindNames[ k ], count->allocs, count->frees, count->reallocs,
+             count->maxBytes );
+  }
+
+  if ( !interp->liveSequences )
+    return;
+
+  // Collect the sequences that are left, and describe a few of them.
+  fprintf( fp, "leaked sequences: %d\n", interp->liveCount );
+  if ( interp->liveCount == 0 )
+    return;
+
+  Sequence **leaks = (Sequence **) malloc( interp->liveCount *
+                                           sizeof( Sequence * ) );
+  int n = 0;
+  for ( int i = 0; i < interp->liveCap; i++ )
+    if ( interp->liveSequences[ i ] )
+      leaks[ n++ ] = interp->liveSequences[ i ];
+  qsort( leaks, n, sizeof( Sequence * ), compareLeaks );
+
+  for ( int i = 0; i < n && i < MAX_LEAKS; i++ )
+    fprintf( fp, "  length %d, references %d%s\n", leaks[ i ]->len,
+             leaks[ i ]->ref, leaks[ i ]->owner ? ", a view" : "" );
+  if ( n > MAX_LEAKS )
+    fprintf( fp, "  ... and %d more\n", n - MAX_LEAKS );
+  free( leaks );
+}
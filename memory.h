@@ -0,0 +1,155 @@
+/**
+  @file memory.h
+  @author Sean Hinton (sahinto2)
+
+  Counted allocation for the objects the interpreter makes as a program
+  runs: syntax tree nodes, sequence headers, the blocks sequences keep
+  their elements in, and environments.  Every allocation, free and
+  growth of one of these is counted in the current context, along with
+  the bytes each kind is using now and the most it has used at once.  A
+  context can also keep track of every sequence that hasn't been freed,
+  so the ones left at the end can be reported as leaks.
+*/
+
+#ifndef _MEMORY_H_
+#define _MEMORY_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "value.h"
+#include "interp.h"
+#include "arena.h"
+
+/** Kinds of memory that are counted separately. */
+typedef enum {
+  /** Expressions and statements, allocated from an arena and freed when
+      the arena is reset. */
+  MEM_NODE,
+
+  /** Sequence headers.  One that's kept as a spare counts as freed,
+      and reusing it counts as another allocation. */
+  MEM_HEADER,
+
+  /** Blocks of sequence elements too big for the header. */
+  MEM_ELEMENTS,
+
+  /** Environments and their tables of variables. */
+  MEM_ENVIRONMENT,
+
+  /** Number of kinds, not a real kind. */
+  MEM_KINDS
+} MemKind;
+
+/** Counts for one kind of memory. */
+typedef struct {
+  /** Number of allocations and frees. */
+  long allocs;
+  long frees;
+
+  /** Number of times a block was grown (or shrunk) in place with
+      realloc, or replaced with a bigger one. */
+  long reallocs;
+
+  /** Bytes in use now, and the most there have been at once. */
+  long bytes;
+  long maxBytes;
+} MemCount;
+
+/** Allocate a block of memory and count it.
+    @param kind kind of memory.
+    @param size number of bytes.
+    @return the new block.
+*/
+void *countedMalloc( MemKind kind, size_t size );
+
+/** Allocate a zeroed block of memory and count it.
+    @param kind kind of memory.
+    @param n number of items.
+    @param size bytes per item.
+    @return the new block.
+*/
+void *countedCalloc( MemKind kind, size_t n, size_t size );
+
+/** Change the size of a block of memory, counting the growth.
+    @param kind kind of memory.
+    @param ptr block to resize.
+    @param oldSize bytes the block has now.
+    @param size bytes it should have.
+    @return the resized block, which may have moved.
+*/
+void *countedRealloc( MemKind kind, void *ptr, size_t oldSize, size_t size );
+
+/** Count the replacement of a block with a bigger one, allocated and
+    freed separately, as one growth.
+    @param kind kind of memory.
+*/
+void countGrowth( MemKind kind );
+
+/** Free a block of memory and count it.
+    @param kind kind of memory.
+    @param ptr block to free.
+    @param size number of bytes in the block.
+*/
+void countedFree( MemKind kind, void *ptr, size_t size );
+
+/** Count memory allocated some other way, such as from an arena.
+    @param kind kind of memory.
+    @param size number of bytes.
+*/
+void countAlloc( MemKind kind, size_t size );
+
+/** Count memory given up some other way, such as by keeping it for
+    reuse.
+    @param kind kind of memory.
+    @param size number of bytes.
+*/
+void countFree( MemKind kind, size_t size );
+
+/** Count the nodes allocated from an arena as freed, just before it's
+    reset or freed.
+    @param arena arena whose allocations are about to be released.
+*/
+void countArenaFreed( Arena const *arena );
+
+/** Start or stop keeping track of which sequences haven't been freed in
+    a context.  This is off unless it's asked for, since it costs a table
+    lookup every time a sequence is made or freed.  Sequences that were
+    made before it started aren't tracked.
+    @param interp context to keep track in.
+    @param enable true to start keeping track.
+*/
+void trackSequences( Interp *interp, bool enable );
+
+/** Add a sequence header that was just handed out to a context's table
+    of sequences that haven't been freed.  Only called while the context
+    is keeping track.
+    @param interp context keeping track.
+    @param seq header that was handed out.
+*/
+void addLiveSequence( Interp *interp, Sequence *seq );
+
+/** Remove a sequence header that's being given up from a context's
+    table, if it's there.  Only called while the context is keeping
+    track.
+    @param interp context keeping track.
+    @param seq header that was given up.
+*/
+void removeLiveSequence( Interp *interp, Sequence *seq );
+
+/** Print the counts for each kind of memory in a context, then the
+    sequences that haven't been freed, if it's keeping track.  Everything
+    that holds on to sequences, like environments and programs, should be
+    freed first, so any that are left are leaks.
+    @param interp context to report on.
+    @param fp stream to print to.
+*/
+void printMemStats( Interp const *interp, FILE *fp );
+
+/** Free a context's table of sequences that haven't been freed.
+    @param interp context that's going away.
+*/
+void freeMemStats( Interp *interp );
+
+#endif
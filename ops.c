@@ -0,0 +1,473 @@
+/**
+ * @file ops.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of the operators and statement actions of our language,
+ * working directly on Values.
+*/
+#include "ops.h"
+#include "output.h"
+#include "context.h"
+#include "kernel.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+
+//////////////////////////////////////////////////////////////////////
+// Error-reporting functions
+
+int reportTypeMismatch()
+{
+  raiseError( INTERP_RUNTIME_ERROR, "Type mismatch" );
+}
+
+int reportIndexOutOfBounds()
+{
+  raiseError( INTERP_RUNTIME_ERROR, "Index out of bounds" );
+}
+
+int reportDivideByZero()
+{
+  raiseError( INTERP_RUNTIME_ERROR, "Divide by zero" );
+}
+
+int reportSequenceTooLong()
+{
+  raiseError( INTERP_RUNTIME_ERROR, "Sequence too long" );
+}
+
+/** Make sure a sequence of the given length can be made.  Raise an
+    error if not.  This is checked before any operand is grabbed, so
+    nothing is left holding a reference.
+    @param len length the new sequence would have, computed in a type
+    wide enough that it can't overflow.
+*/
+static void requireLength( long long len )
+{
+  if ( len > INT_MAX )
+    reportSequenceTooLong();
+}
+
+void requireIntType( Value const *v)
+{
+  if ( v->vtype != IntType ){
+    //The sequence might be a temporary nobody else will free
+    holdValue( *v );
+    reportTypeMismatch();
+  }
+}
+
+void requireSeqType(Value const *s)
+{
+  if(s->vtype != SeqType){
+    reportTypeMismatch();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Temporaries
+
+void holdValue( Value v )
+{
+  if ( v.vtype != SeqType )
+    return;
+
+  Interp *interp = currentInterp();
+  if ( interp->heldLen >= interp->heldCap ) {
+    interp->heldCap = interp->heldCap ? interp->heldCap * DOUBLE_CAP
+      : INIT_CAP;
+    interp->held = (Sequence **) realloc( interp->held, interp->heldCap *
+                                          sizeof( Sequence * ) );
+  }
+
+  grabSequence( v.sval );
+  interp->held[ interp->heldLen++ ] = v.sval;
+}
+
+void dropValue( Value v )
+{
+  if ( v.vtype != SeqType )
+    return;
+
+  currentInterp()->heldLen--;
+  releaseSequence( v.sval );
+}
+
+Value keepValue( Value v )
+{
+  if ( v.vtype != SeqType )
+    return v;
+
+  // The caller takes over our reference, as a temporary with none.
+  currentInterp()->heldLen--;
+  v.sval->ref -= 1;
+  return v;
+}
+
+void releaseHeld( Interp *interp, int mark )
+{
+  while ( interp->heldLen > mark )
+    releaseSequence( interp->held[ --interp->heldLen ] );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Integer addition
+
+Value addValues( Value v1, Value v2 )
+{
+  //Return an int if they are both ints
+  if(v1.vtype == IntType && v2.vtype == IntType){
+    return (Value){ IntType, .ival = v1.ival + v2.ival };
+  }
+
+  //Otherwise there is some sequence in this
+  //Both sequence
+  if(v1.vtype == v2.vtype){
+    Sequence *seq1 = v1.sval;
+    Sequence *seq2 = v2.sval;
+    requireLength((long long) seq1->len + seq2->len);
+    grabSequence(seq1);
+    grabSequence(seq2);
+
+    //We know exactly how big the result is, so copy both in one go
+    Sequence *ret = makeSequenceCap(seq1->len + seq2->len);
+    appendSequence(ret, seq1);
+    appendSequence(ret, seq2);
+
+    releaseSequence(seq1);
+    releaseSequence(seq2);
+
+    //Now return the value
+    return (Value) {SeqType, .sval = ret};
+
+  }
+  //Only the first is a sequence
+  else if(v1.vtype == SeqType){
+    Sequence *seq1 = v1.sval;
+    requireLength((long long) seq1->len + 1);
+    grabSequence(seq1);
+
+    Sequence *ret = makeSequenceCap(seq1->len + 1);
+    appendSequence(ret, seq1);
+    appendInt(ret, v2.ival);
+
+    releaseSequence(seq1);
+    return (Value) {SeqType, .sval = ret};
+
+  }
+  else if(v2.vtype == SeqType){
+    Sequence *seq2 = v2.sval;
+    requireLength((long long) seq2->len + 1);
+    grabSequence(seq2);
+
+    Sequence *ret = makeSequenceCap(seq2->len + 1);
+    appendInt(ret, v1.ival);
+    appendSequence(ret, seq2);
+
+    releaseSequence(seq2);
+    return (Value) {SeqType, .sval = ret};
+
+  }
+
+  //Never reached
+  return (Value){ IntType, .ival = 0 };
+}
+
+//////////////////////////////////////////////////////////////////////
+// Integer subtracton
+
+Value subValues( Value v1, Value v2 )
+{
+  // Make sure the operands are both integers.
+  requireIntType( &v1 );
+  requireIntType( &v2 );
+
+  // Return the difference of the two expression values.
+  return (Value){ IntType, .ival = v1.ival - v2.ival };
+}
+
+//////////////////////////////////////////////////////////////////////
+// Integer multiplication
+
+Value mulValues( Value v1, Value v2 )
+{
+  //Do a multiplication of sequences if one value is a sequnece, the
+  //other one has to be the number of copies
+  if(v1.vtype == SeqType){
+    requireIntType(&v2);
+    Sequence *seq = v1.sval;
+    requireLength((long long) seq->len * v2.ival);
+    grabSequence(seq);
+    Sequence *ret = repeatSequence(seq, v2.ival);
+    releaseSequence(seq);
+    return (Value){SeqType, .sval = ret};
+  }
+  else if(v2.vtype == SeqType){
+    requireIntType(&v1);
+    Sequence *seq = v2.sval;
+    requireLength((long long) seq->len * v1.ival);
+    grabSequence(seq);
+    Sequence *ret = repeatSequence(seq, v1.ival);
+    releaseSequence(seq);
+    return (Value){SeqType, .sval = ret};
+  }
+
+  // Make sure the operands are both integers.
+  requireIntType( &v1 );
+  requireIntType( &v2 );
+
+  // Return the product of the two expression.
+  return (Value){ IntType, .ival = v1.ival * v2.ival };
+}
+
+//////////////////////////////////////////////////////////////////////
+// Integer division
+
+Value divValues( Value v1, Value v2 )
+{
+  // Make sure the operands are both integers.
+  requireIntType( &v1 );
+  requireIntType( &v2 );
+
+  // Catch it if we try to divide by zero.
+  if ( v2.ival == 0 ) {
+    reportDivideByZero();
+  }
+
+  // Return the quotient of the two expression.
+  return (Value){ IntType, .ival = v1.ival / v2.ival };
+}
+
+//////////////////////////////////////////////////////////////////////
+// Less-than comparison
+
+/** Find the first place where two sequences differ.
+    @param seq1 first sequence.
+    @param seq2 second sequence.
+    @param n number of elements to compare, no more than either length.
+    @return index of the first element that isn't the same in both, or n
+    if they're identical that far.
+*/
+static int firstMismatch( Sequence const *seq1, Sequence const *seq2,
+                          int n )
+{
+  if ( seq1->width == seq2->width )
+    return kernelMismatch( seq1->seq, seq2->seq, n, seq1->width );
+
+  // Elements of different widths have to be compared by value.
+  int i = 0;
+  while ( i < n && getElement( seq1, i ) == getElement( seq2, i ) )
+    i++;
+  return i;
+}
+
+Value lessValues( Value v1, Value v2 )
+{
+  // Make sure the operands are both the same type.
+  if ( v1.vtype != v2.vtype )
+    reportTypeMismatch();
+
+  if ( v1.vtype == IntType ) {
+    // Is v1 less than v2
+    return (Value){ IntType, .ival = v1.ival < v2.ival ? true : false };
+  } else {
+    //Hold on to both while we compare them, so temporaries are freed
+    //when we're done
+    Sequence *seq1 = v1.sval;
+    Sequence *seq2 = v2.sval;
+    grabSequence(seq1);
+    grabSequence(seq2);
+
+    //Pick the length of the smaller one
+    int length = seq1->len < seq2->len ? seq1->len : seq2->len;
+
+    //The first element that differs decides it.  Otherwise, seq1 is
+    //less if it's a prefix of seq2
+    int i = firstMismatch(seq1, seq2, length);
+    int result;
+    if(i < length)
+      result = getElement(seq1, i) < getElement(seq2, i);
+    else
+      result = seq1->len < seq2->len;
+
+    releaseSequence(seq1);
+    releaseSequence(seq2);
+    return (Value) {IntType, .ival = result};
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Equality comparison
+
+Value equalsValues( Value v1, Value v2 )
+{
+  // Make sure the same type.
+  if ( v1.vtype == IntType && v2.vtype == IntType ) {
+    return (Value){ IntType, .ival = ( v1.ival == v2.ival ) };
+  } else {
+    // A sequence can also be compared to an int, but they should
+    // never be considered equal.  The sequence still has to be freed
+    // if it's a temporary.
+    if(v1.vtype == IntType || v2.vtype == IntType){
+      Sequence *seq = v1.vtype == SeqType ? v1.sval : v2.sval;
+      grabSequence(seq);
+      releaseSequence(seq);
+      return (Value){IntType, .ival = 0};
+    }
+
+    //Hold on to both while we compare them
+    Sequence *seq1 = v1.sval;
+    Sequence *seq2 = v2.sval;
+    grabSequence(seq1);
+    grabSequence(seq2);
+
+    //They're equal if their lengths are, and all their elements
+    int result = seq1->len == seq2->len &&
+      firstMismatch(seq1, seq2, seq1->len) == seq1->len;
+
+    releaseSequence(seq1);
+    releaseSequence(seq2);
+    return (Value) {IntType, .ival = result};
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sequence length and indexing
+
+Value lenValue( Value s )
+{
+  //We probably want to make sure it's a sequence
+  requireSeqType(&s);
+
+  //Now we know it is indeed a sequence
+  Sequence *current = s.sval;
+
+  grabSequence(current);
+  int len = current->len;
+
+  //We also need to release it since the len expression no longer needs it
+  releaseSequence(current);
+  return (Value){IntType, .ival = len};
+}
+
+Value indexValue( Value seq, Value index )
+{
+  //Check if the integer comes withing the index and that it is an integer
+  //Also check that it is a sequences
+  requireSeqType(&seq);
+  requireIntType(&index);
+
+  //Check the bounds before we grab it, so an error can't leave it
+  //grabbed
+  Sequence *sequence = seq.sval;
+  int vindex = index.ival;
+  if(vindex < 0 || vindex >= sequence->len){
+    reportIndexOutOfBounds();
+  }
+  grabSequence(sequence);
+  int val = getElement(sequence, vindex);
+  releaseSequence(sequence);
+
+  return (Value){IntType, .ival = val};
+}
+
+//////////////////////////////////////////////////////////////////////
+// Print, push and assignment
+
+void printValue( Value v )
+{
+  // Print the value of our expression appropriately, based on its type.
+  if ( v.vtype == IntType ) {
+    writeInt( v.ival );
+  } else {
+    //We are printing a sequence as a string of ASCII character codes.
+    Sequence *seq = v.sval;
+    grabSequence(seq);
+    writeChars(seq->seq, seq->len, seq->width);
+    releaseSequence(seq);
+  }
+  endPrint();
+}
+
+void pushValue( Value seq, Value val )
+{
+  //Now assert their types
+  requireSeqType(&seq);
+  requireIntType(&val);
+
+  Sequence *realSeq = seq.sval;
+  requireLength((long long) realSeq->len + 1);
+
+  //We must grab the sequence too
+  grabSequence(realSeq);
+
+  //Now add it to the end, growing the sequence if there's no room
+  appendInt(realSeq, val.ival);
+
+  //Then release the sequence
+  releaseSequence(realSeq);
+}
+
+void assignVariable( Environment *env, Symbol const *sym, Value result )
+{
+  //If it's a sequence we need to increase the reference count, the
+  //environment will release the old value.
+  if(result.vtype == SeqType){
+    //With value semantics, a sequence that's already stored somewhere
+    //gets shared, so neither one sees changes to the other
+    if(currentInterp()->valueSemantics && result.sval->ref > 0){
+      result.sval = shareSequence(result.sval);
+    }
+    grabSequence(result.sval);
+  }
+
+  setVariable( env, sym, result );
+}
+
+void appendVariable( Environment *env, Symbol const *sym, Value right )
+{
+  Value left = lookupVariable(env, sym);
+
+  //We can only extend the sequence if nobody else can see it, and we're
+  //not copying it onto the end of itself
+  if(left.vtype != SeqType || left.sval->ref != 1 ||
+     (right.vtype == SeqType && right.sval == left.sval)){
+    assignVariable(env, sym, addValues(left, right));
+    return;
+  }
+
+  Sequence *seq = left.sval;
+  requireLength((long long) seq->len +
+                (right.vtype == IntType ? 1 : right.sval->len));
+  if(right.vtype == IntType){
+    appendInt(seq, right.ival);
+  } else {
+    //Hold on to the right-hand sequence, so a temporary gets freed
+    grabSequence(right.sval);
+    appendSequence(seq, right.sval);
+    releaseSequence(right.sval);
+  }
+}
+
+void assignElement( Environment *env, Symbol const *sym, Value index,
+                    Value result )
+{
+  //Go to the index of the sequence then assign the variable
+  //Also make sure it is in bounds
+  requireIntType(&index);
+  int i = index.ival;
+
+  //We have to go find our variable now 
+  Value s = lookupVariable(env, sym);
+  requireSeqType(&s);
+
+  Sequence *seq = s.sval;
+  //Check out of bounds errors
+  if(i < 0 || i >= seq->len){
+    reportIndexOutOfBounds();
+  }
+
+  //Now do the assignment, copying the elements first if they're shared
+  //with a constant
+  makeWritable(seq);
+  setElement(seq, i, result.ival);
+}
@@ -0,0 +1,176 @@
+/**
+  @file ops.h
+  @author Sean Hinton (sahinto2)
+
+  Operations on values in our language.  These are shared by the
+  expressions and statements in syntax.c and the bytecode interpreter in
+  vm.c, so both ways of running a program behave the same way, including
+  the errors they report.
+*/
+
+#ifndef _OPS_H_
+#define _OPS_H_
+
+#include "value.h"
+#include "interp.h"
+
+//////////////////////////////////////////////////////////////////////
+// Error reporting
+
+/** Raise an error for a program with bad types. */
+int reportTypeMismatch();
+
+/** Raise an error for an index that's out of bounds. */
+int reportIndexOutOfBounds();
+
+/** Raise an error for a division by zero. */
+int reportDivideByZero();
+
+/** Raise an error for a sequence with more elements than an int can
+    count. */
+int reportSequenceTooLong();
+
+/** Require a given value to be an IntType value.  Raise an error if
+    not.  A sequence that fails the check is held first (see
+    holdValue()), so it's freed if it was a temporary.
+    @param v value to check, passed by address.
+ */
+void requireIntType( Value const *v );
+
+/** Require a given value to be a SeqType value.  Raise an error if
+    not.
+    @param s value to check, passed by address.
+ */
+void requireSeqType( Value const *s );
+
+//////////////////////////////////////////////////////////////////////
+// Temporaries
+
+/** Hold on to a value while whatever needs it evaluates something else
+    or calls an operation that might report an error.  A sequence made
+    just for the expression has no references yet, so this is what lets
+    the entry point that catches the error free it (see releaseHeld()).
+    Values are let go in the opposite order they're held.
+    @param v value to hold.  Nothing is held for an int.
+ */
+void holdValue( Value v );
+
+/** Let go of the value held most recently, freeing it if it's a
+    sequence nothing else refers to.
+    @param v the value that was held.
+ */
+void dropValue( Value v );
+
+/** Let go of the value held most recently without freeing it, so it
+    can be returned as a temporary.
+    @param v the value that was held.
+    @return the same value.
+ */
+Value keepValue( Value v );
+
+/** Release the sequences still held after an error, freeing the
+    temporaries among them.
+    @param interp context the error was raised in.
+    @param mark number of sequences that were held before the entry
+    point started running, these stay held.
+ */
+void releaseHeld( Interp *interp, int mark );
+
+//////////////////////////////////////////////////////////////////////
+// Operators
+
+/** Add two ints, or concatenate sequences (or a sequence and an int).
+    @param v1 left-hand operand.
+    @param v2 right-hand operand.
+    @return sum of the two values, or a new sequence.
+ */
+Value addValues( Value v1, Value v2 );
+
+/** Subtract two ints.
+    @param v1 left-hand operand.
+    @param v2 right-hand operand.
+    @return difference of the two values.
+ */
+Value subValues( Value v1, Value v2 );
+
+/** Multiply two ints, or repeat a sequence an int number of times.
+    @param v1 left-hand operand.
+    @param v2 right-hand operand.
+    @return product of the two values, or a new sequence.
+ */
+Value mulValues( Value v1, Value v2 );
+
+/** Divide two ints, exiting with an error on division by zero.
+    @param v1 left-hand operand.
+    @param v2 right-hand operand.
+    @return quotient of the two values.
+ */
+Value divValues( Value v1, Value v2 );
+
+/** Compare two ints, or compare two sequences lexicographically.
+    @param v1 left-hand operand.
+    @param v2 right-hand operand.
+    @return true (1) if v1 is less than v2.
+ */
+Value lessValues( Value v1, Value v2 );
+
+/** Compare two values for equality.  An int is never equal to a sequence.
+    @param v1 left-hand operand.
+    @param v2 right-hand operand.
+    @return true (1) if the values are equal.
+ */
+Value equalsValues( Value v1, Value v2 );
+
+/** Get the length of a sequence.
+    @param s value that should be a sequence.
+    @return length of the sequence, as an int value.
+ */
+Value lenValue( Value s );
+
+/** Get one element of a sequence, checking that the index is in bounds.
+    @param seq value that should be a sequence.
+    @param index value that should be an int index.
+    @return the element at that index.
+ */
+Value indexValue( Value seq, Value index );
+
+//////////////////////////////////////////////////////////////////////
+// Statement actions
+
+/** Print a value, an int in decimal or a sequence as character codes.
+    @param v value to print.
+ */
+void printValue( Value v );
+
+/** Add an int to the end of a sequence.
+    @param seq value that should be a sequence.
+    @param val value that should be an int.
+ */
+void pushValue( Value seq, Value val );
+
+/** Store a value in a variable.
+    @param env environment that holds the variable.
+    @param sym variable to store the value in.
+    @param result value to store.
+ */
+void assignVariable( Environment *env, Symbol const *sym, Value result );
+
+/** Implement x = x + right, for a variable x.  If x holds the only
+    reference to a sequence, right is added to the end of it in place.
+    Otherwise, this is the same as assigning the result of addValues().
+    @param env environment that holds the variable.
+    @param sym variable being added to.
+    @param right value to add to the end of the variable.
+ */
+void appendVariable( Environment *env, Symbol const *sym, Value right );
+
+/** Store a value in one element of the sequence held by a variable.
+    @param env environment that holds the variable.
+    @param sym variable holding the sequence.
+    @param index value that should be an int index.
+    @param result value to store in the element.
+ */
+void assignElement( Environment *env, Symbol const *sym, Value index,
+                    Value result );
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * @file output.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of buffered output, with our own conversion from int to
+ * decimal so printing doesn't need to go through printf.  The buffer
+ * belongs to the current context.
+*/
+#include "output.h"
+#include "context.h"
+#include "kernel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Most characters in the decimal representation of an int. */
+#define INT_DIGITS 11
+
+void flushOutput()
+{
+  Interp *interp = currentInterp();
+  if ( interp->bufferLen > 0 ) {
+    fwrite( interp->buffer, 1, interp->bufferLen, interp->out );
+    interp->bufferLen = 0;
+  }
+  fflush( interp->out );
+}
+
+/** Make sure there's room for n more characters in the buffer, writing
+    out what's there if there isn't.
+    @param interp context whose buffer we're using.
+    @param n number of characters, at most OUTPUT_SIZE.
+*/
+static void makeRoom( Interp *interp, int n )
+{
+  if ( interp->bufferLen + n > OUTPUT_SIZE ) {
+    fwrite( interp->buffer, 1, interp->bufferLen, interp->out );
+    interp->bufferLen = 0;
+  }
+}
+
+void writeInt( int val )
+{
+  Interp *interp = currentInterp();
+  makeRoom( interp, INT_DIGITS );
+
+  // Work with the magnitude as an unsigned, so the most negative int
+  // works too.
+  unsigned mag = val < 0 ? -(unsigned) val : (unsigned) val;
+
+  // Build the digits backward, at the end of a little buffer.
+  char digits[ INT_DIGITS ];
+  int pos = INT_DIGITS;
+  do {
+    digits[ --pos ] = '0' + mag % 10;
+    mag /= 10;
+  } while ( mag );
+  if ( val < 0 )
+    digits[ --pos ] = '-';
+
+  while ( pos < INT_DIGITS )
+    interp->buffer[ interp->bufferLen++ ] = digits[ pos++ ];
+}
+
+void writeChars( void const *vals, int n, int width )
+{
+  Interp *interp = currentInterp();
+  while ( n > 0 ) {
+    // Copy as much as will fit in the buffer.
+    makeRoom( interp, n < OUTPUT_SIZE ? n : OUTPUT_SIZE );
+    int count = OUTPUT_SIZE - interp->bufferLen;
+    if ( count > n )
+      count = n;
+
+    kernelNarrow( interp->buffer + interp->bufferLen, vals, count, width );
+
+    interp->bufferLen += count;
+    vals = (char const *) vals + (size_t) count * width;
+    n -= count;
+  }
+}
+
+void endPrint()
+{
+  if ( currentInterp()->unbuffered )
+    flushOutput();
+}
@@ -0,0 +1,39 @@
+/**
+  @file output.h
+  @author Sean Hinton (sahinto2)
+
+  Buffered output for the print statement.  Printed values are collected
+  in a large buffer in the current context and written to its output
+  stream when it fills up, when a call through the embedding interface
+  finishes, or after every print in unbuffered mode.
+*/
+
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stdbool.h>
+
+/** Add the decimal representation of an int to the output.
+    @param val value to write.
+*/
+void writeInt( int val );
+
+/** Add a block of character codes to the output, one byte each.
+    @param vals character codes to write, the elements of a sequence.
+    @param n number of characters.
+    @param width bytes per element in vals.
+*/
+void writeChars( void const *vals, int n, int width );
+
+/** Called at the end of each print statement.  In unbuffered mode, this
+    writes everything printed so far.
+*/
+void endPrint();
+
+/** Write everything in the buffer to the current context's output
+    stream.  Errors raised with raiseError() do this first, so output
+    comes out in the right order.
+*/
+void flushOutput();
+
+#endif
@@ -6,94 +6,485 @@
  * create Statements and Expressions that the interpret.c file will execute.
 */
 
+// For fileno(), mmap() and read().
+#define _POSIX_C_SOURCE 200809L
+
 #include "parse.h"
+#include "context.h"
+#include "output.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-// Prototype so we can use this function before defining it.
-static Expr *parseExpr( char *tok, FILE *fp );
-  
 // Number of characters inside a single-quoted string.
 #define SINGLE_QUOTE_LENGTH 1
 
-// Initial capacity for the resizable array used to store
-// statements in a compound statement.
+// Initial capacity for each of the parser's stacks.
 #define INITIAL_CAPACITY 5
 
+// Most expressions a statement without other statements in it has, the
+// index and value of an assignment to an element.
+#define MAX_PARTS 2
+
+// Size of each chunk we read when the source can't be mapped.
+#define READ_CHUNK 65536
+
+// Initial size of the buffer for a streamed source.  It only has to hold
+// the token being read and whatever has arrived after it.
+#define STREAM_CHUNK 4096
+
 //////////////////////////////////////////////////////////////////////
 // Input tokenization
 
-// Current line we're parsing, starting from 1 like most editors.
-static int lineCount = 1;
+// The current line we're parsing is kept in the context, starting from 1
+// like most editors.
 
-/** Print a syntax error message, with a line number and exit. */
+// Destroys the statement being parsed when there's an error, defined with
+// the parser state below.
+static void discardStatement();
+
+/** Report a syntax error, with a line number. */
 static void syntaxError()
 {
-  fprintf( stderr, "line %d: syntax error\n", lineCount );
-  exit( EXIT_FAILURE );
+  discardStatement();
+  raiseError( INTERP_SYNTAX_ERROR, "line %d: syntax error",
+              currentInterp()->lineCount );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Symbol table
+
+// Every variable name we've seen so far is kept in the context.  Names
+// are interned as they're tokenized, so each distinct name has exactly
+// one Symbol, found through an open-addressed hash table.  The table
+// persists across top-level statements, so a name gets the same slot
+// every time it's used.
+
+// Initial number of entries in the symbol table (a power of two).
+#define INITIAL_SYMBOLS 64
+
+/** Find the entry where the given name is stored in the symbol table, or
+    the empty entry where it should go.
+    @param interp context holding the symbol table.
+    @param name characters of the name, not null terminated.
+    @param len number of characters in the name.
+    @param hash hash of the name.
+    @return pointer to the matching or empty entry.
+*/
+static Symbol **findSymbol( Interp *interp, char const *name, int len,
+                            unsigned hash )
+{
+  Symbol **symbols = interp->symbols;
+  unsigned mask = interp->symbolCap - 1;
+  unsigned pos = hash & mask;
+  while ( symbols[ pos ] &&
+          ( symbols[ pos ]->hash != hash ||
+            strncmp( symbols[ pos ]->name, name, len ) != 0 ||
+            symbols[ pos ]->name[ len ] != '\0' ) )
+    pos = ( pos + 1 ) & mask;
+  return &symbols[ pos ];
+}
+
+/** Documented in the header. */
+Symbol const *internName( char const *name, int len )
+{
+  Interp *interp = currentInterp();
+
+  // Keep the table at most half full.
+  if ( ( interp->symbolCount + 1 ) * DOUBLE_CAP > interp->symbolCap ) {
+    Symbol **old = interp->symbols;
+    int oldCap = interp->symbolCap;
+
+    interp->symbolCap = oldCap ? oldCap * DOUBLE_CAP : INITIAL_SYMBOLS;
+    interp->symbols = (Symbol **) calloc( interp->symbolCap,
+                                          sizeof( Symbol * ) );
+    for ( int i = 0; i < oldCap; i++ )
+      if ( old[ i ] )
+        *findSymbol( interp, old[ i ]->name, strlen( old[ i ]->name ),
+                     old[ i ]->hash ) = old[ i ];
+    free( old );
+  }
+
+  unsigned hash = hashName( name, len );
+  Symbol **entry = findSymbol( interp, name, len, hash );
+  if ( !*entry ) {
+    // It's a new variable, give it the next slot.
+    Symbol *sym = (Symbol *) malloc( sizeof( Symbol ) );
+    sym->slot = interp->symbolCount++;
+    sym->hash = hash;
+    memcpy( sym->name, name, len );
+    sym->name[ len ] = '\0';
+    *entry = sym;
+  }
+
+  return *entry;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Reserved words
+
+// Number of entries in the keyword table.
+#define KEYWORD_TABLE 16
+
+/** Perfect hash function for the reserved words.  Every reserved word
+    has a different length plus first character, modulo the table size,
+    so there's only ever one entry to check.
+    @param len length of the word.
+    @param first first character of the word.
+*/
+#define KEYWORD_HASH( len, first ) ( ( (len) + (first) ) % KEYWORD_TABLE )
+
+/** Reserved words, each stored at the position given by KEYWORD_HASH. */
+static struct {
+  char const *word;
+  TokenKind kind;
+} const keywords[ KEYWORD_TABLE ] = {
+  [ KEYWORD_HASH( 2, 'i' ) ] = { "if", TOK_IF },
+  [ KEYWORD_HASH( 5, 'w' ) ] = { "while", TOK_WHILE },
+  [ KEYWORD_HASH( 5, 'p' ) ] = { "print", TOK_PRINT },
+  [ KEYWORD_HASH( 4, 'p' ) ] = { "push", TOK_PUSH },
+  [ KEYWORD_HASH( 3, 'l' ) ] = { "len", TOK_LEN },
+};
+
+/** Classify a word that looks like an identifier.  It's either a
+    reserved word or a variable name, which gets interned.
+    @param tok token to classify, with its text and length filled in.
+*/
+static void classifyWord( Token *tok )
+{
+  // Names that are too long can't be identifiers.
+  if ( tok->len > MAX_VAR_NAME ) {
+    tok->kind = TOK_OTHER;
+    return;
+  }
+
+  int h = KEYWORD_HASH( tok->len, tok->text[ 0 ] );
+  char const *word = keywords[ h ].word;
+  if ( word && strncmp( word, tok->text, tok->len ) == 0 &&
+       word[ tok->len ] == '\0' ) {
+    tok->kind = keywords[ h ].kind;
+    return;
+  }
+
+  tok->kind = TOK_IDENT;
+  tok->sym = internName( tok->text, tok->len );
+}
+
+// Hidden representation for the tokenizer, a cursor in a copy of the
+// whole source, or in a window on it if the source is streamed.
+struct TokenizerStruct {
+  /** Text of the source, not null terminated. */
+  char const *buf;
+
+  /** Number of characters in the source, or in the window on a streamed
+      source. */
+  size_t size;
+
+  /** Index of the next character to read. */
+  size_t pos;
+
+  /** True if buf is mapped from the file, rather than allocated. */
+  bool mapped;
+
+  /** For a streamed source, the file descriptor we read more of it from,
+      or -1 once it's all been read.  It's -1 for other sources too. */
+  int fd;
+
+  /** Room in buf, for a streamed source. */
+  size_t cap;
+
+  /** Index of the first character of the token being read.  When a
+      streamed source needs more input, everything before this is
+      discarded. */
+  size_t mark;
+
+  /** True if there's a token waiting in the look-ahead slot. */
+  bool peeked;
+
+  /** Token that's been read but pushed back, for look-ahead. */
+  Token peek;
+};
+
+Tokenizer *makeTokenizer( FILE *fp )
+{
+  Tokenizer *tz = (Tokenizer *) malloc( sizeof( Tokenizer ) );
+  tz->pos = 0;
+  tz->mark = 0;
+  tz->fd = -1;
+  tz->peeked = false;
+
+  // Map regular files straight into memory.
+  struct stat st;
+  int fd = fileno( fp );
+  bool known = fd >= 0 && fstat( fd, &st ) == 0;
+  if ( known && S_ISREG( st.st_mode ) && st.st_size > 0 ) {
+    void *map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( map != MAP_FAILED ) {
+      tz->buf = (char const *) map;
+      tz->size = st.st_size;
+      tz->mapped = true;
+      return tz;
+    }
+  }
+  tz->mapped = false;
+
+  // Pipes, terminals and sockets are read a little at a time, as the
+  // source arrives.
+  if ( known && !S_ISREG( st.st_mode ) ) {
+    tz->cap = STREAM_CHUNK;
+    tz->buf = (char const *) malloc( tz->cap );
+    tz->size = 0;
+    tz->fd = fd;
+    return tz;
+  }
+
+  // Otherwise, read the whole thing into a buffer.
+  size_t cap = READ_CHUNK;
+  char *buf = (char *) malloc( cap );
+  size_t len = 0;
+  size_t n;
+  while ( ( n = fread( buf + len, 1, cap - len, fp ) ) > 0 ) {
+    len += n;
+    if ( len == cap ) {
+      cap *= DOUBLE_CAP;
+      buf = (char *) realloc( buf, cap );
+    }
+  }
+
+  tz->buf = buf;
+  tz->size = len;
+  return tz;
+}
+
+void freeTokenizer( Tokenizer *tz )
+{
+  if ( tz->mapped )
+    munmap( (void *) tz->buf, tz->size );
+  else
+    free( (void *) tz->buf );
+  free( tz );
+}
+
+bool sourceText( Tokenizer const *tz, char const **text, size_t *len )
+{
+  if ( tz->fd >= 0 )
+    return false;
+
+  *text = tz->buf;
+  *len = tz->size;
+  return true;
 }
 
-/** Helper function for parseToken.  It checks for overflow and stores
-    the given character in the next element of token.
-    @param ch The character to add. 
-    @param token The token we're building.
-    @param len Next position in token, passed by address. */
-static void addToToken( char ch, char *token, int *len )
+/** Read more of a streamed source, once everything that's arrived so far
+    has been used.  Characters before the start of the token being read
+    are discarded to make room, so the buffer stays about as small as the
+    longest token.  Before we wait for more input, the output so far is
+    written, so a program fed in a statement at a time shows its output
+    right away.
+    @param tz tokenizer to read into.
+    @return true if there's at least one more character.
+*/
+static bool fillBuffer( Tokenizer *tz )
+{
+  if ( tz->fd < 0 )
+    return false;
+
+  // Slide the token we're in the middle of to the front.
+  char *buf = (char *) tz->buf;
+  size_t keep = tz->size - tz->mark;
+  memmove( buf, buf + tz->mark, keep );
+  tz->pos -= tz->mark;
+  tz->size = keep;
+  tz->mark = 0;
+
+  if ( tz->size == tz->cap ) {
+    tz->cap *= DOUBLE_CAP;
+    buf = (char *) realloc( buf, tz->cap );
+    tz->buf = buf;
+  }
+
+  flushOutput();
+  ssize_t n;
+  do {
+    n = read( tz->fd, buf + tz->size, tz->cap - tz->size );
+  } while ( n < 0 && errno == EINTR );
+
+  if ( n <= 0 ) {
+    tz->fd = -1;
+    return false;
+  }
+  tz->size += n;
+  return true;
+}
+
+/** Return the next character of the source without consuming it.
+    @param tz tokenizer to look at.
+    @return the next character, or EOF at the end of the source.
+*/
+static int peekChar( Tokenizer *tz )
+{
+  if ( tz->pos >= tz->size && !fillBuffer( tz ) )
+    return EOF;
+  return (unsigned char) tz->buf[ tz->pos ];
+}
+
+/** Read the next character of the source.
+    @param tz tokenizer to read from.
+    @return the next character, or EOF at the end of the source.
+*/
+static int nextChar( Tokenizer *tz )
+{
+  if ( tz->pos >= tz->size && !fillBuffer( tz ) )
+    return EOF;
+  return (unsigned char) tz->buf[ tz->pos++ ];
+}
+
+/** Read the next character of the source when it isn't part of a token,
+    so a streamed source doesn't need to keep it.
+    @param tz tokenizer to read from.
+    @return the next character, or EOF at the end of the source.
+*/
+static int skipChar( Tokenizer *tz )
+{
+  tz->mark = tz->pos;
+  return nextChar( tz );
+}
+
+/** Put a token back, so it's returned by the next call to parseToken().
+    @param tz tokenizer the token came from.
+    @param tok token to push back.
+*/
+static void pushBackToken( Tokenizer *tz, Token const *tok )
+{
+  tz->peek = *tok;
+  tz->peeked = true;
+}
+
+/** Helper function for parseToken.  It checks for overflow and counts
+    one more character in the token we're reading.
+    @param len Number of characters in the token, passed by address. */
+static void addToToken( int *len )
 {
   // Complain if the token is too long.
   if ( *len >= MAX_TOKEN ) {
-    fprintf( stderr, "line %d: token too long\n", lineCount );
-    exit( EXIT_FAILURE );
+    discardStatement();
+    raiseError( INTERP_SYNTAX_ERROR, "line %d: token too long",
+                currentInterp()->lineCount );
   }
 
-  // Add the given character.
-  token[ *len ] = ch;
   *len += 1;
 }
 
+/** Classify a punctuation token.
+    @param ch first character of the token.
+    @param len number of characters in the token, one or two.
+    @return kind of token.
+*/
+static TokenKind punctuationKind( int ch, int len )
+{
+  if ( len == 2 ) {
+    switch ( ch ) {
+    case '=':
+      return TOK_EQUALS;
+    case '&':
+      return TOK_AND;
+    default:
+      return TOK_OR;
+    }
+  }
+
+  switch ( ch ) {
+  case '+':
+    return TOK_PLUS;
+  case '*':
+    return TOK_TIMES;
+  case '/':
+    return TOK_DIVIDE;
+  case '<':
+    return TOK_LESS;
+  case '[':
+    return TOK_LBRACKET;
+  case ']':
+    return TOK_RBRACKET;
+  case '(':
+    return TOK_LPAREN;
+  case ')':
+    return TOK_RPAREN;
+  case '{':
+    return TOK_LBRACE;
+  case '}':
+    return TOK_RBRACE;
+  case ';':
+    return TOK_SEMI;
+  case ',':
+    return TOK_COMMA;
+  case '=':
+    return TOK_ASSIGN;
+  default:
+    return TOK_OTHER;
+  }
+}
+
 /** Documented in the header. */
-bool parseToken( char *token, FILE *fp )
+bool parseToken( Tokenizer *tz, Token *token )
 {
+  // Use the look-ahead token if there is one.
+  if ( tz->peeked ) {
+    *token = tz->peek;
+    tz->peeked = false;
+    return true;
+  }
+
   int ch;
 
   // Skip whitespace and comments.
-  while ( isspace( ch = fgetc( fp ) ) || ch == '#' ) {
+  while ( isspace( ch = skipChar( tz ) ) || ch == '#' ) {
     // If we hit the comment characer, skip the whole line.
     if ( ch == '#' )
-      while ( ( ch = fgetc( fp ) ) != EOF && ch != '\n' )
+      while ( ( ch = skipChar( tz ) ) != EOF && ch != '\n' )
         ;
 
     if ( ch == '\n' )
-      lineCount++;
+      currentInterp()->lineCount++;
   }
     
   if ( ch == EOF )
     return false;
 
-  // Record the character we've read and keep up with the token length.
-  int len = 0;
-  token[ len++ ] = ch;
+  // The token starts at the character we've read, where the mark is.  Keep
+  // up with the number of characters it would take as a string, to detect
+  // tokens that are too long.  Reading more of a streamed source can move
+  // the text, so we don't point the token at it until it's all been read.
+  int len = 1;
+  token->sym = NULL;
   
   if ( isalpha( ch ) || ch == '_' ) {
-    // Try to parse the token as an identifier.
-    while ( isalnum( ( ch = fgetc( fp ) ) ) || ch == '_' )
-      addToToken( ch, token, &len );
-
-    // We had to read one character too far to find the end of the token.
-    // put the extra character back.
-    if ( ch != EOF )
-      ungetc( ch, fp );
+    // Try to parse the token as an identifier.  Leave the first character
+    // that's not part of it for the next token.
+    while ( isalnum( peekChar( tz ) ) || peekChar( tz ) == '_' ) {
+      addToToken( &len );
+      tz->pos++;
+    }
+
+    // Is it a reserved word or a variable?
+    token->text = tz->buf + tz->mark;
+    token->len = tz->pos - tz->mark;
+    classifyWord( token );
+    return true;
   } else if ( ch == '-' || isdigit( ch ) ) {
     // Try to parse the token as an integer value, it's a sequence of digits
     // after the initial sign or digit.
-    while ( isdigit( ( ch = fgetc( fp ) ) ) )
-      addToToken( ch, token, &len );
-    
-    // We had to read one character too far to find the end.
-    // Put the extra character back.
-    if ( ch != EOF )
-      ungetc( ch, fp );
+    while ( isdigit( peekChar( tz ) ) ) {
+      addToToken( &len );
+      tz->pos++;
+    }
+
+    // Without any digits, it's just a minus sign.
+    token->kind = ch == '-' && len == 1 ? TOK_MINUS : TOK_INT;
   } else if ( ch == '"' || ch == '\'' ) {
     // Look for the same quote to end the string later.
     char quote = ch;
@@ -102,391 +493,703 @@ bool parseToken( char *token, FILE *fp )
     // Is the next character escaped.
     bool escape = false;
 
-    // Keep reading until we hit the matching close quote.
-    while ( ( ch = fgetc( fp ) ) != quote || escape ) {
+    // Keep reading until we hit the matching close quote.  The escape
+    // sequences are checked here, but they're left in the token.
+    while ( ( ch = nextChar( tz ) ) != quote || escape ) {
       // Error conditions
       if ( ch == EOF || ch == '\n' ) {
-        fprintf( stderr, "line %d: invalid string literal.\n", lineCount );
-        exit( EXIT_FAILURE );
+        discardStatement();
+        raiseError( INTERP_SYNTAX_ERROR, "line %d: invalid string literal.",
+                    currentInterp()->lineCount );
       }
       
       // On a backslash, we just enable escape mode.
       if ( !escape && ch == '\\' ) {
         escape = true;
       } else {
-        // Interpret escape sequences if we're in escape mode.
+        // Check escape sequences if we're in escape mode.
         if ( escape ) {
-          switch ( ch ) {
-          case 'n':
-            ch = '\n';
-            break;
-          case 't':
-            ch = '\t';
-            break;
-          case '"':
-            ch = '"';
-            break;
-          case '\\':
-            ch = '\\';
-            break;
-          default:
-            fprintf( stderr, "line %d: Invalid escape sequence \"\\%c\"\n",
-                     lineCount, ch );
-            exit( EXIT_FAILURE );
+          if ( ch != 'n' && ch != 't' && ch != '"' && ch != '\\' ) {
+            discardStatement();
+            raiseError( INTERP_SYNTAX_ERROR,
+                        "line %d: Invalid escape sequence \"\\%c\"",
+                        currentInterp()->lineCount, ch );
           }
           escape = false;
         }
 
-        addToToken( ch, token, &len );
+        addToToken( &len );
       }
     }    
-    // Store the closing quote.
-    addToToken( quote, token, &len );
+    // Count the closing quote.
+    addToToken( &len );
 
     // Single-quoted strings must be exactly one character long.
     if ( quote == '\'' && len != SINGLE_QUOTE_LENGTH  + 1 + 1 ) {
-      fprintf( stderr, "line %d: Invalid single-quoted string\n", lineCount );
-      exit( EXIT_FAILURE );
+      discardStatement();
+      raiseError( INTERP_SYNTAX_ERROR, "line %d: Invalid single-quoted string",
+                  currentInterp()->lineCount );
     }
+
+    token->kind = quote == '"' ? TOK_STRING : TOK_CHAR;
   }  else {
     // Is this a multi-character token?
-    int ch2 = fgetc( fp );
+    int ch2 = peekChar( tz );
     if ( ( ch == '=' && ch2 == '=' ) ||
          ( ch == '&' && ch2 == '&' ) ||
-         ( ch == '|' && ch2 == '|' ) ) {
-      token[ len++ ] = ch2;
-    } else {
-      // Put back the second token and just take a one-character token.
-      if ( ch2 != EOF )
-        ungetc( ch2, fp );
-    }
+         ( ch == '|' && ch2 == '|' ) )
+      tz->pos++;
+
+    token->kind = punctuationKind( ch, tz->pos - tz->mark );
   }
-    
-  token[ len++ ] = '\0';
-  return token;
+
+  token->text = tz->buf + tz->mark;
+  token->len = tz->pos - tz->mark;
+  return true;
 }
 
 /** Called when we expect another token on the input.  This function
     parses the token and exits with an error if there isn't one.
-    @param storage for the next token, with capacity for at least
-    MAX_TOKEN characters.  This buffer will be modified by the parse
-    function as it reads additional tokens.
-    @param fp file tokens should be read from.
-    @return a copy of the pointer to the tok buffer, so this function
-    can be used as a parameter to other parsing calls.
+    @param tok storage for the next token.  This will be overwritten with
+    the token that's read.
+    @param tz tokenizer tokens should be read from.
+    @return a copy of the pointer to tok, so this function can be used
+    as a parameter to other parsing calls.
 */
-static char *expectToken( char *tok, FILE *fp )
+static Token *expectToken( Token *tok, Tokenizer *tz )
 {
-  if ( !parseToken( tok, fp ) )
+  if ( !parseToken( tz, tok ) )
     syntaxError();
   return tok;
 }
 
-/** Called when the next token, must be a particular value,
-    target.  Prints an error message and exits if it's not.
-    @param target string that the next token should match.
-    @param fp file tokens should be read from.
+/** Called when the next token, must be a particular kind, target.
+    Prints an error message and exits if it's not.
+    @param target kind of token that should come next.
+    @param tz tokenizer tokens should be read from.
 */
-static void requireToken( char const *target, FILE *fp )
+static void requireToken( TokenKind target, Tokenizer *tz )
 {
-  char tok[ MAX_TOKEN + 1 ];
-  if ( strcmp( expectToken( tok, fp ), target ) != 0 )
+  Token tok;
+  if ( expectToken( &tok, tz )->kind != target )
     syntaxError();
 }
 
-/** Return true if the given string is a legal identifier name.
-    @param tok token parsed from the input.
-    @return true if the given token is a legal identifier name.
+/** Decode one character of a quoted string from the input, interpreting
+    escape sequences.  The tokenizer has already checked that the escape
+    sequences are valid.
+    @param p pointer to the next character in the string, passed by
+    address.  This is moved past the characters that were decoded.
+    @return the character code.
 */
-static bool isIdentifier( char const *tok )
+static int decodeChar( char const **p )
 {
-  // Make sure the first character is legal.
-  if ( !isalpha( tok[ 0 ] ) && tok[ 0 ] != '_' )
-    return false;
-
-  // Then, check the rest.
-  for ( int i = 1; tok[ i ]; i++ )
-    if ( !isalnum( tok[ i ] ) && tok[ i ] != '_' )
-      return false;
+  char ch = *( *p )++;
+  if ( ch != '\\' )
+    return ch;
 
-  // Make sure it's not too long
-  if ( strlen( tok ) > MAX_VAR_NAME )
-    return false;
-
-  // And, make sure it doesn't match a reserved word.
-  if ( strcmp( tok, "if" ) == 0 ||
-       strcmp( tok, "while" ) == 0 ||
-       strcmp( tok, "print" ) == 0 ||
-       strcmp( tok, "push" ) == 0 ||
-       strcmp( tok, "len" ) == 0 )
-    return false;
-
-  return true;
+  switch ( *( *p )++ ) {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case '"':
+    return '"';
+  default:
+    return '\\';
+  }
 }
 
-/** Return true if the given string is an operator that can come between
+/** Return true if the given token is an operator that can come between
     two operands (e.g., typical infix operator or '[')
     @param tok token parsed from the input.
     @return true if the given token matches one of the infix operator.
 */
-static bool isInfixOperator( char const *tok )
-{
-  return strcmp( tok, "+" ) == 0 ||
-    strcmp( tok, "-" ) == 0 ||
-    strcmp( tok, "*" ) == 0 ||
-    strcmp( tok, "/" ) == 0 ||
-    strcmp( tok, "<" ) == 0 ||
-    strcmp( tok, "==" ) == 0 ||
-    strcmp( tok, "&&" ) == 0 ||
-    strcmp( tok, "||" ) == 0 ||
-    strcmp( tok, "[" ) == 0;
-}
-
-/** Parse a building block for a larger expression, either a literal, a
-    variable, or an expression inside parentheses.
-    @param tok next token from the input.
-    @param fp file subsequent tokens are being read from.
-    @return the expression object constructed from the input.
+static bool isInfixOperator( Token const *tok )
+{
+  return tok->kind >= TOK_PLUS && tok->kind <= TOK_LBRACKET;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Parser state
+
+// The parser doesn't recurse.  Expressions and statements that have been
+// started but not finished are kept on growable stacks in the context,
+// innermost last, so how deeply a program can nest is only limited by
+// memory.  The stacks are reused from one statement to the next.  Every
+// part of the statement being parsed is in exactly one place on them, so
+// if it has a syntax error they can all be destroyed.
+
+/** What an expression being parsed is part of, so we know what to do
+    with it once it's done. */
+typedef enum {
+  /** It's the expression parseExpr() was asked for. */
+  IN_CALLER,
+
+  /** It's inside parentheses. */
+  IN_PARENS,
+
+  /** It's the operand of len. */
+  IN_LEN,
+
+  /** It's an element of a sequence initializer. */
+  IN_SEQUENCE
+} ExprContext;
+
+/** An expression that's being parsed. */
+typedef struct {
+  /** What this expression is part of. */
+  ExprContext context;
+
+  /** Line the expression started on, for the nodes made for it. */
+  int line;
+
+  /** Everything parsed so far, or NULL before the first operand. */
+  Expr *left;
+
+  /** Operator waiting for its right-hand operand. */
+  TokenKind op;
+
+  /** For an element, where the elements of its initializer start on the
+      stack of elements. */
+  int base;
+} ExprFrame;
+
+/** What a statement being parsed is part of. */
+typedef enum {
+  /** It's in a compound statement. */
+  IN_BLOCK,
+
+  /** It's the body of an if or a while. */
+  IN_IF,
+  IN_WHILE
+} StmtContext;
+
+/** A statement that contains other statements, waiting for the rest of
+    them to be parsed. */
+typedef struct {
+  /** What kind of statement this is. */
+  StmtContext context;
+
+  /** Line the statement started on. */
+  int line;
+
+  /** Condition, for an if or a while. */
+  Expr *cond;
+
+  /** For a compound statement, where its statements start on the stack
+      of statements. */
+  int base;
+} StmtFrame;
+
+struct ParseStateStruct {
+  /** Expressions being parsed. */
+  ExprFrame *exprs;
+  int exprLen, exprCap;
+
+  /** Elements of every sequence initializer being parsed. */
+  Element *elems;
+  int elemLen, elemCap;
+
+  /** Statements being parsed. */
+  StmtFrame *stmts;
+  int stmtLen, stmtCap;
+
+  /** Statements finished so far in every compound being parsed. */
+  Stmt **body;
+  int bodyLen, bodyCap;
+
+  /** Expressions finished so far in the statement without other
+      statements in it that's being parsed, or the condition of an if or
+      while before it's pushed. */
+  Expr *parts[ MAX_PARTS ];
+  int partLen;
+};
+
+/** Make sure there's room on a stack for one more item.
+    @param items the stack.
+    @param len number of items on it.
+    @param cap capacity of the stack, passed by address.
+    @param size size of each item.
+    @return the stack, which may have moved.
 */
-static Expr *parseTerm( char tok[ MAX_TOKEN + 1 ], FILE *fp )
+static void *reserveItem( void *items, int len, int *cap, size_t size )
 {
-  if ( strcmp( tok, "(" ) == 0 ) {
-    Expr *expr = parseExpr( expectToken( tok, fp ), fp );
-    requireToken( ")", fp );
-    return expr;
+  if ( len >= *cap ) {
+    *cap *= DOUBLE_CAP;
+    items = realloc( items, *cap * size );
   }
+  return items;
+}
+
+/** Return the parser state for the current context, making it the first
+    time.
+    @return the parser state, with nothing on its stacks.
+*/
+static ParseState *parseState()
+{
+  Interp *interp = currentInterp();
+  ParseState *ps = interp->parser;
+  if ( !ps ) {
+    ps = (ParseState *) malloc( sizeof( ParseState ) );
+    ps->exprCap = ps->elemCap = ps->stmtCap = ps->bodyCap = INITIAL_CAPACITY;
+    ps->exprs = (ExprFrame *) malloc( ps->exprCap * sizeof( ExprFrame ) );
+    ps->elems = (Element *) malloc( ps->elemCap * sizeof( Element ) );
+    ps->stmts = (StmtFrame *) malloc( ps->stmtCap * sizeof( StmtFrame ) );
+    ps->body = (Stmt **) malloc( ps->bodyCap * sizeof( Stmt * ) );
+    interp->parser = ps;
+  }
+
+  ps->exprLen = ps->elemLen = ps->stmtLen = ps->bodyLen = ps->partLen = 0;
+  return ps;
+}
+
+static void discardStatement()
+{
+  // This can be a tokenizer error before anything was parsed.
+  ParseState *ps = currentInterp()->parser;
+  if ( !ps )
+    return;
+
+  // The nodes belong to the arena, but the constant sequences of any
+  // initializers in them don't.
+  for ( int i = 0; i < ps->exprLen; i++ )
+    if ( ps->exprs[ i ].left )
+      ps->exprs[ i ].left->destroy( ps->exprs[ i ].left );
+  for ( int i = 0; i < ps->elemLen; i++ )
+    if ( ps->elems[ i ].expr )
+      ps->elems[ i ].expr->destroy( ps->elems[ i ].expr );
+  for ( int i = 0; i < ps->stmtLen; i++ )
+    if ( ps->stmts[ i ].cond )
+      ps->stmts[ i ].cond->destroy( ps->stmts[ i ].cond );
+  for ( int i = 0; i < ps->bodyLen; i++ )
+    ps->body[ i ]->destroy( ps->body[ i ] );
+  for ( int i = 0; i < ps->partLen; i++ )
+    ps->parts[ i ]->destroy( ps->parts[ i ] );
+
+  ps->exprLen = ps->elemLen = ps->stmtLen = ps->bodyLen = ps->partLen = 0;
+}
+
+void freeParseState( ParseState *ps )
+{
+  if ( ps ) {
+    free( ps->exprs );
+    free( ps->elems );
+    free( ps->stmts );
+    free( ps->body );
+    free( ps );
+  }
+}
+
+/** Start parsing a new expression, for the first operand after the
+    last token that was read.
+    @param ps parser state.
+    @param context what the expression is part of.
+*/
+static void pushExpr( ParseState *ps, ExprContext context )
+{
+  ps->exprs = (ExprFrame *) reserveItem( ps->exprs, ps->exprLen,
+                                         &ps->exprCap, sizeof( ExprFrame ) );
+  ps->exprs[ ps->exprLen++ ] = (ExprFrame){
+    context, currentInterp()->lineCount, NULL, TOK_OTHER, ps->elemLen
+  };
+}
+
+/** Start parsing a statement that contains other statements.
+    @param ps parser state.
+    @param context kind of statement.
+    @param line line the statement started on.
+    @param cond condition for an if or a while, otherwise NULL.
+*/
+static void pushStmt( ParseState *ps, StmtContext context, int line,
+                      Expr *cond )
+{
+  ps->stmts = (StmtFrame *) reserveItem( ps->stmts, ps->stmtLen,
+                                         &ps->stmtCap, sizeof( StmtFrame ) );
+  ps->stmts[ ps->stmtLen++ ] = (StmtFrame){
+    context, line, cond, ps->bodyLen
+  };
+}
+
+/** Add an element to the sequence initializer being parsed.
+    @param ps parser state.
+    @param expr expression for the element, or NULL for a literal.
+    @param val value of a literal element.
+*/
+static void pushElement( ParseState *ps, Expr *expr, int val )
+{
+  ps->elems = (Element *) reserveItem( ps->elems, ps->elemLen,
+                                       &ps->elemCap, sizeof( Element ) );
+  ps->elems[ ps->elemLen++ ] = (Element){ expr, val };
+}
 
-  if ( tok[ 0 ] == '-' || isdigit( tok[ 0 ] ) ) {
-    // It's an int value, parse it and returna LiteraInt object.
-    int val, n;
-    if ( sscanf( tok, "%d%n", &val, &n ) != 1 ||
-         n != strlen( tok ) )
-      syntaxError();
-    return makeLiteralInt( val );
-  } else if ( tok[ 0 ] == '\'' ) {
+/** Remember an expression that's finished, until the statement it's part
+    of is made.
+    @param ps parser state.
+    @param expr expression that was just parsed.
+    @return expr.
+*/
+static Expr *keepPart( ParseState *ps, Expr *expr )
+{
+  ps->parts[ ps->partLen++ ] = expr;
+  return expr;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Parser
+
+/** Record the line an expression came from, if it doesn't have one yet.
+    @param expr expression that was just parsed.
+    @param line line it started on.
+    @return expr.
+*/
+static Expr *atLine( Expr *expr, int line )
+{
+  if ( !expr->line )
+    expr->line = line;
+  return expr;
+}
+
+/** Return the value of an int or character literal.
+    @param tok the token for the literal.
+    @return its value.
+*/
+static int literalValue( Token const *tok )
+{
+  if ( tok->kind == TOK_CHAR ) {
     // A literal (single-quoted) character is just another int.
-    return makeLiteralInt( tok[ 1 ] );
-  } else if ( isIdentifier( tok ) ) {
-    return makeVariable( tok );
-  } else if( tok[0] == '[') {
-    //Keep reading tokens until a closing bracket is found
-    
-    int length = 0;
-    //Maybe the entire line is the expression
-    Expr *elist[MAX_TOKEN];
-    
+    char const *p = tok->text + 1;
+    return decodeChar( &p );
+  }
 
-    char *currentToken = expectToken(tok, fp);
-    while(length <= MAX_TOKEN && strcmp(currentToken, "]") != 0){
-      Expr *newExpr = parseExpr(currentToken, fp);
-      elist[length] = newExpr;
-      length++;
-      //We need a comma after every expression
-      //requireToken(",", fp);
-      currentToken = expectToken(currentToken, fp);
-      //We could expect either a , or ]
-      if(strcmp(currentToken, "]") != 0 && strcmp(currentToken, ",") != 0){
-        syntaxError();
-      }
-      if(strcmp(currentToken, "]") != 0){
-        currentToken = expectToken(currentToken, fp);
-      }
-      //currentToken = expectToken(currentToken, fp);
-    }
-    
-    //All done
-    return makeSequenceInitializer(length, elist);
-    
-  //Reading in a length
-  } else if(strcmp(tok, "len") == 0){
-    Expr *len = parseExpr(expectToken(tok, fp), fp);
-    return makeLenExpr(len);
+  // It's an int value.  The token isn't null terminated, so parse a copy
+  // of it.
+  char text[ MAX_TOKEN + 1 ];
+  memcpy( text, tok->text, tok->len );
+  text[ tok->len ] = '\0';
 
-  // Reading in a literal string into a sequence  
-  } else if(tok[0] == '"'){
-    
-    int i = 1;
-    
-    char current = tok[i];
-    Expr *elist[MAX_TOKEN + 1];
-    while(current != '"'){
-      if(current == EOF){
-        syntaxError();
-      }
-      //Keep reading characters until we hit a closing quote
-      elist[i - 1] = makeLiteralInt(current);
-      i++;
-      current = tok[i];
-    }
+  int val, n;
+  if ( sscanf( text, "%d%n", &val, &n ) != 1 ||
+       n != tok->len )
+    syntaxError();
+  return val;
+}
+
+/** Parse an operand that doesn't contain an expression of its own,
+    either a literal or a variable.
+    @param tok the token for the operand.
+    @param ps parser state, for the characters of a string literal.
+    @return the expression object constructed from the input.
+*/
+static Expr *parseTerm( Token *tok, ParseState *ps )
+{
+  switch ( tok->kind ) {
+  case TOK_INT:
+  case TOK_CHAR:
+    return makeLiteralInt( literalValue( tok ) );
 
-    //We need to verify a semi colon now
-    //requireToken(";", fp);
+  case TOK_IDENT:
+    return makeVariable( tok->sym );
+
+  // Reading in a literal string into a sequence
+  case TOK_STRING: {
+    //Decode characters until we hit the closing quote, collecting their
+    //values on the stack of elements
+    char const *p = tok->text + 1;
+    char const *end = tok->text + tok->len - 1;
+    int base = ps->elemLen;
+    while(p < end){
+      pushElement(ps, NULL, decodeChar(&p));
+    }
 
     //Make the sequence and return it
-    int length = i - 1;
-    Expr *expr = makeSequenceInitializer(length, elist);
-    // //Now destroy all those literal ints so we don't lose them
-    
-    // for(int j = 0; j < length; j++){
-    //    elist[j]->destroy(elist[j]);
-    // }
+    Expr *expr = makeSequenceInitializer(ps->elemLen - base, ps->elems + base);
+    ps->elemLen = base;
     return expr;
   }
-   else
+
+  default:
     syntaxError();
+  }
 
   // Not reached.
   return NULL;
 }
 
+/** Apply the operator waiting in an expression to its right-hand
+    operand.
+    @param frame expression being parsed.
+    @param right right-hand operand.
+    @param tz tokenizer subsequent tokens are being read from.
+    @return the expression for the operator.
+*/
+static Expr *applyOperator( ExprFrame *frame, Expr *right, Tokenizer *tz )
+{
+  Expr *left = frame->left;
+
+  // Create the right type of expression, based on what binary
+  // operator it is.
+  switch ( frame->op ) {
+  case TOK_PLUS:
+    left = makeAdd( left, right );
+    break;
+  case TOK_MINUS:
+    left = makeSub( left, right );
+    break;
+  case TOK_TIMES:
+    left = makeMul( left, right );
+    break;
+  case TOK_DIVIDE:
+    left = makeDiv( left, right );
+    break;
+  case TOK_AND:
+    left = makeAnd( left, right );
+    break;
+  case TOK_OR:
+    left = makeOr( left, right );
+    break;
+  case TOK_LESS:
+    left = makeLess( left, right );
+    break;
+  case TOK_EQUALS:
+    left = makeEquals( left, right );
+    break;
+  default:
+    //Now make a SequenceIndexExpression and parse that extra ].  It goes
+    //in the frame first, so it's destroyed if the ] isn't there
+    left = frame->left = makeSequenceIndex(left, right);
+    requireToken(TOK_RBRACKET, tz);
+    break;
+  }
+  return atLine( left, frame->line );
+}
+
+/** Called after each element of a sequence initializer, to see if
+    there's another one.
+    @param ps parser state, with the initializer on top of the stack of
+    expressions.
+    @param op the token that ended the element.  This is overwritten with
+    the token after a comma.
+    @param tok storage for the first token of the next element.
+    @param tz tokenizer subsequent tokens are being read from.
+    @return true if there's another element, ready to be parsed, or false
+    if the initializer is done.
+*/
+static bool nextElement( ParseState *ps, Token *op, Token *tok,
+                         Tokenizer *tz )
+{
+  //We could expect either a , or ], and a , can be followed by another
+  //element or the ]
+  if ( op->kind == TOK_COMMA &&
+       expectToken( op, tz )->kind != TOK_RBRACKET ) {
+    ExprFrame *frame = ps->exprs + ps->exprLen - 1;
+    frame->line = currentInterp()->lineCount;
+    frame->left = NULL;
+    *tok = *op;
+    return true;
+  }
+  if ( op->kind != TOK_RBRACKET )
+    syntaxError();
+  return false;
+}
+
+/** Finish the sequence initializer on top of the stack of expressions.
+    @param ps parser state.
+    @return the initializer.
+*/
+static Expr *endSequence( ParseState *ps )
+{
+  ExprFrame *frame = ps->exprs + --ps->exprLen;
+  Expr *expr = makeSequenceInitializer( ps->elemLen - frame->base,
+                                        ps->elems + frame->base );
+  ps->elemLen = frame->base;
+  return expr;
+}
+
 /** Parse with one token worth of look-ahead, return the Expr
     object representing the next legal expression from the input.
+    Operands that contain expressions of their own (parentheses, len and
+    sequence initializers) are parsed on the stack of expressions, rather
+    than by calling this function again.
     @param tok next token from the input, already read before
     calling this function.
-    @param fp file subsequent tokens are being read from.
+    @param tz tokenizer subsequent tokens are being read from.
     @return the Expr object constructed from the input.
 */
-static Expr *parseExpr( char *tok, FILE *fp )
+static Expr *parseExpr( Token *tok, Tokenizer *tz )
 {
-  // Parse the expression, or just the left-hand operatnd of a longer
-  // expression.
-  Expr *left = parseTerm( tok, fp );
-  
-  // See if there's another oprator after this one.
-  char op[ MAX_TOKEN + 1 ];
-  while ( isInfixOperator( expectToken( op, fp ) ) ) {
-    // Parse the right-hand operand.
-    Expr *right = parseTerm( expectToken( tok, fp ), fp );
-
-    // Create the right type of expression, based on what binary
-    // operator it is.
-    if ( strcmp( op, "+" ) == 0 ) {
-      left = makeAdd( left, right );
-    } else if ( strcmp( op, "-" ) == 0 ) {
-      left = makeSub( left, right );
-    } else if ( strcmp( op, "*" ) == 0 ) {
-      left = makeMul( left, right );
-    } else if ( strcmp( op, "/" ) == 0 ) {
-      left = makeDiv( left, right );
-    } else if ( strcmp( op, "&&" ) == 0 ) {
-      left = makeAnd( left, right );
-    } else if ( strcmp( op, "||" ) == 0 ) {
-      left = makeOr( left, right );
-    } else if ( strcmp( op, "<" ) == 0 ) {
-      left = makeLess( left, right );
-    } else if ( strcmp( op, "==" ) == 0 ) {
-      left = makeEquals( left, right );
-    } else if ( strcmp(op, "[") == 0){
-      //Now make a SequenceIndexExpression and parse that extra ]
-      requireToken("]", fp);
-      left = makeSequenceIndex(left, right);
+  ParseState *ps = currentInterp()->parser;
+  pushExpr( ps, IN_CALLER );
+
+  for ( ;; ) {
+    // Here, tok is the first token of an operand.  One that contains an
+    // expression starts a new one, and we go on to its first operand.
+    Expr *term;
+    switch ( tok->kind ) {
+    case TOK_LPAREN:
+      expectToken( tok, tz );
+      pushExpr( ps, IN_PARENS );
+      continue;
 
+    //Reading in a length
+    case TOK_LEN:
+      expectToken( tok, tz );
+      pushExpr( ps, IN_LEN );
+      continue;
+
+    //Elements are parsed until a closing bracket is found
+    case TOK_LBRACKET:
+      if ( expectToken( tok, tz )->kind != TOK_RBRACKET ) {
+        pushExpr( ps, IN_SEQUENCE );
+        continue;
+      }
+      term = makeSequenceInitializer( 0, ps->elems );
+      break;
+
+    case TOK_INT:
+    case TOK_CHAR: {
+      // A literal that's a whole element of an initializer is kept as just
+      // its value, without a node of its own.
+      int val = literalValue( tok );
+      ExprFrame *frame = ps->exprs + ps->exprLen - 1;
+      if ( frame->context == IN_SEQUENCE && !frame->left ) {
+        Token op;
+        expectToken( &op, tz );
+        if ( op.kind == TOK_COMMA || op.kind == TOK_RBRACKET ) {
+          pushElement( ps, NULL, val );
+          if ( nextElement( ps, &op, tok, tz ) )
+            continue;
+          term = endSequence( ps );
+          break;
+        }
+        pushBackToken( tz, &op );
+      }
+      term = makeLiteralInt( val );
+      break;
     }
-  }
 
-  // To end an expression, the next token must be ;, ), ] or a comma.
-  if ( strcmp( op, ";" ) != 0 && strcmp( op, ")" ) != 0 &&
-       strcmp( op, "]" ) != 0 && strcmp( op, "," ) != 0 )
-    syntaxError();
+    default:
+      term = parseTerm( tok, ps );
+      break;
+    }
 
-  // Code that called us is going to expect to see this token.
-  ungetc( op[ 0 ], fp );
-  return left;
-}
+    // We have a whole operand.  Add it to the expression it's in, and
+    // keep going as long as that finishes expressions.
+    for ( ;; ) {
+      ExprFrame *frame = ps->exprs + ps->exprLen - 1;
+      atLine( term, frame->line );
+      frame->left = frame->left ? applyOperator( frame, term, tz ) : term;
 
-Stmt *parseStmt( char *tok, FILE *fp )
-{
-  // Handle compound statements
-  if ( strcmp( tok, "{" ) == 0 ) {
-    int len = 0;
-    int cap = INITIAL_CAPACITY;
-    Stmt **stmtList = (Stmt **) malloc( cap * sizeof( Stmt * ) );
+      // See if there's another oprator after this one.
+      Token op;
+      if ( isInfixOperator( expectToken( &op, tz ) ) ) {
+        frame->op = op.kind;
+        expectToken( tok, tz );
+        break;
+      }
+
+      // To end an expression, the next token must be ;, ), ] or a comma.
+      if ( op.kind != TOK_SEMI && op.kind != TOK_RPAREN &&
+           op.kind != TOK_RBRACKET && op.kind != TOK_COMMA )
+        syntaxError();
+
+      // Hand the finished expression to whatever it's part of.
+      Expr *expr = frame->left;
+      if ( frame->context == IN_SEQUENCE ) {
+        pushElement( ps, expr, 0 );
+        frame->left = NULL;
+        if ( nextElement( ps, &op, tok, tz ) )
+          break;
 
-    // Keep parsing statements until we hit the closing curly bracket.
-    while ( strcmp( expectToken( tok, fp ), "}" ) != 0 ) {
-      if ( len >= cap ) {
-        cap *= DOUBLE_CAP;
-        stmtList = (Stmt **) realloc( stmtList, cap * sizeof( Stmt * ) );
+        //All done
+        term = endSequence( ps );
+        continue;
       }
-      stmtList[ len++ ] = parseStmt( tok, fp );
-    }
 
-    return makeCompound( len, stmtList );
+      if ( frame->context == IN_PARENS && op.kind != TOK_RPAREN )
+        syntaxError();
+      ps->exprLen--;
+      if ( frame->context == IN_PARENS ) {
+        term = expr;
+      } else {
+        // Code that called us is going to expect to see this token, and so
+        // is the expression len is the first operand of.
+        pushBackToken( tz, &op );
+        if ( frame->context == IN_CALLER )
+          return expr;
+        term = makeLenExpr( expr );
+      }
+    }
   }
+}
 
+/** Parse one statement that doesn't contain other statements, for
+    parseStmt().
+    @param tok first token of the statement, already read.
+    @param tz tokenizer subsequent tokens are being read from.
+    @return the statement object constructed from the input.
+*/
+static Stmt *parseStatement( Token *tok, Tokenizer *tz )
+{
+  // Each expression is kept in the parser state until the statement is
+  // made, in case there's a syntax error after it.
+  ParseState *ps = currentInterp()->parser;
+  switch ( tok->kind ) {
   // Handle a print statement.
-  if ( strcmp( tok, "print" ) == 0 ) {
+  case TOK_PRINT: {
     // Parse the one argument to print, and create a print expression.
-    Expr *arg = parseExpr( expectToken( tok, fp ), fp );
-    requireToken( ";", fp );
+    Expr *arg = keepPart( ps, parseExpr( expectToken( tok, tz ), tz ) );
+    requireToken( TOK_SEMI, tz );
+    ps->partLen = 0;
     return makePrint( arg );
   }
 
-  // Handle an if statement.
-  if ( strcmp( tok, "if" ) == 0 ) {
-    requireToken( "(", fp );
-    Expr *cond = parseExpr( expectToken( tok, fp ), fp );
-    requireToken( ")", fp );
-    Stmt *body = parseStmt( expectToken( tok, fp ), fp );
-    return makeIf( cond, body );
-  }
-
-  // Handle a while statement..
-  if ( strcmp( tok, "while" ) == 0 ) {
-    requireToken( "(", fp );
-    Expr *cond = parseExpr( expectToken( tok, fp ), fp );
-    requireToken( ")", fp );
-    Stmt *body = parseStmt( expectToken( tok, fp ), fp );
-    return makeWhile( cond, body );
-  }
-
   //Push statement parsing
   //push seq, int
-  if( strcmp(tok, "push") == 0){
-    Expr *sexpr = parseExpr(expectToken(tok, fp), fp);
+  case TOK_PUSH: {
+    Expr *sexpr = keepPart(ps, parseExpr(expectToken(tok, tz), tz));
     //We need a comma then the int
-    requireToken(",", fp);
-    Expr *vexpr = parseExpr(expectToken(tok, fp), fp);
-    requireToken(";", fp);
+    requireToken(TOK_COMMA, tz);
+    Expr *vexpr = keepPart(ps, parseExpr(expectToken(tok, tz), tz));
+    requireToken(TOK_SEMI, tz);
+    ps->partLen = 0;
     return makePush(sexpr, vexpr);
   }
 
   // Handle an assignment statement.
-  if ( isIdentifier( tok ) ) {
-    // This must be an assignment.  Copy the variable name then parse
-    // the expression being assigned to it.
-    char vname[ MAX_VAR_NAME + 1 ];
-    strcpy( vname, tok );
-    
+  case TOK_IDENT: {
+    // This must be an assignment.  The tokenizer already resolved the
+    // variable name, so just parse the expression being assigned to it.
+    Symbol const *sym = tok->sym;
 
     //Use this to check if the token is for assigning an int or sequence index
 
-    expectToken( tok, fp );
-    if (strcmp(tok, "[") == 0){
+    expectToken( tok, tz );
+    if ( tok->kind == TOK_LBRACKET ){
       //We now need to parse the expression expect a ] then =
-      Expr *iexpr = parseExpr(expectToken(tok, fp), fp);
-      requireToken("]", fp);
-      requireToken("=", fp);
-      Expr *expr = parseExpr( expectToken( tok, fp ), fp );
-      requireToken(";", fp);
+      Expr *iexpr = keepPart(ps, parseExpr(expectToken(tok, tz), tz));
+      requireToken(TOK_RBRACKET, tz);
+      requireToken(TOK_ASSIGN, tz);
+      Expr *expr = keepPart( ps, parseExpr( expectToken( tok, tz ), tz ) );
+      requireToken(TOK_SEMI, tz);
       //Now make the assignment
-      return makeAssignment(vname, iexpr, expr);
+      ps->partLen = 0;
+      return makeAssignment(sym, iexpr, expr);
     }
-    else if ( strcmp( tok, "=" ) == 0 ) {
+    else if ( tok->kind == TOK_ASSIGN ) {
       // It's a plain-old assignment. 
-      Expr *expr = parseExpr( expectToken( tok, fp ), fp );
-      requireToken( ";", fp );
+      Expr *expr = keepPart( ps, parseExpr( expectToken( tok, tz ), tz ) );
+      requireToken( TOK_SEMI, tz );
       // Make the assignment statement.
-      //If the exprssion is a sequence we need to grab it
-      
-      return makeAssignment( vname, NULL, expr );
-
-      
-      
+      ps->partLen = 0;
+      return makeAssignment( sym, NULL, expr );
     }
+    break;
   }
 
-  
+  default:
+    break;
+  }
 
   // Otherwise, it's a syntax error.
   syntaxError();
@@ -494,3 +1197,86 @@ Stmt *parseStmt( char *tok, FILE *fp )
   // Never reached.
   return NULL;
 }
+
+
+/** Record the line a statement came from, if it doesn't have one yet.
+    @param stmt statement that was just parsed.
+    @param line line it started on.
+    @return stmt.
+*/
+static Stmt *stmtAtLine( Stmt *stmt, int line )
+{
+  if ( !stmt->line )
+    stmt->line = line;
+  return stmt;
+}
+
+Stmt *parseStmt( Token *tok, Tokenizer *tz )
+{
+  ParseState *ps = parseState();
+
+  for ( ;; ) {
+    // The statement belongs to the line it starts on.  One that contains
+    // other statements is pushed, and we go on to the first one inside.
+    int line = currentInterp()->lineCount;
+    Stmt *stmt = NULL;
+    TokenKind kind = tok->kind;
+    if ( kind == TOK_LBRACE ) {
+      // Handle compound statements
+      pushStmt( ps, IN_BLOCK, line, NULL );
+    } else if ( kind == TOK_IF || kind == TOK_WHILE ) {
+      // Handle an if or a while statement.
+      requireToken( TOK_LPAREN, tz );
+      Expr *cond = keepPart( ps, parseExpr( expectToken( tok, tz ), tz ) );
+      requireToken( TOK_RPAREN, tz );
+      ps->partLen = 0;
+      pushStmt( ps, kind == TOK_IF ? IN_IF : IN_WHILE, line, cond );
+      expectToken( tok, tz );
+      continue;
+    } else {
+      stmt = stmtAtLine( parseStatement( tok, tz ), line );
+    }
+
+    // Add the statement to the one it's in, and keep going as long as
+    // that finishes statements.
+    for ( ;; ) {
+      if ( ps->stmtLen == 0 )
+        return stmt;
+
+      StmtFrame *frame = ps->stmts + ps->stmtLen - 1;
+      if ( frame->context == IN_IF )
+        stmt = makeIf( frame->cond, stmt );
+      else if ( frame->context == IN_WHILE )
+        stmt = makeWhile( frame->cond, stmt );
+      else {
+        // Keep parsing statements until we hit the closing curly
+        // bracket.  We don't have a statement yet for a compound that was
+        // just started.
+        if ( stmt ) {
+          ps->body = (Stmt **) reserveItem( ps->body, ps->bodyLen,
+                                            &ps->bodyCap, sizeof( Stmt * ) );
+          ps->body[ ps->bodyLen++ ] = stmt;
+        }
+        if ( expectToken( tok, tz )->kind != TOK_RBRACE )
+          break;
+
+        // A compound right inside another one doesn't need a statement of
+        // its own, since blocks don't have their own variables.  Its
+        // statements just stay where they are, in the outer one.
+        if ( ps->stmtLen > 1 && frame[ -1 ].context == IN_BLOCK ) {
+          ps->stmtLen--;
+          stmt = NULL;
+          continue;
+        }
+
+        // The compound makes its own copy of the list.
+        stmt = makeCompound( ps->bodyLen - frame->base,
+                             ps->body + frame->base );
+        ps->bodyLen = frame->base;
+      }
+
+      stmtAtLine( stmt, frame->line );
+      ps->stmtLen--;
+    }
+  }
+}
@@ -20,21 +20,147 @@
 /** Maximum length of a token in the source file. */
 #define MAX_TOKEN 1023
 
-/** Read the next token from the given file, skipping whitespace or comments.
-    @param tok storage for the token, with room for a string of up to
-     MAX_TOKEN characters.
+/** Kinds of tokens.  The tokenizer classifies every token as it's read,
+    so the parser can just look at its kind. */
+typedef enum {
+  /** An int literal, like 42 or -7. */
+  TOK_INT,
+
+  /** A single-quoted character literal. */
+  TOK_CHAR,
+
+  /** A double-quoted string literal. */
+  TOK_STRING,
+
+  /** A variable name. */
+  TOK_IDENT,
+
+  /** Reserved words. */
+  TOK_IF,
+  TOK_WHILE,
+  TOK_PRINT,
+  TOK_PUSH,
+  TOK_LEN,
+
+  /** Infix operators, in a contiguous range so they're easy to
+      recognize.  The open square bracket counts as one, since it can
+      follow an operand. */
+  TOK_PLUS,
+  TOK_MINUS,
+  TOK_TIMES,
+  TOK_DIVIDE,
+  TOK_LESS,
+  TOK_EQUALS,
+  TOK_AND,
+  TOK_OR,
+  TOK_LBRACKET,
+
+  /** Other punctuation. */
+  TOK_RBRACKET,
+  TOK_LPAREN,
+  TOK_RPAREN,
+  TOK_LBRACE,
+  TOK_RBRACE,
+  TOK_SEMI,
+  TOK_COMMA,
+  TOK_ASSIGN,
+
+  /** Anything else, including names too long to be identifiers.  These
+      can't appear anywhere in a legal program. */
+  TOK_OTHER
+} TokenKind;
+
+/** A token read from the input.  Rather than being copied, a token is
+    just a slice of the source text, so it isn't null terminated.  String
+    literals still include their quotes and any escape sequences. */
+typedef struct {
+  /** What kind of token this is. */
+  TokenKind kind;
+
+  /** First character of the token in the source. */
+  char const *text;
+
+  /** Number of characters in the token. */
+  int len;
+
+  /** For an identifier, the interned symbol for its name.  Every
+      occurrence of the same name gets the same symbol. */
+  Symbol const *sym;
+} Token;
+
+/** Return the symbol for the given variable name in the current context,
+    giving it the next unused slot if this is the first time we've seen
+    it.  The tokenizer does this for every identifier.
+    @param name characters of the name, not null terminated.
+    @param len number of characters in the name, at most MAX_VAR_NAME.
+    @return symbol for this name.  It never moves, so callers can keep
+    pointers to it.
+*/
+Symbol const *internName( char const *name, int len );
+
+/** Short name for the tokenizer, its representation is hidden in
+    parse.c. */
+typedef struct TokenizerStruct Tokenizer;
+
+/** Make a tokenizer for the given file.  A regular file is mapped into
+    memory (or read into a buffer if it can't be mapped), and tokens are
+    read from there.  A pipe, terminal or socket is streamed instead,
+    read a little at a time as tokens are needed, so statements can be
+    parsed before the rest of the source has arrived.
     @param fp file to read tokens from.
+    @return new tokenizer.  The caller must eventually free it with
+    freeTokenizer().
+*/
+Tokenizer *makeTokenizer( FILE *fp );
+
+/** Free the tokenizer and its copy of the source.  Tokens read from it
+    are no longer valid after this.
+    @param tz tokenizer to free.
+*/
+void freeTokenizer( Tokenizer *tz );
+
+/** Get the whole text of a tokenizer's source, before any of it has
+    been read as tokens.
+    @param tz tokenizer to look at.
+    @param text returns the start of the source, not null terminated.
+    @param len returns the number of characters in the source.
+    @return true if the text is all in memory, false if the source is
+    streamed.
+*/
+bool sourceText( Tokenizer const *tz, char const **text, size_t *len );
+
+/** Read the next token, skipping whitespace or comments.
+    @param tz tokenizer to read from.
+    @param tok storage for the token.  It refers to the tokenizer's copy
+    of the source.  For a streamed source, that's only valid until the
+    next token is read, otherwise it's valid until the tokenizer is
+    freed.
     @return true if the token is successfully read.
 */
-bool parseToken( char token[], FILE *fp );
+bool parseToken( Tokenizer *tz, Token *tok );
+
+//////////////////////////////////////////////////////////////////////
+// Parser
+
+/** Short name for the stacks the parser keeps partly parsed expressions
+    and statements on, instead of recursing.  Its representation is
+    hidden in parse.c.  Each context gets one the first time it parses a
+    statement. */
+typedef struct ParseStateStruct ParseState;
+
+/** Free a context's parser state.
+    @param ps parser state to free, or NULL.
+*/
+void freeParseState( ParseState *ps );
 
 /** Parse with one token worth of look-ahead, return the Stmt
     object representing the next legal statement from the input.
+    Nesting is only limited by memory, not by the C stack.
     @param tok next token from the input, already read before
     calling this function.
-    @param fp file subsequent tokens are being read from.
+    @param tz tokenizer subsequent tokens are being read from.
     @return the Stmt object constructed from the input.
 */
-Stmt *parseStmt( char *tok, FILE *fp );
+Stmt *parseStmt( Token *tok, Tokenizer *tz );
 
 #endif
@@ -0,0 +1,158 @@
+/**
+ * @file profile.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of profiles, and the report of where a program spent its
+ * time.
+*/
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Longest part of a source line shown in the report. */
+#define SOURCE_WIDTH 48
+
+/** Totals for one line of the program. */
+typedef struct {
+  /** Line number. */
+  int line;
+
+  /** Statements executed on this line. */
+  long runs;
+
+  /** Expressions evaluated on this line. */
+  long evals;
+
+  /** Cycles spent in nodes from this line. */
+  uint64_t cycles;
+} LineTotal;
+
+Profile *makeProfile()
+{
+  Profile *profile = (Profile *) malloc( sizeof( Profile ) );
+  profile->len = 0;
+  profile->cap = INIT_CAP;
+  profile->counts =
+    (ProfileCount **) malloc( profile->cap * sizeof( ProfileCount * ) );
+  profile->nested = 0;
+  return profile;
+}
+
+void freeProfile( Profile *profile )
+{
+  for ( int i = 0; i < profile->len; i++ )
+    free( profile->counts[ i ] );
+  free( profile->counts );
+  free( profile );
+}
+
+ProfileCount *newProfileCount( Profile *profile, int line, bool stmt )
+{
+  if ( profile->len >= profile->cap ) {
+    profile->cap *= DOUBLE_CAP;
+    profile->counts = (ProfileCount **)
+      realloc( profile->counts, profile->cap * sizeof( ProfileCount * ) );
+  }
+
+  ProfileCount *count = (ProfileCount *) malloc( sizeof( ProfileCount ) );
+  count->line = line;
+  count->stmt = stmt;
+  count->count = 0;
+  count->cycles = 0;
+  count->eval = NULL;
+  profile->counts[ profile->len++ ] = count;
+  return count;
+}
+
+/** Comparison function for sorting lines, the most time first. */
+static int compareLines( void const *a, void const *b )
+{
+  LineTotal const *x = (LineTotal const *) a;
+  LineTotal const *y = (LineTotal const *) b;
+  if ( x->cycles != y->cycles )
+    return x->cycles < y->cycles ? 1 : -1;
+  return x->line - y->line;
+}
+
+/** Read the text of the first lines of a program, for the report.
+    @param source stream to read the program from.
+    @param lines number of lines to read.
+    @return array of lines, from index 1, with leading space removed and
+    long lines cut short.  Lines past the end of the source are NULL.
+*/
+static char **readSource( FILE *source, int lines )
+{
+  char **text = (char **) calloc( lines + 1, sizeof( char * ) );
+  rewind( source );
+
+  char buffer[ SOURCE_WIDTH + 1 ];
+  int line = 1;
+  bool start = true;
+  while ( line <= lines && fgets( buffer, sizeof( buffer ), source ) ) {
+    size_t len = strcspn( buffer, "\n" );
+    bool end = buffer[ len ] == '\n';
+    buffer[ len ] = '\0';
+
+    // Only the start of a long line is kept, we skip the rest of it.
+    if ( start ) {
+      char const *s = buffer + strspn( buffer, " \t" );
+      text[ line ] = strcpy( (char *) malloc( strlen( s ) + 1 ), s );
+    }
+
+    start = end;
+    if ( end )
+      line++;
+  }
+
+  return text;
+}
+
+void printProfile( Profile const *profile, FILE *source, FILE *fp )
+{
+  // Add up the counts for each line.
+  int lines = 0;
+  for ( int i = 0; i < profile->len; i++ )
+    if ( profile->counts[ i ]->line > lines )
+      lines = profile->counts[ i ]->line;
+
+  LineTotal *total = (LineTotal *) calloc( lines + 1, sizeof( LineTotal ) );
+  uint64_t cycles = 0;
+  for ( int i = 0; i < profile->len; i++ ) {
+    ProfileCount const *count = profile->counts[ i ];
+    LineTotal *t = total + count->line;
+    if ( count->stmt )
+      t->runs += count->count;
+    else
+      t->evals += count->count;
+    t->cycles += count->cycles;
+    cycles += count->cycles;
+  }
+
+  // Keep just the lines that ran, hottest first.
+  int used = 0;
+  for ( int i = 0; i <= lines; i++ )
+    if ( total[ i ].runs || total[ i ].evals ) {
+      total[ used ] = total[ i ];
+      total[ used++ ].line = i;
+    }
+  qsort( total, used, sizeof( LineTotal ), compareLines );
+
+  char **text = source ? readSource( source, lines ) : NULL;
+
+  fprintf( fp, "profile: %llu cycles\n", (unsigned long long) cycles );
+  fprintf( fp, "%6s %10s %10s %14s %6s  %s\n", "line", "runs", "evals",
+           "cycles", "%", "source" );
+  for ( int i = 0; i < used; i++ ) {
+    LineTotal const *t = total + i;
+    fprintf( fp, "%6d %10ld %10ld %14llu %6.2f  %s\n", t->line, t->runs,
+             t->evals, (unsigned long long) t->cycles,
+             cycles ? 100.0 * t->cycles / cycles : 0.0,
+             text && text[ t->line ] ? text[ t->line ] : "" );
+  }
+
+  if ( text ) {
+    for ( int i = 0; i <= lines; i++ )
+      free( text[ i ] );
+    free( text );
+  }
+  free( total );
+}
@@ -0,0 +1,107 @@
+/**
+  @file profile.h
+  @author Sean Hinton (sahinto2)
+
+  Execution counts and time for the nodes of a program, collected while
+  it runs in the tree-walking evaluator.  Profiling wraps the eval and
+  execute functions of every node (see profileStmt() in syntax.h), so
+  each call is counted and timed with the CPU's cycle counter.  Time is
+  attributed to the node that spent it, not counting the time spent in
+  the nodes below it.
+*/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "value.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+struct ExprStruct;
+struct StmtStruct;
+
+/** Counts for one node of a program.  While the node is being profiled,
+    this also holds the eval or execute function it really uses. */
+typedef struct ProfileCountStruct {
+  /** Line of the program the node came from. */
+  int line;
+
+  /** True if the node is a statement, false for an expression. */
+  bool stmt;
+
+  /** Number of times the node was evaluated or executed. */
+  long count;
+
+  /** Cycles spent in the node itself. */
+  uint64_t cycles;
+
+  /** The node's own eval or execute function. */
+  union {
+    Value (*eval)( struct ExprStruct *expr, Environment *env );
+    void (*execute)( struct StmtStruct *stmt, Environment *env );
+  };
+} ProfileCount;
+
+/** All the counts collected in one context. */
+typedef struct {
+  /** Counts for every node that's been profiled, including nodes that
+      have since been freed. */
+  ProfileCount **counts;
+  int len;
+  int cap;
+
+  /** Cycles spent so far in the nodes below the one that's running. */
+  uint64_t nested;
+} Profile;
+
+/** Make a new, empty profile.
+    @return new, dynamically allocated profile.
+*/
+Profile *makeProfile();
+
+/** Free a profile and all its counts.
+    @param profile profile to free.
+*/
+void freeProfile( Profile *profile );
+
+/** Make counts for one more node.
+    @param profile profile the counts belong to.
+    @param line line of the program the node came from.
+    @param stmt true if the node is a statement.
+    @return new counts, all zero, owned by the profile.
+*/
+ProfileCount *newProfileCount( Profile *profile, int line, bool stmt );
+
+/** Print a report of the lines of the program that took the most time,
+    hottest first.
+    @param profile profile to report.
+    @param source where to read the text of the program lines, or NULL
+    to report them by number only.  It's read from the start.
+    @param fp stream to print the report to.
+*/
+void printProfile( Profile const *profile, FILE *source, FILE *fp );
+
+/** Read the CPU's cycle counter, or a nanosecond clock on machines
+    without one.
+    @return current count.
+*/
+static inline uint64_t readCycles()
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+#endif
@@ -0,0 +1,380 @@
+/**
+ * @file program.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of whole programs, a compound statement holding every
+ * top-level statement in the source, and of the compiled script cache.
+ * A cache file has a header saying which format and build configuration
+ * it was written in and which source it was made from, then the
+ * program's syntax tree, written by saveStmt(), then a hash of
+ * everything before it, to catch files that were damaged after they
+ * were written.
+*/
+
+// For mmap(), fstat(), fchmod(), mkstemp() and fdopen().
+#define _POSIX_C_SOURCE 200809L
+
+#include "program.h"
+#include "context.h"
+#include "parse.h"
+#include "vm.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Identifies a cache file. */
+#define CACHE_MAGIC "ASTCACHE"
+
+/** Version of the cache file format.  Bump this whenever the header or
+    what saveStmt() writes changes, so files in the old form are
+    ignored instead of misread. */
+#define CACHE_FORMAT 2
+
+/** Describes the parts of the build that change the bytes written
+    without changing the format: the size of an int, and (since the
+    hashes are written as they are in memory) the byte order. */
+#define CACHE_CONFIG ( (uint32_t) sizeof( int ) << 24 | 0x00010203 )
+
+/** Longest path we'll use for a cache file.  If the directory's name
+    is too long for this, the cache isn't used. */
+#define CACHE_PATH_LEN 4096
+
+/** Hidden representation for a program. */
+struct ProgramStruct {
+  /** Arena holding the program's syntax tree. */
+  Arena *arena;
+
+  /** All the top-level statements, as one compound statement. */
+  Stmt *root;
+
+  /** Compiled code for the root, or NULL if it hasn't been needed
+      yet. */
+  Code *code;
+};
+
+/** Parse every statement a tokenizer reads into a new program, then
+    free the tokenizer, like loadProgram().
+    @param tz tokenizer for the program's source.
+    @return new program.
+*/
+static Program *parseProgram( Tokenizer *tz )
+{
+  Program *prog = (Program *) malloc( sizeof( Program ) );
+  prog->arena = makeArena();
+  prog->code = NULL;
+
+  // Build the tree in our own arena, without disturbing whoever was
+  // using the current one.
+  Arena *previous = setSyntaxArena( prog->arena );
+
+  // Collect the top-level statements in a resizable array.
+  int volatile len = 0;
+  int volatile cap = INIT_CAP;
+  Stmt **volatile stmtList = (Stmt **) malloc( cap * sizeof( Stmt * ) );
+
+  // On a syntax error, free what we've built so far before passing the
+  // error on.
+  Interp *interp = currentInterp();
+  jmp_buf onError;
+  jmp_buf *outer = interp->onError;
+  interp->onError = &onError;
+  if ( setjmp( onError ) ) {
+    interp->onError = outer;
+    for ( int i = 0; i < len; i++ )
+      stmtList[ i ]->destroy( stmtList[ i ] );
+    free( stmtList );
+    freeTokenizer( tz );
+    setSyntaxArena( previous );
+    countArenaFreed( prog->arena );
+    freeArena( prog->arena );
+    free( prog );
+    reraiseError();
+  }
+
+  Token tok;
+  while ( parseToken( tz, &tok ) ) {
+    if ( len >= cap ) {
+      cap *= DOUBLE_CAP;
+      stmtList = (Stmt **) realloc( stmtList, cap * sizeof( Stmt * ) );
+    }
+    Stmt *stmt = parseStmt( &tok, tz );
+    stmtList[ len++ ] = stmt;
+  }
+  interp->onError = outer;
+  freeTokenizer( tz );
+
+  // The compound makes its own copy of the list.
+  prog->root = makeCompound( len, stmtList );
+  free( stmtList );
+
+  setSyntaxArena( previous );
+  return prog;
+}
+
+Program *loadProgram( FILE *fp )
+{
+  return parseProgram( makeTokenizer( fp ) );
+}
+
+/** Return a 64-bit FNV-1a hash of a program's source, or of a cache
+    file.
+    @param text bytes to hash.
+    @param len number of bytes.
+    @return hash of the bytes.
+*/
+static uint64_t hashSource( char const *text, size_t len )
+{
+  uint64_t h = 14695981039346656037ULL;
+  for ( size_t i = 0; i < len; i++ ) {
+    h ^= (unsigned char) text[ i ];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/** Write the header for a cache file.
+    @param out block to write to.
+    @param hash hash of the program's source.
+    @param len number of characters in the source.
+*/
+static void saveHeader( Serial *out, uint64_t hash, size_t len )
+{
+  putBytes( out, CACHE_MAGIC, sizeof( CACHE_MAGIC ) );
+  uint32_t format = CACHE_FORMAT;
+  uint32_t config = CACHE_CONFIG;
+  putBytes( out, &format, sizeof( format ) );
+  putBytes( out, &config, sizeof( config ) );
+  uint64_t size = len;
+  putBytes( out, &hash, sizeof( hash ) );
+  putBytes( out, &size, sizeof( size ) );
+}
+
+/** Read a program from a cache file, if there's a good one for the
+    given source.
+    @param path cache file to read.
+    @param hash hash of the program's source.
+    @param len number of characters in the source.
+    @return new program, or NULL if the file is missing, was written in
+    a different format or build configuration or for a different
+    source, or is damaged.
+*/
+static Program *readCache( char const *path, uint64_t hash, size_t len )
+{
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return NULL;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if ( map == MAP_FAILED )
+    return NULL;
+
+  // The header has to match byte for byte, and the hash at the end has
+  // to match the rest of the file.
+  Serial expected;
+  openWriter( &expected );
+  saveHeader( &expected, hash, len );
+
+  char const *base = (char const *) map;
+  size_t size = st.st_size;
+  uint64_t check;
+  bool good = size > expected.len + sizeof( check ) &&
+    memcmp( base, expected.data, expected.len ) == 0;
+  if ( good ) {
+    size -= sizeof( check );
+    memcpy( &check, base + size, sizeof( check ) );
+    good = check == hashSource( base, size );
+  }
+
+  Program *prog = NULL;
+  if ( good ) {
+    prog = (Program *) malloc( sizeof( Program ) );
+    prog->arena = makeArena();
+    prog->code = NULL;
+
+    Serial in;
+    openReader( &in, base, size );
+    in.pos = expected.len;
+
+    Arena *previous = setSyntaxArena( prog->arena );
+    prog->root = loadStmt( &in );
+    setSyntaxArena( previous );
+
+    // Anything left over means the tree isn't what we wrote.
+    if ( in.bad || in.pos != in.len ) {
+      freeProgram( prog );
+      prog = NULL;
+    }
+    closeSerial( &in );
+  }
+
+  closeSerial( &expected );
+  munmap( map, st.st_size );
+  return prog;
+}
+
+/** Make a directory and any of its parents that don't exist yet, like
+    mkdir -p.
+    @param dir directory to make.
+    @return true if the directory exists now, otherwise false, with
+    errno saying why.
+*/
+static bool makeDirectories( char const *dir )
+{
+  char path[ CACHE_PATH_LEN ];
+  if ( snprintf( path, sizeof( path ), "%s", dir ) >= (int) sizeof( path ) ) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
+  // Make each parent in turn, cutting the path off after it.
+  for ( char *p = path + 1; *p; p++ ) {
+    if ( *p == '/' ) {
+      *p = '\0';
+      if ( mkdir( path, 0777 ) != 0 && errno != EEXIST )
+        return false;
+      *p = '/';
+    }
+  }
+
+  struct stat st;
+  if ( mkdir( path, 0777 ) == 0 )
+    return true;
+  if ( errno != EEXIST )
+    return false;
+  if ( stat( path, &st ) != 0 )
+    return false;
+  if ( !S_ISDIR( st.st_mode ) ) {
+    errno = ENOTDIR;
+    return false;
+  }
+  return true;
+}
+
+/** Write a program to a cache file.  It's written under a temporary
+    name, then renamed, so another run reading the same file sees all of
+    it or none of it.
+    @param path cache file to write.
+    @param hash hash of the program's source.
+    @param len number of characters in the source.
+    @param prog program to write, before it's been run.
+    @return true if the file was written, otherwise false, with errno
+    saying why.
+*/
+static bool writeCache( char const *path, uint64_t hash, size_t len,
+                        Program *prog )
+{
+  Serial out;
+  openWriter( &out );
+  saveHeader( &out, hash, len );
+  saveStmt( prog->root, &out );
+  uint64_t check = hashSource( (char const *) out.data, out.len );
+  putBytes( &out, &check, sizeof( check ) );
+
+  // mkstemp() picks a name nobody else is using, even another thread
+  // writing the same cache file.  It makes the file private, but it
+  // should be readable like one fopen() makes.
+  char temp[ CACHE_PATH_LEN ];
+  FILE *fp = NULL;
+  if ( snprintf( temp, sizeof( temp ), "%s.XXXXXX", path ) <
+       (int) sizeof( temp ) ) {
+    int fd = mkstemp( temp );
+    if ( fd >= 0 )
+      fchmod( fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+    if ( fd >= 0 && !( fp = fdopen( fd, "wb" ) ) ) {
+      close( fd );
+      remove( temp );
+    }
+  } else {
+    errno = ENAMETOOLONG;
+  }
+
+  // Whatever went wrong first is what errno says, not the cleanup.
+  bool ok = fp != NULL;
+  if ( fp ) {
+    ok = fwrite( out.data, 1, out.len, fp ) == out.len;
+    ok = fclose( fp ) == 0 && ok && rename( temp, path ) == 0;
+    if ( !ok ) {
+      int error = errno;
+      remove( temp );
+      errno = error;
+    }
+  }
+
+  closeSerial( &out );
+  return ok;
+}
+
+Program *loadCachedProgram( FILE *fp, char const *dir )
+{
+  // A streamed source can't be hashed before it's parsed, so it's
+  // parsed as usual.
+  Tokenizer *tz = makeTokenizer( fp );
+  char const *text;
+  size_t len;
+  if ( !sourceText( tz, &text, &len ) )
+    return parseProgram( tz );
+
+  uint64_t hash = hashSource( text, len );
+  char path[ CACHE_PATH_LEN ];
+  if ( snprintf( path, sizeof( path ), "%s/%016" PRIx64 ".ast", dir,
+                 hash ) >= (int) sizeof( path ) )
+    return parseProgram( tz );
+
+  Program *prog = readCache( path, hash, len );
+  if ( prog ) {
+    freeTokenizer( tz );
+    return prog;
+  }
+
+  // Syntax errors are passed on from here, so programs with errors
+  // aren't cached.  The program can still run if it can't be cached,
+  // but every run would parse it again, so that's reported.
+  prog = parseProgram( tz );
+  if ( !makeDirectories( dir ) || !writeCache( path, hash, len, prog ) )
+    fprintf( stderr, "%s: can't write to the script cache: %s\n", dir,
+             strerror( errno ) );
+  return prog;
+}
+
+void runProgram( Program *prog, Environment *env, bool vm )
+{
+  // If it was profiled last time, or a profiled run stopped with an
+  // error, the tree still has the profiling functions in it.
+  Interp *interp = currentInterp();
+  if ( interp->profile )
+    profileStmt( prog->root, NULL );
+
+  if ( vm ) {
+    if ( !prog->code )
+      prog->code = compileStmt( prog->root );
+    runCode( prog->code, env );
+  } else {
+    specializeStmt( prog->root, env );
+    if ( interp->profiling )
+      profileStmt( prog->root, interp->profile );
+    prog->root->execute( prog->root, env );
+    if ( interp->profiling )
+      profileStmt( prog->root, NULL );
+  }
+}
+
+void freeProgram( Program *prog )
+{
+  if ( prog->code )
+    freeCode( prog->code );
+  prog->root->destroy( prog->root );
+  countArenaFreed( prog->arena );
+  freeArena( prog->arena );
+  free( prog );
+}
@@ -0,0 +1,65 @@
+/**
+  @file program.h
+  @author Sean Hinton (sahinto2)
+
+  A whole program, parsed once and then run as many times as needed.
+  Unlike interpret's default mode, which runs each top-level statement
+  as soon as it's parsed, the entire source is parsed before any of it
+  runs, so a syntax error anywhere stops the program before it prints
+  anything.
+*/
+
+#ifndef _PROGRAM_H_
+#define _PROGRAM_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "value.h"
+
+/** Short name for a program, its representation is hidden in program.c. */
+typedef struct ProgramStruct Program;
+
+/** Parse every statement in the given source into a new program.  The
+    program's syntax tree is kept in an arena of its own.  Syntax errors
+    are raised in the current context, like they are for parseStmt(), after
+    freeing everything parsed so far.
+    @param fp source of the program.
+    @return new, dynamically allocated program.  The caller must
+    eventually free it with freeProgram().
+*/
+Program *loadProgram( FILE *fp );
+
+/** Load a program like loadProgram(), using a cache of compiled scripts
+    to skip parsing it if it's been seen before.  The cache holds each
+    program's syntax tree in a file named for a hash of its source, and
+    a file is only used if it was written in the same format, by a
+    build with the same configuration, for exactly the same source.  Otherwise, the program is
+    parsed, and its tree is written to the cache for next time.  The
+    cache only saves time, so a file that can't be read is just parsed
+    again, and if the tree can't be written, that's reported on
+    standard error and the program runs anyway.  A streamed source is
+    always parsed.
+    @param fp source of the program.
+    @param dir directory for the cache, created along with any missing
+    parents if it doesn't exist.
+    @return new, dynamically allocated program, as for loadProgram().
+*/
+Program *loadCachedProgram( FILE *fp, char const *dir );
+
+/** Run a program from start to finish.  A program can be run any number
+    of times, usually with a fresh environment each time.
+    @param prog program to run.
+    @param env environment for the program's variables.
+    @param vm true if the program should run as compiled code on the VM,
+    rather than with the tree-walking evaluator.  The code is compiled
+    the first time it's needed, then reused.
+*/
+void runProgram( Program *prog, Environment *env, bool vm );
+
+/** Free all the memory used by a program.
+    @param prog program to free.
+*/
+void freeProgram( Program *prog );
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * @file serial.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of the encoding for serialized syntax trees.  Ints are
+ * zigzag encoded, so small negative numbers stay small, then written
+ * seven bits at a time with the high bit set on every byte but the last.
+*/
+#include "serial.h"
+#include "parse.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/** Initial size of a block we're writing. */
+#define INIT_SERIAL 4096
+
+/** Most bytes an encoded int can take. */
+#define MAX_INT_BYTES 5
+
+/** Symbol returned when a variable can't be read. */
+static Symbol const badSymbol;
+
+void openWriter( Serial *s )
+{
+  memset( s, 0, sizeof( Serial ) );
+  s->cap = INIT_SERIAL;
+  s->data = (unsigned char *) malloc( s->cap );
+}
+
+void openReader( Serial *s, void const *data, size_t len )
+{
+  memset( s, 0, sizeof( Serial ) );
+  s->data = (unsigned char *) data;
+  s->len = len;
+}
+
+void closeSerial( Serial *s )
+{
+  if ( s->cap )
+    free( s->data );
+  free( s->slotIndex );
+  free( s->syms );
+}
+
+/** Make sure there's room to write n more bytes. */
+static void makeRoom( Serial *s, size_t n )
+{
+  if ( s->len + n > s->cap ) {
+    while ( s->len + n > s->cap )
+      s->cap *= DOUBLE_CAP;
+    s->data = (unsigned char *) realloc( s->data, s->cap );
+  }
+}
+
+void putInt( Serial *s, int val )
+{
+  makeRoom( s, MAX_INT_BYTES );
+  uint32_t u = ( (uint32_t) val << 1 ) ^ (uint32_t) -( val < 0 );
+  while ( u >= 0x80 ) {
+    s->data[ s->len++ ] = (unsigned char) ( u | 0x80 );
+    u >>= 7;
+  }
+  s->data[ s->len++ ] = (unsigned char) u;
+}
+
+void putBytes( Serial *s, void const *bytes, size_t n )
+{
+  makeRoom( s, n );
+  memcpy( s->data + s->len, bytes, n );
+  s->len += n;
+}
+
+void putLine( Serial *s, int line )
+{
+  putInt( s, line - s->line );
+  s->line = line;
+}
+
+void putSymbol( Serial *s, Symbol const *sym )
+{
+  if ( sym->slot >= s->slotCap ) {
+    int cap = s->slotCap ? s->slotCap : INIT_CAP;
+    while ( sym->slot >= cap )
+      cap *= DOUBLE_CAP;
+    s->slotIndex = (int *) realloc( s->slotIndex, cap * sizeof( int ) );
+    memset( s->slotIndex + s->slotCap, 0,
+            ( cap - s->slotCap ) * sizeof( int ) );
+    s->slotCap = cap;
+  }
+
+  // A variable we've already written is just its index.  The first time,
+  // the next index is followed by its name.
+  int index = s->slotIndex[ sym->slot ];
+  if ( index ) {
+    putInt( s, index - 1 );
+    return;
+  }
+
+  s->slotIndex[ sym->slot ] = ++s->symCount;
+  putInt( s, s->symCount - 1 );
+  int len = strlen( sym->name );
+  putInt( s, len );
+  putBytes( s, sym->name, len );
+}
+
+int getInt( Serial *s )
+{
+  uint32_t u = 0;
+  for ( int shift = 0; shift < 7 * MAX_INT_BYTES; shift += 7 ) {
+    if ( s->pos >= s->len ) {
+      s->bad = true;
+      return 0;
+    }
+
+    unsigned char b = s->data[ s->pos++ ];
+    u |= (uint32_t) ( b & 0x7F ) << shift;
+    if ( !( b & 0x80 ) )
+      return (int) ( ( u >> 1 ) ^ -( u & 1 ) );
+  }
+
+  s->bad = true;
+  return 0;
+}
+
+int getLine( Serial *s )
+{
+  // A bad difference can't overflow, it just gives a bad line.
+  s->line = (int) ( (unsigned) s->line + (unsigned) getInt( s ) );
+  return s->line;
+}
+
+int getCount( Serial *s )
+{
+  int n = getInt( s );
+  if ( n < 0 || (size_t) n > s->len - s->pos ) {
+    s->bad = true;
+    return 0;
+  }
+  return n;
+}
+
+void getBytes( Serial *s, void *bytes, size_t n )
+{
+  if ( n > s->len - s->pos ) {
+    s->bad = true;
+    memset( bytes, 0, n );
+    return;
+  }
+
+  memcpy( bytes, s->data + s->pos, n );
+  s->pos += n;
+}
+
+Symbol const *getSymbol( Serial *s )
+{
+  int index = getInt( s );
+  if ( index >= 0 && index < s->symCount )
+    return s->syms[ index ];
+
+  // Otherwise, it has to be the next new one, followed by its name.
+  int len = getInt( s );
+  if ( index != s->symCount || len < 1 || len > MAX_VAR_NAME ||
+       (size_t) len > s->len - s->pos ) {
+    s->bad = true;
+    return &badSymbol;
+  }
+
+  if ( s->symCount >= s->symCap ) {
+    s->symCap = s->symCap ? s->symCap * DOUBLE_CAP : INIT_CAP;
+    s->syms = (Symbol const **) realloc( s->syms,
+                                         s->symCap * sizeof( Symbol * ) );
+  }
+
+  Symbol const *sym = internName( (char const *) s->data + s->pos, len );
+  s->pos += len;
+  s->syms[ s->symCount++ ] = sym;
+  return sym;
+}
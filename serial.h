@@ -0,0 +1,133 @@
+/**
+  @file serial.h
+  @author Sean Hinton (sahinto2)
+
+  A compact, position-independent encoding for syntax trees, used by the
+  compiled script cache (see loadCachedProgram() in program.h).  Ints are
+  written as variable-length numbers, so small ones take a single byte,
+  and line numbers are written relative to the one before.  Variables
+  are written by name the first time each one appears, then by a short
+  index.  Names are resolved in the current context when they're read,
+  so a tree can be read into a different run than the one that wrote
+  it.
+*/
+
+#ifndef _SERIAL_H_
+#define _SERIAL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "value.h"
+
+/** A block of serialized data being written or read. */
+typedef struct {
+  /** The bytes, and how many there are.  When writing, the block is
+      owned by the Serial and grows as needed. */
+  unsigned char *data;
+  size_t len;
+  size_t cap;
+
+  /** Position of the next byte to read. */
+  size_t pos;
+
+  /** Set if we've tried to read past the end, or read something that
+      doesn't make sense.  Reading carries on, returning zeros, so the
+      caller only has to check this at the end. */
+  bool bad;
+
+  /** When writing, the index each slot was given plus one, or zero for
+      variables that haven't been written yet. */
+  int *slotIndex;
+  int slotCap;
+
+  /** When reading, the symbol for each index. */
+  Symbol const **syms;
+  int symCap;
+
+  /** Number of variables written or read so far. */
+  int symCount;
+
+  /** Line of the last node written or read.  Lines are written as the
+      difference from this, which is usually small. */
+  int line;
+} Serial;
+
+/** Start writing a new, empty block.
+    @param s block to initialize.
+*/
+void openWriter( Serial *s );
+
+/** Start reading a block of serialized data.
+    @param s block to initialize.
+    @param data bytes to read.  They're used in place, so they have to
+    stay put until we're done.
+    @param len number of bytes.
+*/
+void openReader( Serial *s, void const *data, size_t len );
+
+/** Free the memory used for a block we were writing or reading.
+    @param s block we're done with.
+*/
+void closeSerial( Serial *s );
+
+/** Add an int.
+    @param s block to add to.
+    @param val value to add.
+*/
+void putInt( Serial *s, int val );
+
+/** Add a block of bytes, as they are.
+    @param s block to add to.
+    @param bytes bytes to add.
+    @param n number of bytes.
+*/
+void putBytes( Serial *s, void const *bytes, size_t n );
+
+/** Add the line number for a node.
+    @param s block to add to.
+    @param line line number to add.
+*/
+void putLine( Serial *s, int line );
+
+/** Add a variable.
+    @param s block to add to.
+    @param sym symbol for the variable.
+*/
+void putSymbol( Serial *s, Symbol const *sym );
+
+/** Read an int.
+    @param s block to read from.
+    @return the next int, or zero if there isn't one.
+*/
+int getInt( Serial *s );
+
+/** Read the line number for a node.
+    @param s block to read from.
+    @return the line number.
+*/
+int getLine( Serial *s );
+
+/** Read a count of things that each take at least one more byte, so a
+    bad count can't ask for more than the rest of the block.
+    @param s block to read from.
+    @return the count, or zero if it's not a reasonable one.
+*/
+int getCount( Serial *s );
+
+/** Read a block of bytes.
+    @param s block to read from.
+    @param bytes where to copy the bytes.
+    @param n number of bytes to read.  If there aren't that many, bytes
+    is filled with zeros.
+*/
+void getBytes( Serial *s, void *bytes, size_t n );
+
+/** Read a variable, resolving its name in the current context.
+    @param s block to read from.
+    @return symbol for the variable.  If there isn't one, this is a
+    symbol that doesn't belong to any context.
+*/
+Symbol const *getSymbol( Serial *s );
+
+#endif
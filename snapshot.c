@@ -0,0 +1,439 @@
+/**
+ * @file snapshot.c
+ * @author Sean Hinton (sahinto2)
+ * Implementation of environment snapshots.  An image has a header, the
+ * variables, a table of blocks of elements, a table of sequences saying
+ * which block each one views, then the elements of every block.  Each
+ * part starts on an IMAGE_ALIGN boundary, so elements can be used right
+ * where they're mapped.
+*/
+
+// For mmap() and fstat().
+#define _POSIX_C_SOURCE 200809L
+
+#include "snapshot.h"
+#include "parse.h"
+#include "context.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Identifies an environment image, and the version of its format. */
+#define IMAGE_MAGIC "ENVIMG2"
+
+/** Describes the parts of the build an image depends on, since it's
+    written as it is in memory: the size of an int, and the byte
+    order. */
+#define IMAGE_CONFIG ( (uint32_t) sizeof( int ) << 24 | 0x00010203 )
+
+/** Alignment of every part of an image, and of every block of
+    elements. */
+#define IMAGE_ALIGN 8
+
+/** Round a size up to a multiple of IMAGE_ALIGN. */
+#define ALIGN_UP( n ) ( ( (n) + IMAGE_ALIGN - 1 ) & ~(uint64_t) ( IMAGE_ALIGN - 1 ) )
+
+/** Initial number of entries in a set of sequences (a power of two). */
+#define INIT_SET 64
+
+/** Start of an image. */
+typedef struct {
+  char magic[ sizeof( IMAGE_MAGIC ) ];
+
+  /** Number of variables, sequences and blocks of elements. */
+  uint32_t vars;
+  uint32_t seqs;
+  uint32_t blocks;
+
+  /** IMAGE_CONFIG for the build that wrote the image. */
+  uint32_t config;
+
+  /** Size of the whole image, in bytes. */
+  uint64_t size;
+} ImageHeader;
+
+/** One variable in an image. */
+typedef struct {
+  char name[ MAX_VAR_NAME + 1 ];
+
+  /** Index of the variable's sequence, or -1 if it's an int. */
+  int32_t seq;
+
+  /** The variable's value, if it's an int. */
+  int32_t ival;
+} ImageVar;
+
+/** One block of elements in an image, shared by all the sequences that
+    view it. */
+typedef struct {
+  /** Where the elements start, from the start of the image. */
+  uint64_t offset;
+
+  /** Number of elements, and bytes in each one. */
+  int32_t len;
+  int32_t width;
+} ImageBlock;
+
+/** Where each part of an image starts. */
+typedef struct {
+  uint64_t vars;
+  uint64_t blocks;
+  uint64_t seqs;
+  uint64_t data;
+} ImageLayout;
+
+// Hidden representation for a loaded image, a mapping of the file.
+struct SnapshotStruct {
+  void *map;
+  size_t size;
+
+  /** Next image loaded in the same context. */
+  Snapshot *next;
+};
+
+/** Work out where the parts of an image go.
+    @param head header of the image, with its counts filled in.
+    @return offsets of the parts.
+*/
+static ImageLayout layoutImage( ImageHeader const *head )
+{
+  ImageLayout at;
+  at.vars = ALIGN_UP( sizeof( ImageHeader ) );
+  at.blocks = ALIGN_UP( at.vars + (uint64_t) head->vars * sizeof( ImageVar ) );
+  at.seqs = ALIGN_UP( at.blocks +
+                      (uint64_t) head->blocks * sizeof( ImageBlock ) );
+  at.data = ALIGN_UP( at.seqs + (uint64_t) head->seqs * sizeof( int32_t ) );
+  return at;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Saving
+
+/** Distinct sequences, each given an index in the order they're found.
+    Sequences are found through an open-addressed table keyed by
+    address. */
+typedef struct {
+  /** Table of sequences and their indices, NULL for an empty entry. */
+  Sequence **keys;
+  int *index;
+
+  /** Entries in the table, always a power of two. */
+  int cap;
+
+  /** Sequences in index order. */
+  Sequence **list;
+  int len;
+} SeqSet;
+
+/** Everything we need to write an image, collected from the variables. */
+typedef struct {
+  ImageVar *vars;
+  int varCount;
+  int varCap;
+
+  /** Sequences the variables hold. */
+  SeqSet seqs;
+
+  /** Sequences that own the elements we need to save, either the
+      sequences themselves or the payloads they view. */
+  SeqSet blocks;
+} Collector;
+
+/** Initialize an empty set. */
+static void initSet( SeqSet *set )
+{
+  set->cap = INIT_SET;
+  set->keys = (Sequence **) calloc( set->cap, sizeof( Sequence * ) );
+  set->index = (int *) malloc( set->cap * sizeof( int ) );
+  set->list = (Sequence **) malloc( set->cap * sizeof( Sequence * ) );
+  set->len = 0;
+}
+
+/** Free the memory used by a set. */
+static void freeSet( SeqSet *set )
+{
+  free( set->keys );
+  free( set->index );
+  free( set->list );
+}
+
+/** Find the table entry for a sequence, or the empty one where it
+    should go. */
+static int findEntry( SeqSet const *set, Sequence const *seq )
+{
+  unsigned mask = set->cap - 1;
+  unsigned pos = (unsigned) ( ( (uintptr_t) seq >> 4 ) * 2654435761u ) & mask;
+  while ( set->keys[ pos ] && set->keys[ pos ] != seq )
+    pos = ( pos + 1 ) & mask;
+  return pos;
+}
+
+/** Return the index of a sequence in a set, adding it if it's new.
+    @param set set to look in.
+    @param seq sequence to find.
+    @return index of the sequence.
+*/
+static int addToSet( SeqSet *set, Sequence *seq )
+{
+  int pos = findEntry( set, seq );
+  if ( set->keys[ pos ] )
+    return set->index[ pos ];
+
+  // Keep the table at most half full.  The list grows with it.
+  if ( ( set->len + 1 ) * DOUBLE_CAP > set->cap ) {
+    SeqSet old = *set;
+    set->cap *= DOUBLE_CAP;
+    set->keys = (Sequence **) calloc( set->cap, sizeof( Sequence * ) );
+    set->index = (int *) malloc( set->cap * sizeof( int ) );
+    set->list = (Sequence **) realloc( set->list,
+                                       set->cap * sizeof( Sequence * ) );
+    for ( int i = 0; i < old.cap; i++ )
+      if ( old.keys[ i ] ) {
+        int p = findEntry( set, old.keys[ i ] );
+        set->keys[ p ] = old.keys[ i ];
+        set->index[ p ] = old.index[ i ];
+      }
+    free( old.keys );
+    free( old.index );
+    pos = findEntry( set, seq );
+  }
+
+  set->keys[ pos ] = seq;
+  set->index[ pos ] = set->len;
+  set->list[ set->len ] = seq;
+  return set->len++;
+}
+
+/** Record one variable, for visitVariables(). */
+static void collectVariable( char const *name, Value val, void *data )
+{
+  Collector *c = (Collector *) data;
+  if ( c->varCount >= c->varCap ) {
+    c->varCap *= DOUBLE_CAP;
+    c->vars = (ImageVar *) realloc( c->vars, c->varCap * sizeof( ImageVar ) );
+  }
+
+  ImageVar *var = c->vars + c->varCount++;
+  memset( var, 0, sizeof( ImageVar ) );
+  strcpy( var->name, name );
+  if ( val.vtype == SeqType ) {
+    var->seq = addToSet( &c->seqs, val.sval );
+
+    // A view is saved with the payload it views, so views that shared
+    // elements still share them.
+    addToSet( &c->blocks, val.sval->owner ? val.sval->owner : val.sval );
+  } else {
+    var->seq = -1;
+    var->ival = val.ival;
+  }
+}
+
+/** Write zeros up to the next IMAGE_ALIGN boundary. */
+static void writePadding( FILE *fp, uint64_t len )
+{
+  static char const zeros[ IMAGE_ALIGN ] = { 0 };
+  fwrite( zeros, 1, ALIGN_UP( len ) - len, fp );
+}
+
+void saveSnapshot( Environment *env, char const *path )
+{
+  Collector c;
+  c.varCap = INIT_CAP;
+  c.varCount = 0;
+  c.vars = (ImageVar *) malloc( c.varCap * sizeof( ImageVar ) );
+  initSet( &c.seqs );
+  initSet( &c.blocks );
+  visitVariables( env, collectVariable, &c );
+
+  ImageHeader head;
+  memset( &head, 0, sizeof( head ) );
+  strcpy( head.magic, IMAGE_MAGIC );
+  head.vars = c.varCount;
+  head.seqs = c.seqs.len;
+  head.blocks = c.blocks.len;
+  head.config = IMAGE_CONFIG;
+  ImageLayout at = layoutImage( &head );
+
+  // Lay out the elements of every block, one after another.
+  ImageBlock *blocks = (ImageBlock *) malloc( ( c.blocks.len + 1 ) *
+                                              sizeof( ImageBlock ) );
+  uint64_t offset = at.data;
+  for ( int i = 0; i < c.blocks.len; i++ ) {
+    Sequence const *seq = c.blocks.list[ i ];
+    blocks[ i ].offset = offset;
+    blocks[ i ].len = seq->len;
+    blocks[ i ].width = seq->width;
+    offset = ALIGN_UP( offset + (uint64_t) seq->len * seq->width );
+  }
+  head.size = offset;
+
+  int32_t *seqs = (int32_t *) malloc( ( c.seqs.len + 1 ) * sizeof( int32_t ) );
+  for ( int i = 0; i < c.seqs.len; i++ ) {
+    Sequence *seq = c.seqs.list[ i ];
+    seqs[ i ] = addToSet( &c.blocks, seq->owner ? seq->owner : seq );
+  }
+
+  FILE *fp = fopen( path, "wb" );
+  bool ok = fp != NULL;
+  if ( ok ) {
+    fwrite( &head, sizeof( head ), 1, fp );
+    writePadding( fp, sizeof( head ) );
+    fwrite( c.vars, sizeof( ImageVar ), c.varCount, fp );
+    writePadding( fp, at.vars + (uint64_t) c.varCount * sizeof( ImageVar ) );
+    fwrite( blocks, sizeof( ImageBlock ), c.blocks.len, fp );
+    writePadding( fp, at.blocks +
+                  (uint64_t) c.blocks.len * sizeof( ImageBlock ) );
+    fwrite( seqs, sizeof( int32_t ), c.seqs.len, fp );
+    writePadding( fp, at.seqs + (uint64_t) c.seqs.len * sizeof( int32_t ) );
+    for ( int i = 0; i < c.blocks.len; i++ ) {
+      Sequence const *seq = c.blocks.list[ i ];
+      uint64_t bytes = (uint64_t) seq->len * seq->width;
+      fwrite( seq->seq, 1, bytes, fp );
+      writePadding( fp, bytes );
+    }
+    ok = !ferror( fp );
+    ok = fclose( fp ) == 0 && ok;
+  }
+
+  free( seqs );
+  free( blocks );
+  freeSet( &c.blocks );
+  freeSet( &c.seqs );
+  free( c.vars );
+  if ( !ok )
+    raiseError( INTERP_RUNTIME_ERROR, "%s: can't write environment image",
+                path );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Loading
+
+/** Check that a mapped image is well formed, and written by a build
+    with the same int size and byte order, so everything in it can be
+    used without checking it again.
+    @param map start of the image.
+    @param size bytes in the image.
+    @return true if it's a good image.
+*/
+static bool checkImage( char const *map, size_t size )
+{
+  ImageHeader const *head = (ImageHeader const *) map;
+  if ( size < sizeof( ImageHeader ) ||
+       memcmp( head->magic, IMAGE_MAGIC, sizeof( head->magic ) ) != 0 ||
+       head->config != IMAGE_CONFIG || head->size != size )
+    return false;
+
+  ImageLayout at = layoutImage( head );
+  if ( at.data > size )
+    return false;
+
+  ImageVar const *vars = (ImageVar const *) ( map + at.vars );
+  for ( uint32_t i = 0; i < head->vars; i++ ) {
+    int len = strnlen( vars[ i ].name, MAX_VAR_NAME + 1 );
+    if ( len == 0 || len > MAX_VAR_NAME ||
+         vars[ i ].seq < -1 || vars[ i ].seq >= (int64_t) head->seqs )
+      return false;
+  }
+
+  ImageBlock const *blocks = (ImageBlock const *) ( map + at.blocks );
+  for ( uint32_t i = 0; i < head->blocks; i++ ) {
+    ImageBlock const *b = blocks + i;
+    if ( ( b->width != 1 && b->width != 2 && b->width != 4 ) ||
+         b->len < 0 || b->offset < at.data || b->offset % IMAGE_ALIGN ||
+         b->offset + (uint64_t) b->len * b->width > size )
+      return false;
+  }
+
+  int32_t const *seqs = (int32_t const *) ( map + at.seqs );
+  for ( uint32_t i = 0; i < head->seqs; i++ )
+    if ( seqs[ i ] < 0 || seqs[ i ] >= (int64_t) head->blocks )
+      return false;
+
+  return true;
+}
+
+void loadSnapshot( Environment *env, char const *path )
+{
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    raiseError( INTERP_RUNTIME_ERROR, "%s: %s", path, strerror( errno ) );
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if ( fstat( fd, &st ) == 0 && st.st_size >= (off_t) sizeof( ImageHeader ) )
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+
+  if ( map == MAP_FAILED || !checkImage( (char const *) map, st.st_size ) ) {
+    if ( map != MAP_FAILED )
+      munmap( map, st.st_size );
+    raiseError( INTERP_RUNTIME_ERROR, "%s: not an environment image", path );
+  }
+
+  // The context keeps the image mapped for as long as it might be used.
+  Interp *interp = currentInterp();
+  Snapshot *image = (Snapshot *) malloc( sizeof( Snapshot ) );
+  image->map = map;
+  image->size = st.st_size;
+  image->next = interp->snapshots;
+  interp->snapshots = image;
+
+  char const *base = (char const *) map;
+  ImageHeader const *head = (ImageHeader const *) base;
+  ImageLayout at = layoutImage( head );
+  ImageVar const *vars = (ImageVar const *) ( base + at.vars );
+  ImageBlock const *blocks = (ImageBlock const *) ( base + at.blocks );
+  int32_t const *seqs = (int32_t const *) ( base + at.seqs );
+
+  // Every block becomes a payload that borrows its elements from the
+  // image, and every sequence a view of one.  The references they hold on
+  // each other and the ones the variables hold give them the right
+  // reference counts.  We hold one of our own while we're building them,
+  // so anything nobody uses gets freed at the end.
+  Sequence **payload = (Sequence **) malloc( ( head->blocks + 1 ) *
+                                             sizeof( Sequence * ) );
+  for ( uint32_t i = 0; i < head->blocks; i++ ) {
+    payload[ i ] = makeBorrowedSequence( base + blocks[ i ].offset,
+                                         blocks[ i ].len, blocks[ i ].width );
+    grabSequence( payload[ i ] );
+  }
+
+  Sequence **seq = (Sequence **) malloc( ( head->seqs + 1 ) *
+                                         sizeof( Sequence * ) );
+  for ( uint32_t i = 0; i < head->seqs; i++ ) {
+    seq[ i ] = makeSequenceView( payload[ seqs[ i ] ] );
+    grabSequence( seq[ i ] );
+  }
+
+  for ( uint32_t i = 0; i < head->vars; i++ ) {
+    ImageVar const *var = vars + i;
+    Value val = { IntType, .ival = var->ival };
+    if ( var->seq >= 0 ) {
+      val = (Value){ SeqType, .sval = seq[ var->seq ] };
+      grabSequence( val.sval );
+    }
+    setVariable( env, internName( var->name, strlen( var->name ) ), val );
+  }
+
+  for ( uint32_t i = 0; i < head->seqs; i++ )
+    releaseSequence( seq[ i ] );
+  for ( uint32_t i = 0; i < head->blocks; i++ )
+    releaseSequence( payload[ i ] );
+  free( seq );
+  free( payload );
+}
+
+void freeSnapshots( Snapshot *images )
+{
+  while ( images ) {
+    Snapshot *next = images->next;
+    munmap( images->map, images->size );
+    free( images );
+    images = next;
+  }
+}
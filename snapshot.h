@@ -0,0 +1,46 @@
+/**
+  @file snapshot.h
+  @author Sean Hinton (sahinto2)
+
+  Snapshots of an environment, saved to a file so a later run can start
+  with the same variables without running the statements that built
+  them.  A snapshot is a binary image holding every variable and every
+  sequence they can reach, with sequences that were shared still shared.
+  Loading one maps the image into memory and points each sequence at
+  its elements where they are, as a view that gets its own copy the
+  first time it's changed (see makeSequenceView()).  Images are in the
+  machine's own byte order, for warm starts on the same machine.
+*/
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "value.h"
+
+/** Short name for a loaded image, its representation is hidden in
+    snapshot.c.  Every image loaded in a context stays mapped until the
+    context is freed. */
+typedef struct SnapshotStruct Snapshot;
+
+/** Write every variable in an environment to an image file.  Errors are
+    raised in the current context.
+    @param env environment to save.
+    @param path file to write the image to.
+*/
+void saveSnapshot( Environment *env, char const *path );
+
+/** Give the variables in an image file their saved values in an
+    environment.  The names are resolved in the current context, and the
+    image stays mapped until the context is freed, so the environment has
+    to be freed first.  Errors are raised in the current context.
+    @param env environment to load into.
+    @param path image file to load.
+*/
+void loadSnapshot( Environment *env, char const *path );
+
+/** Unmap a context's list of loaded images.
+    @param images first image in the list.
+*/
+void freeSnapshots( Snapshot *images );
+
+#endif
@@ -5,55 +5,47 @@
  * Component containing the behaviors and constructors of different expression and statements
 */
 #include "syntax.h"
+#include "ops.h"
+#include "vm.h"
+#include "context.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 //////////////////////////////////////////////////////////////////////
-// Error-reporting functions
+// Memory for expressions and statements
 
-/** Report an error for a program with bad types, then exit. */
-static int reportTypeMismatch()
-{
-  fprintf( stderr, "Type mismatch\n" );
-  exit( EXIT_FAILURE );
-}
-
-/**
- * Report that index is out of bounds, then exit
-*/
-static int reportIndexOutOfBounds()
-{
-  fprintf( stderr, "Index out of bounds\n" );
-  exit( EXIT_FAILURE );
-}
+// The arena that new expressions and statements are allocated from is
+// kept in the context.
 
-/** Require a given value to be an IntType value.  Exit with an error
-    message if not.
-    @param v value to check, passed by address.
- */
-static void requireIntType( Value const *v)
+Arena *setSyntaxArena( Arena *arena )
 {
-  if ( v->vtype != IntType ){
-
-    reportTypeMismatch();
-  }
+  Interp *interp = currentInterp();
+  Arena *previous = interp->arena;
+  interp->arena = arena;
+  return previous;
 }
 
-/**
- * Checks for a typeMisMatch by requiring a sequence is the value
- * Exits with an error if not
- * @param s value that is being check passed by address
+/** Allocate memory for an expression or statement from the current
+    arena, making a default arena if none has been chosen.  The memory
+    starts out zeroed, so a node has no line and no profile until
+    they're filled in.
+    @param size number of bytes needed.
+    @return pointer to the new memory.
 */
-static void requireSeqType(Value const *s)
+static void *allocNode( size_t size )
 {
-  if(s->vtype != SeqType){
-    reportTypeMismatch();
+  Interp *interp = currentInterp();
+  if ( !interp->arena ) {
+    if ( !interp->defaultArena )
+      interp->defaultArena = makeArena();
+    interp->arena = interp->defaultArena;
   }
+  countAlloc( MEM_NODE, size );
+  return memset( arenaAlloc( interp->arena, size ), 0, size );
 }
 
-
-
 //////////////////////////////////////////////////////////////////////
 // LiteralInt
 
@@ -62,6 +54,9 @@ static void requireSeqType(Value const *s)
 typedef struct {
   Value (*eval)( Expr *expr, Environment *env );
   void (*destroy)( Expr *expr );
+  void (*compile)( Expr *expr, Code *code );
+  int line;
+  ProfileCount *profile;
 
   /** Integer value this expression evaluates to. */
   int val;
@@ -80,19 +75,26 @@ static Value evalLiteralInt( Expr *expr, Environment *env )
 /** Implementation of destroy for LiteralInt expressions. */
 static void destroyLiteralInt( Expr *expr )
 {
-  // This object is just one block of memory.  We can free it without
-  // even having to type-cast its pointer.
-  free( expr );
+  // This object is just one block of memory, and it belongs to the
+  // arena, so there's nothing to free.
+}
+
+/** Implementation of compile for LiteralInt expressions. */
+static void compileLiteralInt( Expr *expr, Code *code )
+{
+  LiteralInt *this = (LiteralInt *)expr;
+  emitInt( code, OP_INT, this->val );
 }
 
 Expr *makeLiteralInt( int val )
 {
   // Allocate space for the LiteralInt object
-  LiteralInt *this = (LiteralInt *) malloc( sizeof( LiteralInt ) );
+  LiteralInt *this = (LiteralInt *) allocNode( sizeof( LiteralInt ) );
 
   // Remember the pointers to functions for evaluating and destroying ourself.
   this->eval = evalLiteralInt;
   this->destroy = destroyLiteralInt;
+  this->compile = compileLiteralInt;
 
   // Remember the integer value we contain.
   this->val = val;
@@ -104,6 +106,10 @@ Expr *makeLiteralInt( int val )
 //////////////////////////////////////////////////////////////////////
 // SimpleExpr Struct
 
+/** Cached value for a loop-invariant expression, defined with the
+    hoisting pass below. */
+typedef struct InvariantStruct Invariant;
+
 /** Representation for an expression with either one or two
     sub-expressionts.  With the right eval funciton, this struct should
     be able to help implement any expression with either one or two
@@ -111,17 +117,27 @@ Expr *makeLiteralInt( int val )
 typedef struct {
   Value (*eval)( Expr *expr, Environment *env );
   void (*destroy)( Expr *oper );
+  void (*compile)( Expr *expr, Code *code );
+  int line;
+  ProfileCount *profile;
 
   /** The first sub-expression */
   Expr *expr1;
   
   /** The second sub-expression, or NULL if it's not needed. */
   Expr *expr2;
+
+  /** Instruction that performs this operation in compiled code. */
+  OpCode op;
+
+  /** If this expression has ever been hoisted out of a loop, its cached
+      value, or NULL.  See hoistInvariants(). */
+  Invariant *invariant;
 } SimpleExpr;
 
 /** General-purpose function for freeing an expression represented by
-    SimpleExpr.  It frees the two sub-expressions, then frees the strucct
-    itself. */
+    SimpleExpr.  It frees the two sub-expressions.  The struct itself
+    belongs to the arena. */
 static void destroySimpleExpr( Expr *expr )
 {
   // If this function gets called, expr must really be a SimpleExpr.
@@ -134,8 +150,23 @@ static void destroySimpleExpr( Expr *expr )
   if ( this->expr2 )
     this->expr2->destroy( this->expr2 );
 
-  // Then the SimpleExpr struct itself.
-  free( this );
+  // The cache for a hoisted expression is made when it's first needed,
+  // so it doesn't come from the arena.
+  free( this->invariant );
+}
+
+/** General-purpose function for compiling an expression represented by
+    SimpleExpr.  It compiles the sub-expressions in order, then adds the
+    instruction for the operation. */
+static void compileSimpleExpr( Expr *expr, Code *code )
+{
+  // If this function gets called, expr must really be a SimpleExpr.
+  SimpleExpr *this = (SimpleExpr *)expr;
+
+  this->expr1->compile( this->expr1, code );
+  if ( this->expr2 )
+    this->expr2->compile( this->expr2, code );
+  emit( code, this->op );
 }
 
 /** Helper funciton to construct a SimpleExpr representation and fill
@@ -144,148 +175,142 @@ static void destroySimpleExpr( Expr *expr )
     @param second sub-expression in the expression, or null if it only
     has one sub-expression.
     @param eval function implementing the eval mehod for this expression.
+    @param op instruction for this operation in compiled code.
     @return new expression, as a poiner to Expr.
 */
 static Expr *buildSimpleExpr( Expr *expr1, Expr *expr2,
-                              Value (*eval)( Expr *, Environment * ) )
+                              Value (*eval)( Expr *, Environment * ),
+                              OpCode op )
 {
   // Allocate space for a new SimpleExpr and fill in the pointer for
-  // its destroy function.
-  SimpleExpr *this = (SimpleExpr *) malloc( sizeof( SimpleExpr ) );
+  // its destroy and compile functions.
+  SimpleExpr *this = (SimpleExpr *) allocNode( sizeof( SimpleExpr ) );
   this->destroy = destroySimpleExpr;
+  this->compile = compileSimpleExpr;
 
   // Fill in the two parameters and the eval funciton.
   this->eval = eval;
   this->expr1 = expr1;
   this->expr2 = expr2;
+  this->op = op;
 
   return (Expr *) this;
 }
 
-//////////////////////////////////////////////////////////////////////
-// Integer addition
-
-/** Implementation of the eval function for integer addition. */
-static Value evalAdd( Expr *expr, Environment *env )
+/** Replace an operator on two literals with a literal for its value, so
+    it isn't computed again every time it runs.  A logical operator is
+    folded if its left operand decides it, since the right one wouldn't
+    be evaluated.  Anything that could fail, like dividing by zero, is
+    left to report its error at run time.
+    @param expr operator expression that was just built.
+    @return a literal for its value, or expr if it can't be folded.
+*/
+static Expr *foldConstant( Expr *expr )
 {
-  // If this function gets called, expr must really be a SimpleExpr.
-  SimpleExpr *this = (SimpleExpr *)expr;
-
-  // Evaluate our left and right operands. 
-  Value v1 = this->expr1->eval( this->expr1, env );
-  Value v2 = this->expr2->eval( this->expr2, env );
-
-  // Make sure the operands are both integers.
-  // requireIntType( &v1 );
-  // requireIntType( &v2 );
-
-  //Return an int if they are both ints
-  if(v1.vtype == IntType && v2.vtype == IntType){
-    return (Value){ IntType, .ival = v1.ival + v2.ival };
-  }
-
-  //Otherwise there is some sequence in this
-  //Both sequence
-  if(v1.vtype == v2.vtype){
-    Sequence *seq1 = v1.sval;
-    Sequence *seq2 = v2.sval;
-    grabSequence(seq1);
-    grabSequence(seq2);
-
-    Sequence *ret = makeSequence();
-
-    //grabSequence(ret);
-    //Now copy over all the elements of both array to a new sequence
-    int len1 = seq1->len;
-    for(int i = 0; i < len1; i++){
-      if(ret->len >= ret->cap){
-        ret->cap *= DOUBLE_CAP;
-        ret->seq = (int*) realloc (ret->seq, ret->cap * sizeof(int));
-      }
-      ret->seq[i] = seq1->seq[i];
-      ret->len++;
-    }
-
+  SimpleExpr *this = (SimpleExpr *) expr;
+  if ( this->expr1->eval != evalLiteralInt )
+    return expr;
+  int a = ( (LiteralInt *) this->expr1 )->val;
 
-    releaseSequence(seq1);
-    for(int i = 0; i < seq2->len; i++){
-      if(ret->len >= ret->cap){
-        ret->cap *= DOUBLE_CAP;
-        ret->seq = (int*) realloc (ret->seq, ret->cap * sizeof(int));
-      }
-      ret->seq[i + len1] = seq2->seq[i];
-      ret->len++;
+  int val;
+  if ( ( this->op == OP_AND && a == 0 ) || ( this->op == OP_OR && a != 0 ) ) {
+    val = a;
+  } else if ( this->expr2->eval != evalLiteralInt ) {
+    return expr;
+  } else {
+    // Arithmetic wraps around, the way it does when it's computed.
+    int b = ( (LiteralInt *) this->expr2 )->val;
+    switch ( this->op ) {
+    case OP_ADD: val = (int) ( (unsigned) a + (unsigned) b ); break;
+    case OP_SUB: val = (int) ( (unsigned) a - (unsigned) b ); break;
+    case OP_MUL: val = (int) ( (unsigned) a * (unsigned) b ); break;
+    case OP_DIV:
+      if ( b == 0 || ( a == INT_MIN && b == -1 ) )
+        return expr;
+      val = a / b;
+      break;
+    case OP_LESS: val = a < b; break;
+    case OP_EQUALS: val = a == b; break;
+    case OP_AND:
+    case OP_OR:
+      // The left operand didn't decide it, so it's the right one.
+      val = b;
+      break;
+    default:
+      return expr;
     }
+  }
 
+  currentInterp()->foldedConstants++;
+  expr->destroy( expr );
+  return makeLiteralInt( val );
+}
 
-    releaseSequence(seq2);
-
-    //Now return the value
-    return (Value) {SeqType, .sval = ret};
-
-  }
-  //Only the first is a sequence
-  else if(v1.vtype == SeqType){
-    Sequence *seq1 = v1.sval;
-    grabSequence(seq1);
-    Sequence *ret = makeSequence();
-
-    //grabSequence(ret);
-    int len1 = seq1->len;
-    for(int i = 0; i < len1; i++){
-      if(ret->len >= ret->cap){
-        ret->cap *= DOUBLE_CAP;
-        ret->seq = (int*) realloc (ret->seq, ret->cap * sizeof(int));
-      }
-      ret->seq[i] = seq1->seq[i];
-      ret->len++;
-    }
+/** Eval function for an int operation that leaves its left operand
+    unchanged, like x + 0 or x * 1, see specializeExpr(). */
+static Value evalLeftOperand( Expr *expr, Environment *env )
+{
+  SimpleExpr *this = (SimpleExpr *)expr;
+  return this->expr1->eval( this->expr1, env );
+}
 
-    //
-    if(ret->len >= ret->cap){
-        ret->cap *= DOUBLE_CAP;
-        ret->seq = (int*) realloc (ret->seq, ret->cap * sizeof(int));
-    }
-    ret->seq[ret->len] = v2.ival;
-    ret->len++;
-    releaseSequence(seq1);
-    return (Value) {SeqType, .sval = ret};
+/** Eval function for an int operation that leaves its right operand
+    unchanged, like 0 + x or 1 * x. */
+static Value evalRightOperand( Expr *expr, Environment *env )
+{
+  SimpleExpr *this = (SimpleExpr *)expr;
+  return this->expr2->eval( this->expr2, env );
+}
 
-  }
-  else if(v2.vtype == SeqType){
-    Sequence *seq2 = v2.sval;
-    grabSequence(seq2);
-    Sequence *ret = makeSequence();
-
-    //grabSequence(ret);
-    //Now copy over all the elements of both array to a new sequence
-    ret->seq[0] = v1.ival;
-    ret->len++;
-    for(int i = 0; i < seq2->len; i++){
-      if(ret->len >= ret->cap){
-        ret->cap *= DOUBLE_CAP;
-        ret->seq = (int*) realloc (ret->seq, ret->cap * sizeof(int));
-      }
-      ret->seq[ret->len] = seq2->seq[i];
-      ret->len++;
-    }
+/** Evaluate the operands of a binary operator, then apply it.  Each
+    operand is held while the other one is evaluated and the operator
+    runs, so temporaries are freed if either of them reports an error.
+    @param this operator expression.
+    @param env environment for evaluating the operands.
+    @param op function that applies the operator to the two values.
+    @return result of the operator.
+*/
+static Value evalOperands( SimpleExpr *this, Environment *env,
+                           Value (*op)( Value v1, Value v2 ) )
+{
+  Value v1 = this->expr1->eval( this->expr1, env );
+  holdValue( v1 );
+  Value v2 = this->expr2->eval( this->expr2, env );
+  holdValue( v2 );
 
-    releaseSequence(seq2);
-    return (Value) {SeqType, .sval = ret};
+  Value result = op( v1, v2 );
+  dropValue( v2 );
+  dropValue( v1 );
+  return result;
+}
 
-  }
+//////////////////////////////////////////////////////////////////////
+// Integer addition
 
-  //Never reached
-  return (Value){ IntType, .ival = 0 };
-  
+/** Implementation of the eval function for integer addition. */
+static Value evalAdd( Expr *expr, Environment *env )
+{
+  // If this function gets called, expr must really be a SimpleExpr.
+  SimpleExpr *this = (SimpleExpr *)expr;
 
-  
+  // Add the ints or concatenate the sequences.
+  return evalOperands( this, env, addValues );
 }
 
 Expr *makeAdd( Expr *left, Expr *right )
 {
   // Use the convenience function to build a SimpleExpr for addition
-  return buildSimpleExpr( left, right, evalAdd );
+  return foldConstant( buildSimpleExpr( left, right, evalAdd, OP_ADD ) );
+}
+
+/** Eval function for addition when both operands are known to be
+    ints, see specializeStmt(). */
+static Value evalAddIntInt( Expr *expr, Environment *env )
+{
+  SimpleExpr *this = (SimpleExpr *)expr;
+  int a = this->expr1->eval( this->expr1, env ).ival;
+  int b = this->expr2->eval( this->expr2, env ).ival;
+  return (Value){ IntType, .ival = a + b };
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -297,22 +322,24 @@ static Value evalSub( Expr *expr, Environment *env )
   // If this function gets called, expr must really be a SimpleExpr.
   SimpleExpr *this = (SimpleExpr *)expr;
 
-  // Evaluate our left and right operands. 
-  Value v1 = this->expr1->eval( this->expr1, env );
-  Value v2 = this->expr2->eval( this->expr2, env );
-
-  // Make sure the operands are both integers.
-  requireIntType( &v1 );
-  requireIntType( &v2 );
-
   // Return the difference of the two expression values.
-  return (Value){ IntType, .ival = v1.ival - v2.ival };
+  return evalOperands( this, env, subValues );
 }
 
 Expr *makeSub( Expr *left, Expr *right )
 {
   // Use the convenience function to build a SimpleExpr for subtraction.
-  return buildSimpleExpr( left, right, evalSub );
+  return foldConstant( buildSimpleExpr( left, right, evalSub, OP_SUB ) );
+}
+
+/** Eval function for subtraction when both operands are known to be
+    ints. */
+static Value evalSubIntInt( Expr *expr, Environment *env )
+{
+  SimpleExpr *this = (SimpleExpr *)expr;
+  int a = this->expr1->eval( this->expr1, env ).ival;
+  int b = this->expr2->eval( this->expr2, env ).ival;
+  return (Value){ IntType, .ival = a - b };
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -324,71 +351,24 @@ static Value evalMul( Expr *expr, Environment *env )
   // If this function gets called, expr must really be a SimpleExpr.
   SimpleExpr *this = (SimpleExpr *)expr;
 
-  // Evaluate our left and right operands. 
-  Value v1 = this->expr1->eval( this->expr1, env );
-  Value v2 = this->expr2->eval( this->expr2, env );
-
-  //Do a multiplication of sequences if one value is a sequnece
-  if(v1.vtype == SeqType){
-    Sequence *seq = v1.sval;
-    grabSequence(seq);
-    Sequence *ret = makeSequence();
-    int times = v2.ival;
-    for(int i = 0; i < times; i++){
-      for(int j = 0; j < seq->len; j++){
-        if(ret->len >= ret->cap){
-          ret->cap *= DOUBLE_CAP;
-          ret->seq = (int*)realloc(ret->seq, ret->cap * sizeof(int) );
-        }
-        ret->seq[ret->len] = seq->seq[j];
-        ret->len++;
-      }
-    }
-
-    releaseSequence(seq);
-    return (Value){SeqType, .sval = ret};
-  }
-  else if(v2.vtype == SeqType){
-    Sequence *seq = v2.sval;
-    grabSequence(seq);
-    Sequence *ret = makeSequence();
-    int times = v1.ival;
-    for(int i = 0; i < times; i++){
-      for(int j = 0; j < seq->len; j++){
-        if(ret->len >= ret->cap){
-          ret->cap *= DOUBLE_CAP;
-          ret->seq = (int*)realloc(ret->seq, ret->cap * sizeof(int) );
-        }
-        ret->seq[ret->len] = seq->seq[j];
-        ret->len++;
-      }
-      // if(ret->len + seq->len >= ret->cap){
-      //     ret->cap *= DOUBLE_CAP;
-      //     ret->cap += seq->len;
-      //     ret->seq = (int*)realloc(ret->seq, ret->cap * sizeof(int));
-      // }
-      // ret->seq[i * seq->len] = seq->seq;
-    }
-
-    releaseSequence(seq);
-    return (Value){SeqType, .sval = ret};
-  }
-  else if(v1.vtype == SeqType && v2.vtype == SeqType){
-    reportTypeMismatch();
-  }
-
-  // Make sure the operands are both integers.
-  requireIntType( &v1 );
-  requireIntType( &v2 );
-
-  // Return the product of the two expression.
-  return (Value){ IntType, .ival = v1.ival * v2.ival };
+  // Return the product, or a repeated sequence.
+  return evalOperands( this, env, mulValues );
 }
 
 Expr *makeMul( Expr *left, Expr *right )
 {
   // Use the convenience function to build a SimpleExpr for multiplication.
-  return buildSimpleExpr( left, right, evalMul );
+  return foldConstant( buildSimpleExpr( left, right, evalMul, OP_MUL ) );
+}
+
+/** Eval function for multiplication when both operands are known to be
+    ints. */
+static Value evalMulIntInt( Expr *expr, Environment *env )
+{
+  SimpleExpr *this = (SimpleExpr *)expr;
+  int a = this->expr1->eval( this->expr1, env ).ival;
+  int b = this->expr2->eval( this->expr2, env ).ival;
+  return (Value){ IntType, .ival = a * b };
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -400,32 +380,45 @@ static Value evalDiv( Expr *expr, Environment *env )
   // If this function gets called, expr must really be a SimpleExpr.
   SimpleExpr *this = (SimpleExpr *)expr;
 
-  // Evaluate our left and right operands. 
-  Value v1 = this->expr1->eval( this->expr1, env );
-  Value v2 = this->expr2->eval( this->expr2, env );
-
-  // Make sure the operands are both integers.
-  requireIntType( &v1 );
-  requireIntType( &v2 );
-
-  // Catch it if we try to divide by zero.
-  if ( v2.ival == 0 ) {
-    fprintf( stderr, "Divide by zero\n" );
-    exit( EXIT_FAILURE );
-  }
-
   // Return the quotient of the two expression.
-  return (Value){ IntType, .ival = v1.ival / v2.ival };
+  return evalOperands( this, env, divValues );
 }
 
 Expr *makeDiv( Expr *left, Expr *right )
 {
   // Use the convenience function to build a SimpleExpr for division.
-  return buildSimpleExpr( left, right, evalDiv );
+  return foldConstant( buildSimpleExpr( left, right, evalDiv, OP_DIV ) );
+}
+
+/** Eval function for division when both operands are known to be
+    ints.  Only the divisor needs checking. */
+static Value evalDivIntInt( Expr *expr, Environment *env )
+{
+  SimpleExpr *this = (SimpleExpr *)expr;
+  int a = this->expr1->eval( this->expr1, env ).ival;
+  int b = this->expr2->eval( this->expr2, env ).ival;
+  if ( b == 0 )
+    reportDivideByZero();
+  return (Value){ IntType, .ival = a / b };
 }
 
 //////////////////////////////////////////////////////////////////////
-// Logical and
+// Logical and / or
+
+/** Compile function for the logical operators.  The instruction for the
+    operator skips the right-hand operand if the left-hand one decides
+    the result. */
+static void compileLogical( Expr *expr, Code *code )
+{
+  // If this function gets called, expr must really be a SimpleExpr.
+  SimpleExpr *this = (SimpleExpr *)expr;
+
+  this->expr1->compile( this->expr1, code );
+  int jump = emitInt( code, this->op, 0 );
+  this->expr2->compile( this->expr2, code );
+  emit( code, OP_REQUIRE_INT );
+  patchJump( code, jump );
+}
 
 static Value evalAnd( Expr *expr, Environment *env )
 {
@@ -449,12 +442,11 @@ static Value evalAnd( Expr *expr, Environment *env )
 Expr *makeAnd( Expr *left, Expr *right )
 {
   // Use the convenience function to build a SimpleExpr for the logical and.
-  return buildSimpleExpr( left, right, evalAnd );
+  Expr *expr = buildSimpleExpr( left, right, evalAnd, OP_AND );
+  expr->compile = compileLogical;
+  return foldConstant( expr );
 }
 
-//////////////////////////////////////////////////////////////////////
-// Logical or
-
 static Value evalOr( Expr *expr, Environment *env )
 {
   // If this function gets called, expr must really be a SimpleExpr.
@@ -477,7 +469,9 @@ static Value evalOr( Expr *expr, Environment *env )
 Expr *makeOr( Expr *left, Expr *right )
 {
   // Use the convenience function to build a SimpleExpr for the logical or
-  return buildSimpleExpr( left, right, evalOr );
+  Expr *expr = buildSimpleExpr( left, right, evalOr, OP_OR );
+  expr->compile = compileLogical;
+  return foldConstant( expr );
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -489,56 +483,42 @@ static Value evalLess( Expr *expr, Environment *env )
   // If this function gets called, expr must really be a SimpleExpr.
   SimpleExpr *this = (SimpleExpr *)expr;
 
-  // Evaluate our left and right operands. 
-  Value v1 = this->expr1->eval( this->expr1, env );
-  Value v2 = this->expr2->eval( this->expr2, env );
-
-  // Make sure the operands are both the same type.
-  if ( v1.vtype != v2.vtype )
-    
-    reportTypeMismatch();
-
-  if ( v1.vtype == IntType ) {
-    // Is v1 less than v2
-    return (Value){ IntType, .ival = v1.ival < v2.ival ? true : false };
-  } else {
-    // Replace with code to compare sequences.
-    // fprintf( stderr, "Sequence comparison not implemented\n" );
-    // exit( 0 );
-
-    //Pick the length of the smaller one
-    Sequence *seq1 = v1.sval;
-    Sequence *seq2 = v2.sval;
-
-    int length = seq1->len < seq2->len ? seq1->len : seq2->len;
+  // Compare the ints, or the sequences lexicographically.
+  return evalOperands( this, env, lessValues );
+}
 
-    for(int i = 0; i < length; i++){
-      if(seq1->seq[i] > seq2->seq[i]){
-        //False since 1 is bigger than 2
-        return (Value) {IntType, .ival = 0};
-      }
-      else if(seq1->seq[i] < seq2->seq[i]){
-        //True since 1 is smaller than 2 at this index
-        return (Value) {IntType, .ival = 1};
-      }
+// Peephole rewrites for common patterns, defined with the fused
+// expressions below.
+static Expr *fuseLessLen( Expr *expr );
+static Expr *fuseIndexVars( Expr *expr );
 
-      //If they are equal we go to the next index
-    }
+Expr *makeLess( Expr *left, Expr *right )
+{
+  // Use the convenience function to build a SimpleExpr for the less-than
+  // comparison.  It can only be folded if there's a literal on the left,
+  // and only fused if there's a variable.
+  Expr *expr = buildSimpleExpr( left, right, evalLess, OP_LESS );
+  return left->eval == evalLiteralInt ? foldConstant( expr ) :
+    fuseLessLen( expr );
+}
 
-    if(seq1->len < seq2->len){
-      //seq1 is a prefix so it's less than
-      return (Value) {IntType, .ival = 1};
-    }
-    //Otherwise it is equal or greater than
-    return (Value) {IntType, .ival = 0};
-  }
+/** Compare two int operands, evaluating the left one first.
+    @param this less-than expression with int operands.
+    @param env environment for evaluating the operands.
+    @return true if the left operand is less than the right one.
+*/
+static bool lessInts( SimpleExpr *this, Environment *env )
+{
+  int a = this->expr1->eval( this->expr1, env ).ival;
+  int b = this->expr2->eval( this->expr2, env ).ival;
+  return a < b;
 }
 
-Expr *makeLess( Expr *left, Expr *right )
+/** Eval function for less-than when both operands are known to be
+    ints. */
+static Value evalLessIntInt( Expr *expr, Environment *env )
 {
-  // Use the convenience function to build a SimpleExpr for the less-than
-  // comparison.
-  return buildSimpleExpr( left, right, evalLess );
+  return (Value){ IntType, .ival = lessInts( (SimpleExpr *) expr, env ) };
 }
 
 
@@ -550,12 +530,22 @@ Expr *makeLess( Expr *left, Expr *right )
 typedef struct{
   Value (*eval)( Expr *expr, Environment *env );
   void (*destroy)( Expr *expr );
+  void (*compile)( Expr *expr, Code *code );
+  int line;
+  ProfileCount *profile;
 
  
+  //If every element is a literal, this is the sequence built from them
+  //at parse time, packed as tightly as its values allow.  We hold a
+  //reference to it, so it's never freed or changed while we're using it.
+  //Otherwise, it's NULL.
+  Sequence *constant;
+
+  //Number of expressions in the list, zero for a constant
   int length;
   
-  //The pointer to a list of expressions
-  Expr **elist;
+  //The list of expressions, in the same block as the rest of us
+  Expr *elist[];
 } SequenceInitializerExpr;
 
 
@@ -570,29 +560,53 @@ static Value evalSequence( Expr *expr, Environment *env)
   // We know this is a sequence
   SequenceInitializerExpr *this = (SequenceInitializerExpr *)expr;
 
+  //A constant just needs a new view of the elements we already built
+  if(this->constant){
+    return (Value){ SeqType, .sval = makeSequenceView(this->constant) };
+  }
   
-  Sequence *seq = makeSequence();
+  //The number of elements is known, so allocate them all up front
+  Sequence *seq = makeSequenceCap(this->length);
   
+  //Hold on to it while the elements are evaluated, in case one of them
+  //reports an error
+  Value result = (Value){ SeqType, .sval = seq };
+  holdValue(result);
+
   //Now create the sequence
   for(int i = 0; i < this->length; i++){
     //We probably should make sure everything is an int first
-    //Case for regrowing the array
-    if(seq->len >= seq->cap){
-      seq->cap *= DOUBLE_CAP;
-      seq->seq = (int*)realloc(seq->seq, seq->cap * sizeof(int));
-    }
     Value v = this->elist[i]->eval(this->elist[i], env);
     requireIntType(&v);
     //Want to make sure to require and int and then destroy
     int val = v.ival;
-    //this->elist[i]->destroy(this->elist[i]);
-    seq->seq[i] = val;
+    setElement(seq, i, val);
     seq->len++;
     
   }
   
-  // Return an int value containing a copy of the value we represent.
-  return (Value){ SeqType, .sval = seq };
+  // Return the new sequence, as a temporary.
+  return keepValue(result);
+}
+
+/**
+ * Compiles the SequenceInitializerExpression, checking each element as it's
+ * evaluated then collecting them all into a sequence.
+*/
+static void compileSequence( Expr *expr, Code *code )
+{
+  SequenceInitializerExpr *this = (SequenceInitializerExpr *)expr;
+
+  if(this->constant){
+    emitConstant(code, this->constant);
+    return;
+  }
+
+  for(int i = 0; i < this->length; i++){
+    this->elist[i]->compile(this->elist[i], code);
+    emit(code, OP_REQUIRE_INT);
+  }
+  emitInt(code, OP_SEQUENCE, this->length);
 }
 
 
@@ -609,27 +623,59 @@ static void destroySequence(Expr *expr)
     destroy->elist[i]->destroy(destroy->elist[i]);
   }
 
-  //Free that whole expression list
-  free(destroy->elist);
-  
-  //Now free the block
-  free(destroy);
+  //Views of our constant can outlive us, they each hold a reference
+  if(destroy->constant){
+    releaseSequence(destroy->constant);
+  }
+
+  //The expression list and the block itself belong to the arena
 }
 
-Expr *makeSequenceInitializer(int len, Expr *elist[])
+Expr *makeSequenceInitializer(int len, Element const elems[])
 {
-  SequenceInitializerExpr *ret = (SequenceInitializerExpr*) malloc (sizeof(SequenceInitializerExpr));
-  
+  //See if every element is a literal, and how wide they need to be
+  bool literal = true;
+  int width = 1;
+  for(int i = 0; i < len && literal; i++){
+    if(elems[i].expr && elems[i].expr->eval != evalLiteralInt){
+      literal = false;
+    } else {
+      int val = elems[i].expr ? ((LiteralInt *) elems[i].expr)->val : elems[i].val;
+      if(elementWidth(val) > width){
+        width = elementWidth(val);
+      }
+    }
+  }
+
+  //A constant only needs its sequence, not the expressions
+  int count = literal ? 0 : len;
+  SequenceInitializerExpr *ret = (SequenceInitializerExpr*) allocNode (sizeof(SequenceInitializerExpr) + count * sizeof(Expr*));
   
-  ret->elist = (Expr**) malloc(len * sizeof(Expr*));
-  ret->length = len;
+  ret->length = count;
   ret->destroy = destroySequence;
   ret->eval = evalSequence;
+  ret->compile = compileSequence;
   
-  //Now copy over the expressions into the pointers
-  
+  //Build a constant sequence once, instead of every time we're evaluated
+  ret->constant = NULL;
+  if(literal){
+    ret->constant = makeSequenceCap(len);
+    if(width > ret->constant->width){
+      widenSequence(ret->constant, width);
+    }
+    for(int i = 0; i < len; i++){
+      int val = elems[i].expr ? ((LiteralInt *) elems[i].expr)->val : elems[i].val;
+      setElement(ret->constant, i, val);
+    }
+    ret->constant->len = len;
+    grabSequence(ret->constant);
+    return (Expr*) ret;
+  }
+
+  //Now copy over the expressions, making nodes for the literals that
+  //were just given as values
   for(int i = 0; i < len; i++){
-    ret->elist[i] = elist[i];
+    ret->elist[i] = elems[i].expr ? elems[i].expr : makeLiteralInt(elems[i].val);
   }
   return (Expr*) ret;
 }
@@ -650,25 +696,12 @@ static Value evalLen(Expr *expr, Environment *env)
   //We probably want to make sure it's a sequence
   Value s = this->expr1->eval(this->expr1, env); 
 
-  requireSeqType(&s);
-
-  //Now we know it is indeed a sequence
-  Sequence *current = s.sval;
-
-
-  grabSequence(current);
-  //And we know the second things is probably a varaible or sequence
-  int len = current->len;
-
-  //We also need to release it since the len expression no longer needs it
-  releaseSequence(current);
-  return (Value){IntType, .ival = len};
-  
+  return lenValue(s);
 }
 
 Expr *makeLenExpr(Expr *expr)
 {
-  return buildSimpleExpr(expr, NULL, evalLen);
+  return buildSimpleExpr(expr, NULL, evalLen, OP_LEN);
 }
 
 
@@ -681,51 +714,24 @@ static Value evalEquals( Expr *expr, Environment *env )
   // If this function gets called, expr must really be a SimpleExpr.
   SimpleExpr *this = (SimpleExpr *)expr;
 
-  // Evaluate our left and right operands. 
-  Value v1 = this->expr1->eval( this->expr1, env );
-  Value v2 = this->expr2->eval( this->expr2, env );
-
-  // Make sure the same type.
-  if ( v1.vtype == IntType && v2.vtype == IntType ) {
-    return (Value){ IntType, .ival = ( v1.ival == v2.ival ) };
-  } else {
-    // Replace with code to permit sequence-sequence comparison.
-    // A sequence can also be compared to an int, but they should
-    // never be considered equal.
-    // fprintf( stderr, "Sequence comparison not implemented\n" );
-    // exit( 0 );
-    
-    //Check for mismatching types
-    if((v1.vtype == IntType && v2.vtype == SeqType) || (v1.vtype == SeqType && v2.vtype == IntType)){
-      return (Value){IntType, .ival = 0};
-    }
-
-    //If their lengths are not equal return false
-    Sequence *seq1 = v1.sval;
-    Sequence *seq2 = v2.sval;
-    if(seq1->len != seq2->len){
-      return (Value) {IntType, .ival = 0};
-    }
-
-    //Now compare elements for equality
-    for(int i = 0; i < seq1->len; i++){
-      if(seq1->seq[i] != seq2->seq[i]){
-        return (Value) {IntType, .ival = 0};
-      }
-    }
-
-    //Everything matches so return true
-    return (Value) {IntType, .ival = 1};
-  }
-
-  // Never reached.
-  return (Value){ IntType, .ival = 0 };
+  // Compare the ints or sequences.
+  return evalOperands( this, env, equalsValues );
 }
 
 Expr *makeEquals( Expr *left, Expr *right )
 {
   // Use the convenience function to build a SimpleExpr for the equals test.
-  return buildSimpleExpr( left, right, evalEquals );
+  return foldConstant( buildSimpleExpr( left, right, evalEquals, OP_EQUALS ) );
+}
+
+/** Eval function for an equality test when both operands are known to
+    be ints. */
+static Value evalEqualsIntInt( Expr *expr, Environment *env )
+{
+  SimpleExpr *this = (SimpleExpr *)expr;
+  int a = this->expr1->eval( this->expr1, env ).ival;
+  int b = this->expr2->eval( this->expr2, env ).ival;
+  return (Value){ IntType, .ival = a == b };
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -736,9 +742,12 @@ Expr *makeEquals( Expr *left, Expr *right )
 typedef struct {
   Value (*eval)( Expr *expr, Environment *env );
   void (*destroy)( Expr *expr );
+  void (*compile)( Expr *expr, Code *code );
+  int line;
+  ProfileCount *profile;
 
-  /** Name of the variable. */
-  char name[ MAX_VAR_NAME + 1 ];
+  /** Name and slot of the variable. */
+  Symbol sym;
 } VariableExpr;
 
 static Value evalVariable( Expr *expr, Environment *env )
@@ -747,7 +756,7 @@ static Value evalVariable( Expr *expr, Environment *env )
   VariableExpr *this = (VariableExpr *) expr;
 
   // Get the value of this variable.
-  Value val = lookupVariable( env, this->name );
+  Value val = lookupVariable( env, &this->sym );
 
   return val;
 }
@@ -755,17 +764,25 @@ static Value evalVariable( Expr *expr, Environment *env )
 /** Implementation of destroy for Variable. */
 static void destroyVariable( Expr *expr )
 {
-  free( expr );
+  // Nothing to do, the arena owns our memory.
 }
 
-Expr *makeVariable( char const *name )
+/** Implementation of compile for Variable. */
+static void compileVariable( Expr *expr, Code *code )
+{
+  VariableExpr *this = (VariableExpr *) expr;
+  emitSymbol( code, OP_LOAD, &this->sym );
+}
+
+Expr *makeVariable( Symbol const *sym )
 {
   // Allocate space for the Variable statement, and fill in its function
-  // pointers and a copy of the variable name.
-  VariableExpr *this = (VariableExpr *) malloc( sizeof( VariableExpr ) );
+  // pointers and a copy of the variable's symbol.
+  VariableExpr *this = (VariableExpr *) allocNode( sizeof( VariableExpr ) );
   this->eval = evalVariable;
   this->destroy = destroyVariable;
-  strcpy( this->name, name );
+  this->compile = compileVariable;
+  this->sym = *sym;
 
   return (Expr *) this;
 }
@@ -783,109 +800,229 @@ static Value evalSequenceIndex(Expr *expr, Environment *env)
   SimpleExpr *this = (SimpleExpr *) expr;
   //Check if the integer comes withing the index and that it is an integer
   //Also check that it is a sequences
-  Value seq = this->expr1->eval(this->expr1, env);
-  Value index = this->expr2->eval(this->expr2, env);
-  requireSeqType(&seq);
-  requireIntType(&index);
-
-
-
-  Sequence *sequence = seq.sval;
-  grabSequence(sequence);
-  int vindex = index.ival;
-  if(vindex < 0 || vindex >= sequence->len){
-    reportIndexOutOfBounds();
-  }
-  int val = sequence->seq[vindex];
-  releaseSequence(sequence);
-
-  
-  return (Value){IntType, .ival = val};
+  return evalOperands(this, env, indexValue);
 }
 
 
 
 Expr *makeSequenceIndex( Expr *aexpr, Expr *iexpr )
 {
-  //Allocate and create this using a SimpleExpr
-  SimpleExpr *this = (SimpleExpr *) malloc(sizeof(SimpleExpr));
-  this->eval = evalSequenceIndex;
-  this->destroy = destroySimpleExpr;
-  this->expr1 = aexpr;
-  this->expr2 = iexpr;
-  return (Expr *)this;
-  
+  //Build this using a SimpleExpr
+  return fuseIndexVars( buildSimpleExpr( aexpr, iexpr, evalSequenceIndex,
+                                         OP_INDEX ) );
 }
 
-
 //////////////////////////////////////////////////////////////////////
-// SimpleStmt Struct
+// Fused expressions
 
-/** Generic representation for a statement that contains one or two
-    expressions.  With different execute methods, this same struct
-    can be used to represent print and push statements. */
+/** Representation for an operator that works directly on two
+    variables, replacing a small tree of nodes with one.  The tree it
+    replaces is kept, to compile it for the VM. */
 typedef struct {
-  void (*execute)( Stmt *stmt, Environment *env );
-  void (*destroy)( Stmt *stmt );
+  Value (*eval)( Expr *expr, Environment *env );
+  void (*destroy)( Expr *expr );
+  void (*compile)( Expr *expr, Code *code );
+  int line;
+  ProfileCount *profile;
 
-  /** First (or only) expression used by this statement. */
-  Expr *expr1;
-  /** Second expression used by this statement, or null */
-  Expr *expr2;
-} SimpleStmt;
+  /** The first variable. */
+  Symbol sym1;
 
-/** Generic destroy function for SimpleStmt, with either one
-    or two sub-expressions. */
-static void destroySimpleStmt( Stmt *stmt )
-{
-  // If this function gets called, stmt must really be a SimpleStmt.
-  SimpleStmt *this = (SimpleStmt *)stmt;
+  /** The second variable. */
+  Symbol sym2;
 
-  // Free our subexpression then the SimpleStmt object itself.
-  this->expr1->destroy( this->expr1 );
-  if ( this->expr2 )
-    this->expr2->destroy( this->expr2 );
-  free( this );
+  /** Expression this one replaced. */
+  Expr *original;
+} VarPairExpr;
+
+/** Implementation of destroy for fused expressions. */
+static void destroyVarPair( Expr *expr )
+{
+  VarPairExpr *this = (VarPairExpr *) expr;
+  this->original->destroy( this->original );
 }
 
-//////////////////////////////////////////////////////////////////////
-// Print Statement
+/** Implementation of compile for fused expressions, the VM runs the
+    code for the original expression. */
+static void compileVarPair( Expr *expr, Code *code )
+{
+  VarPairExpr *this = (VarPairExpr *) expr;
+  this->original->compile( this->original, code );
+}
 
-/** Implementation of execute for a print statement */
-static void executePrint( Stmt *stmt, Environment *env )
+/** Helper function to build a fused expression.
+    @param original expression being replaced.
+    @param var1 first variable used by the expression.
+    @param var2 second variable used by the expression.
+    @param eval function implementing eval for the fused expression.
+    @return the new expression.
+*/
+static Expr *buildVarPair( Expr *original, Expr *var1, Expr *var2,
+                           Value (*eval)( Expr *, Environment * ) )
 {
-  // If this function gets called, stmt must really be a SimpleStmt.
-  SimpleStmt *this = (SimpleStmt *)stmt;
+  VarPairExpr *this = (VarPairExpr *) allocNode( sizeof( VarPairExpr ) );
+  this->eval = eval;
+  this->destroy = destroyVarPair;
+  this->compile = compileVarPair;
+  this->sym1 = ( (VariableExpr *) var1 )->sym;
+  this->sym2 = ( (VariableExpr *) var2 )->sym;
+  this->original = original;
+
+  return (Expr *) this;
+}
+
+/** Eval function for i < len a, where i and a are variables. */
+static Value evalLessLen( Expr *expr, Environment *env )
+{
+  VarPairExpr *this = (VarPairExpr *) expr;
+  Value v = lookupVariable( env, &this->sym1 );
+  Value s = lookupVariable( env, &this->sym2 );
+
+  // The environment holds on to the sequence, so we can just look at
+  // its length.
+  if ( v.vtype == IntType && s.vtype == SeqType )
+    return (Value){ IntType, .ival = v.ival < s.sval->len };
+
+  return lessValues( v, lenValue( s ) );
+}
+
+/** Replace a comparison like i < len a with one fused expression, if
+    i and a are both variables.
+    @param expr less-than expression that was just built.
+    @return the fused expression, or expr if it doesn't match.
+*/
+static Expr *fuseLessLen( Expr *expr )
+{
+  SimpleExpr *less = (SimpleExpr *) expr;
+  if ( less->expr1->eval != evalVariable || less->expr2->eval != evalLen )
+    return expr;
+
+  Expr *seq = ( (SimpleExpr *) less->expr2 )->expr1;
+  if ( seq->eval != evalVariable )
+    return expr;
+
+  currentInterp()->fusedLengthTests++;
+  return buildVarPair( expr, less->expr1, seq, evalLessLen );
+}
+
+/** Eval function for a[ i ], where a and i are variables. */
+static Value evalIndexVars( Expr *expr, Environment *env )
+{
+  VarPairExpr *this = (VarPairExpr *) expr;
+  Value s = lookupVariable( env, &this->sym1 );
+  Value i = lookupVariable( env, &this->sym2 );
+
+  if ( s.vtype == SeqType && i.vtype == IntType &&
+       i.ival >= 0 && i.ival < s.sval->len )
+    return (Value){ IntType, .ival = getElement( s.sval, i.ival ) };
+
+  // Let the general version report the error.
+  return indexValue( s, i );
+}
+
+/** Replace an index like a[ i ] with one fused expression, if a and i
+    are both variables.
+    @param expr index expression that was just built.
+    @return the fused expression, or expr if it doesn't match.
+*/
+static Expr *fuseIndexVars( Expr *expr )
+{
+  SimpleExpr *index = (SimpleExpr *) expr;
+  if ( index->expr1->eval != evalVariable ||
+       index->expr2->eval != evalVariable )
+    return expr;
+
+  currentInterp()->fusedIndexes++;
+  return buildVarPair( expr, index->expr1, index->expr2, evalIndexVars );
+}
+
+/** Eval function for a[ i ], where a and i are variables and the
+    enclosing loop has already proven a is a sequence and i is in
+    bounds.  See checkBounds(). */
+static Value evalIndexVarsUnchecked( Expr *expr, Environment *env )
+{
+  VarPairExpr *this = (VarPairExpr *) expr;
+  Sequence *seq = lookupVariable( env, &this->sym1 ).sval;
+  int i = lookupVariable( env, &this->sym2 ).ival;
+  return (Value){ IntType, .ival = getElement( seq, i ) };
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// SimpleStmt Struct
+
+/** Generic representation for a statement that contains one or two
+    expressions.  With different execute methods, this same struct
+    can be used to represent print and push statements. */
+typedef struct {
+  void (*execute)( Stmt *stmt, Environment *env );
+  void (*destroy)( Stmt *stmt );
+  void (*compile)( Stmt *stmt, Code *code );
+  int line;
+  ProfileCount *profile;
+
+  /** First (or only) expression used by this statement. */
+  Expr *expr1;
+  /** Second expression used by this statement, or null */
+  Expr *expr2;
+
+  /** Instruction that performs this statement in compiled code. */
+  OpCode op;
+} SimpleStmt;
+
+/** Generic destroy function for SimpleStmt, with either one
+    or two sub-expressions. */
+static void destroySimpleStmt( Stmt *stmt )
+{
+  // If this function gets called, stmt must really be a SimpleStmt.
+  SimpleStmt *this = (SimpleStmt *)stmt;
+
+  // Free our subexpressions, the arena owns the SimpleStmt object.
+  this->expr1->destroy( this->expr1 );
+  if ( this->expr2 )
+    this->expr2->destroy( this->expr2 );
+}
+
+/** Generic compile function for SimpleStmt.  It compiles its
+    sub-expressions in order, then adds the instruction for the
+    statement. */
+static void compileSimpleStmt( Stmt *stmt, Code *code )
+{
+  // If this function gets called, stmt must really be a SimpleStmt.
+  SimpleStmt *this = (SimpleStmt *)stmt;
+
+  this->expr1->compile( this->expr1, code );
+  if ( this->expr2 )
+    this->expr2->compile( this->expr2, code );
+  emit( code, this->op );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Print Statement
+
+/** Implementation of execute for a print statement */
+static void executePrint( Stmt *stmt, Environment *env )
+{
+  // If this function gets called, stmt must really be a SimpleStmt.
+  SimpleStmt *this = (SimpleStmt *)stmt;
 
   // Evaluate our argument.
   Value v = this->expr1->eval( this->expr1, env );
 
   // Print the value of our expression appropriately, based on its type.
-  if ( v.vtype == IntType ) {
-    printf( "%d", v.ival );
-  } else {
-
-
-    // Replace with code to permit print a sequence as a string of
-    // ASCII character codes.
-    //We are printing a sequence
-    Sequence *seq = v.sval;
-    grabSequence(seq);
-    for(int i = 0; i < seq->len; i++){
-      printf("%c", seq->seq[i]);
-    }
-    releaseSequence(seq);
-  }
+  printValue( v );
 }
 
 Stmt *makePrint( Expr *expr )
 {
   // Allocate space for the SimpleStmt object
-  SimpleStmt *this = (SimpleStmt *) malloc( sizeof( SimpleStmt ) );
+  SimpleStmt *this = (SimpleStmt *) allocNode( sizeof( SimpleStmt ) );
 
-  // Remember the pointers to execute and destroy this statement.
+  // Remember the pointers to execute, destroy and compile this statement.
   this->execute = executePrint;
   this->destroy = destroySimpleStmt;
+  this->compile = compileSimpleStmt;
+  this->op = OP_PRINT;
 
   // Remember the expression for the thing we're supposed to print.
   this->expr1 = expr;
@@ -902,6 +1039,9 @@ Stmt *makePrint( Expr *expr )
 typedef struct {
   void (*execute)( Stmt *stmt, Environment *env );
   void (*destroy)( Stmt *stmt );
+  void (*compile)( Stmt *stmt, Code *code );
+  int line;
+  ProfileCount *profile;
 
   /** Number of statements in the compound. */
   int len;
@@ -931,23 +1071,35 @@ static void destroyCompound( Stmt *stmt )
   for ( int i = 0; i < this->len; i++ )
     this->stmtList[ i ]->destroy( this->stmtList[ i ] );
 
-  // Then, free the array of pointers and the compund statement itself.
-  free( this->stmtList );
-  free( this );
+  // The array of pointers and the compound statement itself belong to
+  // the arena.
+}
+
+/** Implementation of compile for CompountStmt */
+static void compileCompound( Stmt *stmt, Code *code )
+{
+  // If this function gets called, stmt must really be a CompoundStmt.
+  CompoundStmt *this = (CompoundStmt *)stmt;
+
+  // The code for each statement just follows the one before.
+  for ( int i = 0; i < this->len; i++ )
+    this->stmtList[ i ]->compile( this->stmtList[ i ], code );
 }
 
 Stmt *makeCompound( int len, Stmt **stmtList )
 {
   // Allocate space for the CompoundStmt object
-  CompoundStmt *this = (CompoundStmt *) malloc( sizeof( CompoundStmt ) );
+  CompoundStmt *this = (CompoundStmt *) allocNode( sizeof( CompoundStmt ) );
 
-  // Remember the pointers to execute and destroy this statement.
+  // Remember the pointers to execute, destroy and compile this statement.
   this->execute = executeCompound;
   this->destroy = destroyCompound;
+  this->compile = compileCompound;
 
-  // Remember the list of statements in the compound.
+  // Keep a copy of the list of statements in the compound.
   this->len = len;
-  this->stmtList = stmtList;
+  this->stmtList = (Stmt **) allocNode( len * sizeof( Stmt * ) );
+  memcpy( this->stmtList, stmtList, len * sizeof( Stmt * ) );
 
   // Return the result, as an instance of the Stmt interface.
   return (Stmt *) this;
@@ -960,12 +1112,19 @@ Stmt *makeCompound( int len, Stmt **stmtList )
 typedef struct {
   void (*execute)( Stmt *stmt, Environment *env );
   void (*destroy)( Stmt *stmt );
+  void (*compile)( Stmt *stmt, Code *code );
+  int line;
+  ProfileCount *profile;
 
   // Condition to be checked before running the body.
   Expr *cond;
 
   // Body to execute if / while cond is true.
   Stmt *body;
+
+  // For a while loop, the number of times it's started running.  Values
+  // hoisted out of the loop are only good for the run they came from.
+  unsigned long runs;
 } ConditionalStmt;
 
 /** Implementation of destroy for either while of if statements. */
@@ -977,9 +1136,34 @@ static void destroyConditional( Stmt *stmt )
   // Destroy the condition expression and the statement in the body.
   this->cond->destroy( this->cond );
   this->body->destroy( this->body );
+}
+
+/** Helper function to construct a ConditionalStmt and fill in its fields.
+    @param cond Expression for the condition.
+    @param body Statement in the body.
+    @param execute function implementing execute for this statement.
+    @param compile function implementing compile for this statement.
+    @return A new statement object, as an instance of Stmt.
+*/
+static Stmt *buildConditional( Expr *cond, Stmt *body,
+                               void (*execute)( Stmt *, Environment * ),
+                               void (*compile)( Stmt *, Code * ) )
+{
+  // Allocate an instance of ConditionalStmt
+  ConditionalStmt *this =
+    (ConditionalStmt *) allocNode( sizeof( ConditionalStmt ) );
 
-  // Then, free the ConditionalStmt struct.
-  free( this );
+  // Functions to execute, destroy and compile the statement.
+  this->execute = execute;
+  this->destroy = destroyConditional;
+  this->compile = compile;
+
+  // Fill in the condition and the body.
+  this->cond = cond;
+  this->body = body;
+
+  // Return the result, as an instance of the Stmt interface.
+  return (Stmt *) this;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -1000,22 +1184,31 @@ static void executeIf( Stmt *stmt, Environment *env )
     this->body->execute( this->body, env );
 }
 
-Stmt *makeIf( Expr *cond, Stmt *body )
+/** Implementation of compile for an if statement. */
+static void compileIf( Stmt *stmt, Code *code )
 {
-  // Allocate an instance of ConditionalStmt
-  ConditionalStmt *this =
-    (ConditionalStmt *) malloc( sizeof( ConditionalStmt ) );
+  // If this function gets called, stmt must really be a ConditionalStmt.
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
 
-  // Functions to execute and destroy an if statement.
-  this->execute = executeIf;
-  this->destroy = destroyConditional;
+  // Skip over the body if the condition is false.
+  this->cond->compile( this->cond, code );
+  int skip = emitInt( code, OP_JUMP_FALSE, 0 );
+  this->body->compile( this->body, code );
+  patchJump( code, skip );
+}
 
-  // Fill in the condition and the body of the if.
-  this->cond = cond;
-  this->body = body;
+Stmt *makeIf( Expr *cond, Stmt *body )
+{
+  return buildConditional( cond, body, executeIf, compileIf );
+}
 
-  // Return the result, as an instance of the Stmt interface.
-  return (Stmt *) this;
+/** Execute function for an if statement with a condition that's known
+    to be an int. */
+static void executeIfInt( Stmt *stmt, Environment *env )
+{
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+  if ( this->cond->eval( this->cond, env ).ival )
+    this->body->execute( this->body, env );
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -1026,6 +1219,7 @@ static void executeWhile( Stmt *stmt, Environment *env )
 {
   // If this function gets called, stmt must really be a ConditionalStmt.
   ConditionalStmt *this = (ConditionalStmt *)stmt;
+  this->runs++;
 
   // Evaluate our condition and see if it's true.
   Value result = this->cond->eval( this->cond, env );
@@ -1041,22 +1235,118 @@ static void executeWhile( Stmt *stmt, Environment *env )
   }
 }
 
+/** Implementation of compile for a while statement. */
+static void compileWhile( Stmt *stmt, Code *code )
+{
+  // If this function gets called, stmt must really be a ConditionalStmt.
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+
+  // Check the condition at the top of the loop, and jump back to it at
+  // the end of the body.
+  int top = code->len;
+  this->cond->compile( this->cond, code );
+  int done = emitInt( code, OP_JUMP_FALSE, 0 );
+  this->body->compile( this->body, code );
+  emitInt( code, OP_JUMP, top );
+  patchJump( code, done );
+}
+
 Stmt *makeWhile( Expr *cond, Stmt *body )
 {
-  // Allocate an instance of ConditionalStmt
-  ConditionalStmt *this =
-    (ConditionalStmt *) malloc( sizeof( ConditionalStmt ) );
+  return buildConditional( cond, body, executeWhile, compileWhile );
+}
 
-  // Functions to execute and destroy a while statement.
-  this->execute = executeWhile;
-  this->destroy = destroyConditional;
+/** Execute function for a while statement with a condition that's
+    known to be an int. */
+static void executeWhileInt( Stmt *stmt, Environment *env )
+{
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+  this->runs++;
+  while ( this->cond->eval( this->cond, env ).ival )
+    this->body->execute( this->body, env );
+}
 
-  // Fill in the condition and the body of the while.
-  this->cond = cond;
-  this->body = body;
+/** Execute function for a while statement with a condition like a < b,
+    where a and b are known to be ints.  The operands are compared
+    directly, without making a value for the condition. */
+static void executeWhileLess( Stmt *stmt, Environment *env )
+{
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+  SimpleExpr *cond = (SimpleExpr *) this->cond;
+  this->runs++;
+  while ( lessInts( cond, env ) )
+    this->body->execute( this->body, env );
+}
 
-  // Return the result, as an instance of the Stmt interface.
-  return (Stmt *) this;
+// Puts the bounds checks back in a loop body, defined with the bounds
+// check elimination pass below.
+static void restoreBoundsChecks( Stmt *stmt );
+
+/** Execute function for a while statement with a condition like
+    i < len a, where some accesses to a[ i ] in the body skip their
+    bounds checks.  The condition only proves i is below the length, so
+    the loop also checks it isn't negative.  If it is, or if the
+    condition is about to report an error, the body gets its checks back
+    and the loop carries on as an ordinary one. */
+static void executeWhileGuarded( Stmt *stmt, Environment *env )
+{
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+  VarPairExpr *cond = (VarPairExpr *) this->cond;
+  this->runs++;
+
+  while ( true ) {
+    Value i = lookupVariable( env, &cond->sym1 );
+    Value s = lookupVariable( env, &cond->sym2 );
+    if ( i.vtype != IntType || s.vtype != SeqType || i.ival < 0 ) {
+      // Restoring the checks looks at the real eval and execute
+      // functions, so profiling has to stop while it does.
+      Interp *interp = currentInterp();
+      if ( interp->profiling )
+        profileStmt( stmt, NULL );
+      restoreBoundsChecks( this->body );
+      this->execute = executeWhile;
+      if ( interp->profiling )
+        profileStmt( stmt, interp->profile );
+      executeWhile( stmt, env );
+      return;
+    }
+
+    if ( i.ival >= s.sval->len )
+      return;
+    this->body->execute( this->body, env );
+  }
+}
+
+/** Execute function for a while statement with a condition like
+    i < len a, where nothing in the body can change the length of a (see
+    hoistInvariants()).  The length is looked up once, when the loop
+    starts, and each iteration just compares i to it. */
+static void executeWhileLessLen( Stmt *stmt, Environment *env )
+{
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+  VarPairExpr *cond = (VarPairExpr *) this->cond;
+  this->runs++;
+
+  // Anything but a sequence and an int gets the general version, which
+  // reports the error.
+  Value s = lookupVariable( env, &cond->sym2 );
+  if ( s.vtype != SeqType ) {
+    executeWhile( stmt, env );
+    return;
+  }
+
+  int len = s.sval->len;
+  while ( true ) {
+    Value i = lookupVariable( env, &cond->sym1 );
+    if ( i.vtype != IntType ) {
+      executeWhile( stmt, env );
+      return;
+    }
+
+    if ( i.ival >= len )
+      return;
+    this->body->execute( this->body, env );
+  }
 }
 
 /*************************Push statement*/
@@ -1076,43 +1366,27 @@ static void executePush(Stmt *stmt, Environment *env)
   SimpleStmt *this = (SimpleStmt*) stmt;
 
 
-  //Need to check for type mismatches
+  //Need to check for type mismatches, holding on to the values in case
+  //that reports an error
   Value seq = this->expr1->eval(this->expr1, env);
+  holdValue(seq);
   Value val = this->expr2->eval(this->expr2, env);
-  //Now assert their types
- 
-  requireSeqType(&seq);
-  requireIntType(&val);
-  
-
-  Sequence *realSeq = seq.sval;
-
-  //We must grab the sequence too
-  grabSequence(realSeq);
-
-  //Not enough room so realloc some space
-  if(realSeq->len >= realSeq->cap){
-    realSeq->cap *= DOUBLE_CAP;
-    realSeq->seq = (int*)realloc(realSeq->seq, realSeq->cap * sizeof(int));
-  }
-
-  //Now assign to the end and increase the length by 1
-  realSeq->seq[realSeq->len] = val.ival;
-  realSeq->len++;
-
-
-  //Then release the sequence
-  releaseSequence(realSeq);
+  holdValue(val);
 
+  pushValue(seq, val);
+  dropValue(val);
+  dropValue(seq);
 }
 
 Stmt *makePush(Expr *sexpr, Expr *vexpr)
 {
-  SimpleStmt *this = (SimpleStmt*)malloc(sizeof(SimpleStmt));
+  SimpleStmt *this = (SimpleStmt*)allocNode(sizeof(SimpleStmt));
   this->expr1 = sexpr;
   this->expr2 = vexpr;
   this->execute = executePush;
   this->destroy = destroySimpleStmt;
+  this->compile = compileSimpleStmt;
+  this->op = OP_PUSH;
   return (Stmt*) this;
 }
 
@@ -1126,9 +1400,12 @@ Stmt *makePush(Expr *sexpr, Expr *vexpr)
 typedef struct {
   void (*execute)( Stmt *stmt, Environment *env );
   void (*destroy)( Stmt *stmt );
+  void (*compile)( Stmt *stmt, Code *code );
+  int line;
+  ProfileCount *profile;
 
-  /** Name of the variable we're assigning to. */
-  char name[ MAX_VAR_NAME + 1 ];
+  /** Name and slot of the variable we're assigning to. */
+  Symbol sym;
   
   /** If we're assigning to an element of a sequence, this is the index
       expression. Otherwise, it's zero. */
@@ -1147,7 +1424,6 @@ static void destroyAssignment( Stmt *stmt )
   this->expr->destroy( this->expr );
   if ( this->iexpr )
     this->iexpr->destroy( this->iexpr );
-  free( this );
 }
 
 /** Implementation of execute for assignment Statements. */
@@ -1160,62 +1436,1122 @@ static void executeAssignment( Stmt *stmt, Environment *env )
   Value result = this->expr->eval( this->expr, env );
  
   if ( this->iexpr ) {
-    // Replace with code to permit assigning to a sequence element.
-    // fprintf( stderr, "Assignment to sequence elements not implemented\n" );
-    // exit( 0 );
-    
-    //Go to the index of the sequence then assign the variable
-    //Also make sure it is in bounds
+    //Go to the index of the sequence then assign the variable, holding
+    //on to the value in case the index reports an error
+    holdValue( result );
     Value i = this->iexpr->eval(this->iexpr, env);
-    requireIntType(&i);
-    int index = i.ival;
-    //We have to go find our variable now 
-    //If it does not exist syntax error
-    Value s = lookupVariable(env, this->name);
-    requireSeqType(&s);
-
-    Sequence *seq = s.sval;
-    //Check out of bounds errors
-    if(index < 0 || index >= seq->len){
-      reportIndexOutOfBounds();
-    }
-
-    //Now do the assignment
-    seq->seq[index] = result.ival;
-
+    holdValue( i );
+    assignElement( env, &this->sym, i, result );
+    dropValue( i );
+    dropValue( result );
   } else {
     // It's a variable, change its value
+    assignVariable( env, &this->sym, result );
+  }
+}
+
+/** Implementation of execute for assigning a[ i ], where the enclosing
+    loop has already proven a is a sequence and i is in bounds. */
+static void executeAssignElementUnchecked( Stmt *stmt, Environment *env )
+{
+  AssignmentStmt *this = (AssignmentStmt *) stmt;
 
-    //If it's a sequence we need to increase the reference count and decrease the reference count
+  // Evaluate the right-hand side first, like executeAssignment().
+  Value result = this->expr->eval( this->expr, env );
 
-    
-    //We also might need to report a type mismatch
-    if(result.vtype == SeqType){
-      grabSequence(result.sval);
-    }
-    
+  VariableExpr *index = (VariableExpr *) this->iexpr;
+  int i = lookupVariable( env, &index->sym ).ival;
+  Sequence *seq = lookupVariable( env, &this->sym ).sval;
+  makeWritable( seq );
+  setElement( seq, i, result.ival );
+}
+
+/** Implementation of execute for assignments like x = x + expr, where
+    the right-hand side adds something to the variable being assigned. */
+static void executeAppendAssignment( Stmt *stmt, Environment *env )
+{
+  AssignmentStmt *this = (AssignmentStmt *) stmt;
+
+  // Only the added part needs to be evaluated, the variable is looked up
+  // when we add to it.
+  SimpleExpr *add = (SimpleExpr *) this->expr;
+  Value right = add->expr2->eval( add->expr2, env );
+  appendVariable( env, &this->sym, right );
+}
+
+/** Implementation of compile for assignments like x = x + expr. */
+static void compileAppendAssignment( Stmt *stmt, Code *code )
+{
+  AssignmentStmt *this = (AssignmentStmt *) stmt;
+
+  SimpleExpr *add = (SimpleExpr *) this->expr;
+  add->expr2->compile( add->expr2, code );
+  emitSymbol( code, OP_APPEND, &this->sym );
+}
+
+/** Implementation of execute for assignments like x = x + expr, where
+    x and expr are both known to be ints. */
+static void executeAddAssignInt( Stmt *stmt, Environment *env )
+{
+  AssignmentStmt *this = (AssignmentStmt *) stmt;
+
+  SimpleExpr *add = (SimpleExpr *) this->expr;
+  int right = add->expr2->eval( add->expr2, env ).ival;
+  int left = lookupVariable( env, &this->sym ).ival;
+  setVariable( env, &this->sym, (Value){ IntType, .ival = left + right } );
+}
+
+/** Implementation of execute for assignments like x = x + 1, adding a
+    literal to the variable being assigned. */
+static void executeIncrement( Stmt *stmt, Environment *env )
+{
+  AssignmentStmt *this = (AssignmentStmt *) stmt;
+
+  SimpleExpr *add = (SimpleExpr *) this->expr;
+  Value right = (Value){ IntType,
+                         .ival = ( (LiteralInt *) add->expr2 )->val };
+  Value left = lookupVariable( env, &this->sym );
+  if ( left.vtype == IntType )
+    setVariable( env, &this->sym,
+                 (Value){ IntType, .ival = left.ival + right.ival } );
+  else
+    appendVariable( env, &this->sym, right );
+}
 
+/** Return true if the given expression is the given variable plus
+    something, so assigning it to that variable can add in place.
+    @param expr right-hand side of an assignment.
+    @param sym variable being assigned to.
+    @return true if expr has the form sym + something.
+*/
+static bool isAppendTo( Expr *expr, Symbol const *sym )
+{
+  if ( expr->eval != evalAdd )
+    return false;
 
-    setVariable( env, this->name, result );
+  Expr *left = ( (SimpleExpr *) expr )->expr1;
+  return left->eval == evalVariable &&
+    ( (VariableExpr *) left )->sym.slot == sym->slot;
+}
+
+/** Implementation of compile for assignment Statements. */
+static void compileAssignment( Stmt *stmt, Code *code )
+{
+  AssignmentStmt *this = (AssignmentStmt *) stmt;
+
+  // The source is evaluated before the index, like in execute.
+  this->expr->compile( this->expr, code );
+  if ( this->iexpr ) {
+    this->iexpr->compile( this->iexpr, code );
+    emitSymbol( code, OP_STORE_ELEMENT, &this->sym );
+  } else {
+    emitSymbol( code, OP_STORE, &this->sym );
   }
 }
 
-Stmt *makeAssignment( char const *name, Expr *iexpr, Expr *expr )
+Stmt *makeAssignment( Symbol const *sym, Expr *iexpr, Expr *expr )
 {
   // Allocate the AssignmentStmt representations.
   AssignmentStmt *this =
-    (AssignmentStmt *) malloc( sizeof( AssignmentStmt ) );
+    (AssignmentStmt *) allocNode( sizeof( AssignmentStmt ) );
 
-  // Fill in functions to execute or destory this statement.
+  // Fill in functions to execute, destroy or compile this statement.
   this->execute = executeAssignment;
   this->destroy = destroyAssignment;
+  this->compile = compileAssignment;
 
-  // Get a copy of the destination variable name, the source
+  // Get a copy of the destination variable symbol, the source
   // expression and the sequence index (if it's non-null).
-  strcpy( this->name, name );
+  this->sym = *sym;
   this->iexpr = iexpr;
   this->expr = expr;
 
+  // Adding to the variable we're assigning can happen in place.
+  if ( !iexpr && isAppendTo( expr, sym ) ) {
+    this->execute = executeAppendAssignment;
+    this->compile = compileAppendAssignment;
+
+    // Adding a constant is common enough to get its own version.
+    if ( ( (SimpleExpr *) expr )->expr2->eval == evalLiteralInt ) {
+      this->execute = executeIncrement;
+      currentInterp()->fusedIncrements++;
+    }
+  }
+
   // Return this object, as an instance of Stmt.
   return (Stmt *) this;
 }
+
+///////////////////////////////////////////////////////////////////////
+// Int specialization
+
+/** What the specialization pass knows about each variable. */
+typedef enum {
+  /** We haven't looked at this variable yet. */
+  VAR_UNKNOWN,
+
+  /** This variable holds an int the whole time the statement runs. */
+  VAR_INT,
+
+  /** This variable might hold a sequence. */
+  VAR_ANY
+} VarKind;
+
+/** State for the specialization pass over one statement. */
+typedef struct {
+  /** Environment the statement is about to run in. */
+  Environment *env;
+
+  /** What we know about each variable, indexed by slot. */
+  unsigned char *kind;
+
+  /** True if we learned that some variable might not be an int. */
+  bool changed;
+
+  /** Loop conditions that still hold at this point, see checkBounds(). */
+  struct GuardStruct *guards;
+
+  /** Number of loop conditions in guards. */
+  int guardCount;
+
+  /** Capacity of the guards array. */
+  int guardCap;
+} TypeInfo;
+
+/** Return true if the given variable is still believed to hold only
+    ints.  The first time we see a variable, we start from the value it
+    has in the environment right now.
+    @param info state of the pass.
+    @param sym variable to check.
+    @return true if the variable is believed to be int-only.
+*/
+static bool isIntVariable( TypeInfo *info, Symbol const *sym )
+{
+  if ( info->kind[ sym->slot ] == VAR_UNKNOWN )
+    info->kind[ sym->slot ] =
+      lookupVariable( info->env, sym ).vtype == IntType ? VAR_INT : VAR_ANY;
+  return info->kind[ sym->slot ] == VAR_INT;
+}
+
+/** Return true if the given expression can only evaluate to an int (or
+    raise an error), given what we believe about variables.
+    @param expr expression to check.
+    @param info state of the pass.
+    @return true if expr is int-only.
+*/
+static bool isIntExpr( Expr *expr, TypeInfo *info )
+{
+  if ( expr->destroy == destroyLiteralInt )
+    return true;
+
+  if ( expr->destroy == destroyVariable )
+    return isIntVariable( info, &( (VariableExpr *) expr )->sym );
+
+  // Fused comparisons and indexes always make an int.
+  if ( expr->destroy == destroyVarPair )
+    return true;
+
+  if ( expr->destroy == destroySimpleExpr ) {
+    SimpleExpr *this = (SimpleExpr *) expr;
+    switch ( this->op ) {
+    case OP_ADD:
+    case OP_MUL:
+      // These work on sequences too.
+      return isIntExpr( this->expr1, info ) && isIntExpr( this->expr2, info );
+    case OP_SUB:
+    case OP_DIV:
+    case OP_AND:
+    case OP_OR:
+    case OP_LESS:
+    case OP_EQUALS:
+    case OP_LEN:
+    case OP_INDEX:
+      // These always make an int, whatever their operands are.
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  return false;
+}
+
+/** Look for assignments that could store something other than an int,
+    and stop believing the variables they assign are int-only.
+    @param stmt statement to look through.
+    @param info state of the pass.
+*/
+static void findIntVariables( Stmt *stmt, TypeInfo *info )
+{
+  if ( stmt->destroy == destroyCompound ) {
+    CompoundStmt *this = (CompoundStmt *) stmt;
+    for ( int i = 0; i < this->len; i++ )
+      findIntVariables( this->stmtList[ i ], info );
+  } else if ( stmt->destroy == destroyConditional ) {
+    findIntVariables( ( (ConditionalStmt *) stmt )->body, info );
+  } else if ( stmt->destroy == destroyAssignment ) {
+    // Assigning an element changes the sequence, not the variable.
+    AssignmentStmt *this = (AssignmentStmt *) stmt;
+    if ( !this->iexpr && isIntVariable( info, &this->sym ) &&
+         !isIntExpr( this->expr, info ) ) {
+      info->kind[ this->sym.slot ] = VAR_ANY;
+      info->changed = true;
+    }
+  }
+}
+
+/** Return true if the given expression is a literal with the given
+    value.
+    @param expr expression to check.
+    @param val value to look for.
+    @return true if expr is a literal for val.
+*/
+static bool isLiteralValue( Expr *expr, int val )
+{
+  return expr->destroy == destroyLiteralInt &&
+    ( (LiteralInt *) expr )->val == val;
+}
+
+/** Choose the eval function for every expression in a tree, using the
+    int-only version for operators whose operands are int-only, and
+    skipping operators that leave an int operand unchanged.
+    @param expr expression to specialize.
+    @param info state of the pass, after finding int-only variables.
+*/
+static void specializeExpr( Expr *expr, TypeInfo *info )
+{
+  if ( expr->destroy == destroySequence ) {
+    SequenceInitializerExpr *this = (SequenceInitializerExpr *) expr;
+    for ( int i = 0; i < this->length; i++ )
+      specializeExpr( this->elist[ i ], info );
+  }
+
+  if ( expr->destroy != destroySimpleExpr )
+    return;
+
+  SimpleExpr *this = (SimpleExpr *) expr;
+  specializeExpr( this->expr1, info );
+  if ( !this->expr2 )
+    return;
+  specializeExpr( this->expr2, info );
+
+  bool ints = isIntExpr( this->expr1, info ) && isIntExpr( this->expr2, info );
+  switch ( this->op ) {
+  case OP_ADD:
+    this->eval = ints ? evalAddIntInt : evalAdd;
+    break;
+  case OP_SUB:
+    this->eval = ints ? evalSubIntInt : evalSub;
+    break;
+  case OP_MUL:
+    this->eval = ints ? evalMulIntInt : evalMul;
+    break;
+  case OP_DIV:
+    this->eval = ints ? evalDivIntInt : evalDiv;
+    break;
+  case OP_LESS:
+    this->eval = ints ? evalLessIntInt : evalLess;
+    break;
+  case OP_EQUALS:
+    this->eval = ints ? evalEqualsIntInt : evalEquals;
+    break;
+  default:
+    break;
+  }
+
+  // Adding zero to an int, or multiplying it by one, just gives the int.
+  // For a sequence, it would make a new one, so it has to be an int.
+  if ( !ints )
+    return;
+  int identity = this->op == OP_ADD || this->op == OP_SUB ? 0 : 1;
+  bool arithmetic = this->op == OP_ADD || this->op == OP_SUB ||
+    this->op == OP_MUL || this->op == OP_DIV;
+  if ( arithmetic && isLiteralValue( this->expr2, identity ) )
+    this->eval = evalLeftOperand;
+  else if ( ( this->op == OP_ADD || this->op == OP_MUL ) &&
+            isLiteralValue( this->expr1, identity ) )
+    this->eval = evalRightOperand;
+}
+
+/** Choose the execute function for every statement in a tree, and the
+    eval function for every expression in it.
+    @param stmt statement to specialize.
+    @param info state of the pass, after finding int-only variables.
+*/
+static void specializeTree( Stmt *stmt, TypeInfo *info )
+{
+  if ( stmt->destroy == destroySimpleStmt ) {
+    SimpleStmt *this = (SimpleStmt *) stmt;
+    specializeExpr( this->expr1, info );
+    if ( this->expr2 )
+      specializeExpr( this->expr2, info );
+  } else if ( stmt->destroy == destroyCompound ) {
+    CompoundStmt *this = (CompoundStmt *) stmt;
+    for ( int i = 0; i < this->len; i++ )
+      specializeTree( this->stmtList[ i ], info );
+  } else if ( stmt->destroy == destroyConditional ) {
+    ConditionalStmt *this = (ConditionalStmt *) stmt;
+    specializeExpr( this->cond, info );
+    specializeTree( this->body, info );
+
+    bool ints = isIntExpr( this->cond, info );
+    if ( this->compile == compileIf ) {
+      this->execute = ints ? executeIfInt : executeIf;
+    } else if ( this->cond->eval == evalLessIntInt ) {
+      this->execute = executeWhileLess;
+    } else {
+      this->execute = ints ? executeWhileInt : executeWhile;
+    }
+  } else if ( stmt->destroy == destroyAssignment ) {
+    AssignmentStmt *this = (AssignmentStmt *) stmt;
+    specializeExpr( this->expr, info );
+    if ( this->iexpr )
+      specializeExpr( this->iexpr, info );
+
+    // Increments already check their type just once.
+    if ( this->compile == compileAppendAssignment &&
+         this->execute != executeIncrement )
+      this->execute = isIntExpr( this->expr, info ) ?
+        executeAddAssignInt : executeAppendAssignment;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+// Bounds check elimination
+
+/** A loop condition like i < len a.  From the start of the loop body
+    until i or a is assigned, a[ i ] is known to be in bounds (as long as
+    i isn't negative, which the loop checks for itself). */
+typedef struct GuardStruct {
+  /** Slot of the index variable. */
+  int index;
+
+  /** Slot of the sequence variable. */
+  int seq;
+
+  /** False once one of the variables might have been assigned. */
+  bool live;
+} Guard;
+
+/** Return true if the given statement could assign the given variable.
+    Assigning one element of a sequence doesn't count.
+    @param stmt statement to look through.
+    @param slot slot of the variable.
+    @return true if stmt contains an assignment to the variable.
+*/
+static bool assignsVariable( Stmt *stmt, int slot )
+{
+  if ( stmt->destroy == destroyCompound ) {
+    CompoundStmt *this = (CompoundStmt *) stmt;
+    for ( int i = 0; i < this->len; i++ )
+      if ( assignsVariable( this->stmtList[ i ], slot ) )
+        return true;
+    return false;
+  }
+
+  if ( stmt->destroy == destroyConditional )
+    return assignsVariable( ( (ConditionalStmt *) stmt )->body, slot );
+
+  if ( stmt->destroy == destroyAssignment ) {
+    AssignmentStmt *this = (AssignmentStmt *) stmt;
+    return !this->iexpr && this->sym.slot == slot;
+  }
+
+  return false;
+}
+
+/** Return true if a[ i ] is known to be in bounds at this point.
+    @param info state of the pass.
+    @param index slot of the index variable, i.
+    @param seq slot of the sequence variable, a.
+    @return true if a live guard covers a[ i ].
+*/
+static bool isGuarded( TypeInfo *info, int index, int seq )
+{
+  for ( int i = 0; i < info->guardCount; i++ )
+    if ( info->guards[ i ].live && info->guards[ i ].index == index &&
+         info->guards[ i ].seq == seq )
+      return true;
+  return false;
+}
+
+/** Stop believing any guard that uses the given variable.
+    @param info state of the pass.
+    @param slot slot of a variable that's being assigned.
+*/
+static void killGuards( TypeInfo *info, int slot )
+{
+  for ( int i = 0; i < info->guardCount; i++ )
+    if ( info->guards[ i ].index == slot || info->guards[ i ].seq == slot )
+      info->guards[ i ].live = false;
+}
+
+/** Choose the checked or unchecked version of every fused index in an
+    expression.
+    @param expr expression to look through.
+    @param info state of the pass.
+*/
+static void checkIndexes( Expr *expr, TypeInfo *info )
+{
+  if ( expr->destroy == destroySimpleExpr ) {
+    SimpleExpr *this = (SimpleExpr *) expr;
+    checkIndexes( this->expr1, info );
+    if ( this->expr2 )
+      checkIndexes( this->expr2, info );
+  } else if ( expr->destroy == destroySequence ) {
+    SequenceInitializerExpr *this = (SequenceInitializerExpr *) expr;
+    for ( int i = 0; i < this->length; i++ )
+      checkIndexes( this->elist[ i ], info );
+  } else if ( expr->eval == evalIndexVars ||
+              expr->eval == evalIndexVarsUnchecked ) {
+    VarPairExpr *this = (VarPairExpr *) expr;
+    this->eval = isGuarded( info, this->sym2.slot, this->sym1.slot ) ?
+      evalIndexVarsUnchecked : evalIndexVars;
+  }
+}
+
+/** Find the accesses to a[ i ] that are inside a loop on i < len a,
+    and come before anything in the body that could assign i or a.
+    Those accesses get unchecked versions, and everything else gets the
+    checked version.  Statements are visited in the order they run, so
+    an assignment ends a guard for everything after it.
+    @param stmt statement to look through.
+    @param info state of the pass.
+*/
+static void checkBounds( Stmt *stmt, TypeInfo *info )
+{
+  if ( stmt->destroy == destroySimpleStmt ) {
+    SimpleStmt *this = (SimpleStmt *) stmt;
+    checkIndexes( this->expr1, info );
+    if ( this->expr2 )
+      checkIndexes( this->expr2, info );
+  } else if ( stmt->destroy == destroyCompound ) {
+    CompoundStmt *this = (CompoundStmt *) stmt;
+    for ( int i = 0; i < this->len; i++ )
+      checkBounds( this->stmtList[ i ], info );
+  } else if ( stmt->destroy == destroyConditional ) {
+    ConditionalStmt *this = (ConditionalStmt *) stmt;
+    checkIndexes( this->cond, info );
+    if ( this->compile == compileIf ) {
+      checkBounds( this->body, info );
+      return;
+    }
+
+    // A loop body can run more than once, so an assignment anywhere in
+    // it ends an outer guard, even for accesses that come before it.
+    for ( int i = 0; i < info->guardCount; i++ )
+      if ( assignsVariable( this->body, info->guards[ i ].index ) ||
+           assignsVariable( this->body, info->guards[ i ].seq ) )
+        info->guards[ i ].live = false;
+
+    if ( this->cond->eval != evalLessLen ) {
+      checkBounds( this->body, info );
+      return;
+    }
+
+    // This loop's own condition holds at the start of each iteration.
+    if ( info->guardCount >= info->guardCap ) {
+      info->guardCap = info->guardCap ? info->guardCap * DOUBLE_CAP : INIT_CAP;
+      info->guards = (Guard *) realloc( info->guards,
+                                        info->guardCap * sizeof( Guard ) );
+    }
+    VarPairExpr *cond = (VarPairExpr *) this->cond;
+    info->guards[ info->guardCount++ ] =
+      (Guard){ cond->sym1.slot, cond->sym2.slot, true };
+    checkBounds( this->body, info );
+    info->guardCount--;
+
+    this->execute = executeWhileGuarded;
+  } else if ( stmt->destroy == destroyAssignment ) {
+    AssignmentStmt *this = (AssignmentStmt *) stmt;
+    checkIndexes( this->expr, info );
+    if ( !this->iexpr ) {
+      killGuards( info, this->sym.slot );
+      return;
+    }
+
+    checkIndexes( this->iexpr, info );
+    bool guarded = this->iexpr->eval == evalVariable &&
+      isGuarded( info, ( (VariableExpr *) this->iexpr )->sym.slot,
+                 this->sym.slot );
+    this->execute = guarded ? executeAssignElementUnchecked :
+      executeAssignment;
+  }
+}
+
+static void restoreBoundsChecks( Stmt *stmt )
+{
+  // With no guards, every access gets its checks.  Loops inside this
+  // one can still guard their own bodies.
+  TypeInfo info = { NULL, NULL, false, NULL, 0, 0 };
+  checkBounds( stmt, &info );
+  free( info.guards );
+}
+
+///////////////////////////////////////////////////////////////////////
+// Loop-invariant hoisting
+
+struct InvariantStruct {
+  /** Eval function that really computes the expression. */
+  Value (*compute)( Expr *expr, Environment *env );
+
+  /** Run counter of the loop the expression doesn't change in. */
+  unsigned long const *runs;
+
+  /** Run of that loop the value was computed in, or zero. */
+  unsigned long run;
+
+  /** Value of the expression in that run. */
+  int val;
+};
+
+/** Eval function for an int expression that can't change while a loop
+    runs.  It's computed the first time it's needed in each run of the
+    loop, so it raises any error at the same point it would have. */
+static Value evalInvariant( Expr *expr, Environment *env )
+{
+  Invariant *inv = ( (SimpleExpr *) expr )->invariant;
+  if ( inv->run != *inv->runs ) {
+    inv->val = inv->compute( expr, env ).ival;
+    inv->run = *inv->runs;
+  }
+  return (Value){ IntType, .ival = inv->val };
+}
+
+/** While loops around the part of a tree the hoisting pass is looking
+    at, outermost first. */
+typedef struct {
+  ConditionalStmt **list;
+  int count;
+  int cap;
+} LoopStack;
+
+/** Return true if the given statement contains a push.  A push can
+    change the length of any sequence, through any variable that refers
+    to it.
+    @param stmt statement to look through.
+    @return true if stmt contains a push statement.
+*/
+static bool containsPush( Stmt *stmt )
+{
+  if ( stmt->destroy == destroySimpleStmt )
+    return ( (SimpleStmt *) stmt )->op == OP_PUSH;
+
+  if ( stmt->destroy == destroyCompound ) {
+    CompoundStmt *this = (CompoundStmt *) stmt;
+    for ( int i = 0; i < this->len; i++ )
+      if ( containsPush( this->stmtList[ i ] ) )
+        return true;
+    return false;
+  }
+
+  if ( stmt->destroy == destroyConditional )
+    return containsPush( ( (ConditionalStmt *) stmt )->body );
+
+  return false;
+}
+
+/** Return true if the given expression is certain to compute the same
+    int every time it's evaluated in a run of a loop.  That's true for
+    arithmetic and comparisons on literals and int-only variables the
+    loop doesn't assign.  Anything that looks inside a sequence could
+    see the loop change it.
+    @param expr expression to check.
+    @param info state of the pass, after finding int-only variables.
+    @param body body of the loop.
+    @return true if expr is invariant in the loop.
+*/
+static bool isInvariant( Expr *expr, TypeInfo *info, Stmt *body )
+{
+  if ( expr->destroy == destroyLiteralInt )
+    return true;
+
+  if ( expr->destroy == destroyVariable ) {
+    Symbol const *sym = &( (VariableExpr *) expr )->sym;
+    return isIntVariable( info, sym ) && !assignsVariable( body, sym->slot );
+  }
+
+  if ( expr->destroy != destroySimpleExpr )
+    return false;
+
+  SimpleExpr *this = (SimpleExpr *) expr;
+  switch ( this->op ) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_LESS:
+  case OP_EQUALS:
+  case OP_AND:
+  case OP_OR:
+    return isInvariant( this->expr1, info, body ) &&
+      isInvariant( this->expr2, info, body );
+  default:
+    return false;
+  }
+}
+
+/** Put back the eval function of every expression in a tree that was
+    hoisted by an earlier run of the pass.
+    @param expr expression to restore.
+*/
+static void restoreInvariants( Expr *expr )
+{
+  if ( expr->destroy == destroySequence ) {
+    SequenceInitializerExpr *this = (SequenceInitializerExpr *) expr;
+    for ( int i = 0; i < this->length; i++ )
+      restoreInvariants( this->elist[ i ] );
+  } else if ( expr->destroy == destroySimpleExpr ) {
+    SimpleExpr *this = (SimpleExpr *) expr;
+    if ( this->eval == evalInvariant )
+      this->eval = this->invariant->compute;
+    restoreInvariants( this->expr1 );
+    if ( this->expr2 )
+      restoreInvariants( this->expr2 );
+  }
+}
+
+/** Find the largest parts of an expression that are invariant in one of
+    the loops around it, and have them cache their value for each run of
+    the outermost such loop.  Plain variables and literals are left
+    alone, they're already as cheap as a cached value.
+    @param expr expression to look through.
+    @param info state of the pass.
+    @param loops loops around the expression.
+*/
+static void hoistExpr( Expr *expr, TypeInfo *info, LoopStack *loops )
+{
+  if ( expr->destroy == destroySequence ) {
+    SequenceInitializerExpr *this = (SequenceInitializerExpr *) expr;
+    for ( int i = 0; i < this->length; i++ )
+      hoistExpr( this->elist[ i ], info, loops );
+    return;
+  }
+
+  if ( expr->destroy != destroySimpleExpr )
+    return;
+
+  restoreInvariants( expr );
+  SimpleExpr *this = (SimpleExpr *) expr;
+  for ( int i = 0; i < loops->count; i++ )
+    if ( isInvariant( expr, info, loops->list[ i ]->body ) ) {
+      if ( !this->invariant )
+        this->invariant = (Invariant *) malloc( sizeof( Invariant ) );
+      this->invariant->compute = this->eval;
+      this->invariant->runs = &loops->list[ i ]->runs;
+      this->invariant->run = 0;
+      this->eval = evalInvariant;
+      return;
+    }
+
+  hoistExpr( this->expr1, info, loops );
+  if ( this->expr2 )
+    hoistExpr( this->expr2, info, loops );
+}
+
+/** Hoist invariant expressions out of every loop in a statement, and
+    give loops on i < len a a version that only looks up the length
+    once, if nothing in the body can change it.
+    @param stmt statement to look through.
+    @param info state of the pass.
+    @param loops loops around the statement.
+*/
+static void hoistTree( Stmt *stmt, TypeInfo *info, LoopStack *loops )
+{
+  if ( stmt->destroy == destroySimpleStmt ) {
+    SimpleStmt *this = (SimpleStmt *) stmt;
+    hoistExpr( this->expr1, info, loops );
+    if ( this->expr2 )
+      hoistExpr( this->expr2, info, loops );
+  } else if ( stmt->destroy == destroyCompound ) {
+    CompoundStmt *this = (CompoundStmt *) stmt;
+    for ( int i = 0; i < this->len; i++ )
+      hoistTree( this->stmtList[ i ], info, loops );
+  } else if ( stmt->destroy == destroyConditional ) {
+    // A loop's condition runs with the loops outside it, and its body
+    // runs inside it.
+    ConditionalStmt *this = (ConditionalStmt *) stmt;
+    hoistExpr( this->cond, info, loops );
+    if ( this->compile == compileIf ) {
+      hoistTree( this->body, info, loops );
+      return;
+    }
+
+    // Guarded loops already look at the sequence for every iteration.
+    if ( this->cond->eval == evalLessLen &&
+         this->execute != executeWhileGuarded &&
+         !assignsVariable( this->body,
+                           ( (VarPairExpr *) this->cond )->sym2.slot ) &&
+         !containsPush( this->body ) )
+      this->execute = executeWhileLessLen;
+
+    if ( loops->count >= loops->cap ) {
+      loops->cap = loops->cap ? loops->cap * DOUBLE_CAP : INIT_CAP;
+      loops->list = (ConditionalStmt **)
+        realloc( loops->list, loops->cap * sizeof( ConditionalStmt * ) );
+    }
+    loops->list[ loops->count++ ] = this;
+    hoistTree( this->body, info, loops );
+    loops->count--;
+  } else if ( stmt->destroy == destroyAssignment ) {
+    AssignmentStmt *this = (AssignmentStmt *) stmt;
+    hoistExpr( this->expr, info, loops );
+    if ( this->iexpr )
+      hoistExpr( this->iexpr, info, loops );
+  }
+}
+
+/** Run the hoisting pass over a statement, after the other passes have
+    chosen eval and execute functions for it.
+    @param stmt statement to look through.
+    @param info state of the pass, after finding int-only variables.
+*/
+static void hoistInvariants( Stmt *stmt, TypeInfo *info )
+{
+  LoopStack loops = { NULL, 0, 0 };
+  hoistTree( stmt, info, &loops );
+  free( loops.list );
+}
+
+void specializeStmt( Stmt *stmt, Environment *env )
+{
+  // Start out believing every variable that's an int now stays an int,
+  // then look for assignments that could change that, until there are
+  // no more.
+  TypeInfo info = { env, NULL, true, NULL, 0, 0 };
+  info.kind = (unsigned char *) calloc( currentInterp()->symbolCount + 1, 1 );
+  while ( info.changed ) {
+    info.changed = false;
+    findIntVariables( stmt, &info );
+  }
+
+  specializeTree( stmt, &info );
+  checkBounds( stmt, &info );
+  hoistInvariants( stmt, &info );
+  free( info.kind );
+  free( info.guards );
+}
+
+///////////////////////////////////////////////////////////////////////
+// Profiling
+
+/** Eval function for an expression that's being profiled.  It calls the
+    expression's own eval function, counting the call and the time spent
+    in it. */
+static Value evalProfiled( Expr *expr, Environment *env )
+{
+  ProfileCount *count = expr->profile;
+  Profile *profile = currentInterp()->profile;
+
+  // Time spent in the nodes below this one is theirs, not ours.
+  uint64_t outer = profile->nested;
+  profile->nested = 0;
+  uint64_t start = readCycles();
+  Value result = count->eval( expr, env );
+  uint64_t cycles = readCycles() - start;
+
+  count->count++;
+  count->cycles += cycles - profile->nested;
+  profile->nested = outer + cycles;
+  return result;
+}
+
+/** Execute function for a statement that's being profiled, like
+    evalProfiled(). */
+static void executeProfiled( Stmt *stmt, Environment *env )
+{
+  ProfileCount *count = stmt->profile;
+  Profile *profile = currentInterp()->profile;
+
+  uint64_t outer = profile->nested;
+  profile->nested = 0;
+  uint64_t start = readCycles();
+  count->execute( stmt, env );
+  uint64_t cycles = readCycles() - start;
+
+  count->count++;
+  count->cycles += cycles - profile->nested;
+  profile->nested = outer + cycles;
+}
+
+/** Start or stop profiling an expression and everything in it.
+    @param expr expression to profile.
+    @param profile profile to collect counts in, or NULL to stop.
+    @param line line of the enclosing node, for nodes the parser didn't
+    give a line of their own.
+*/
+static void profileExpr( Expr *expr, Profile *profile, int line )
+{
+  if ( expr->line )
+    line = expr->line;
+
+  if ( profile && expr->eval != evalProfiled ) {
+    if ( !expr->profile )
+      expr->profile = newProfileCount( profile, line, false );
+    expr->profile->eval = expr->eval;
+    expr->eval = evalProfiled;
+  } else if ( !profile && expr->eval == evalProfiled ) {
+    expr->eval = expr->profile->eval;
+  }
+
+  if ( expr->destroy == destroySimpleExpr ) {
+    SimpleExpr *this = (SimpleExpr *) expr;
+    profileExpr( this->expr1, profile, line );
+    if ( this->expr2 )
+      profileExpr( this->expr2, profile, line );
+  } else if ( expr->destroy == destroySequence ) {
+    SequenceInitializerExpr *this = (SequenceInitializerExpr *) expr;
+    for ( int i = 0; i < this->length; i++ )
+      profileExpr( this->elist[ i ], profile, line );
+  }
+}
+
+/** Start or stop profiling a statement and everything in it, like
+    profileExpr(). */
+static void profileTree( Stmt *stmt, Profile *profile, int line )
+{
+  if ( stmt->line )
+    line = stmt->line;
+
+  // Without a line of its own or one around it, this is the compound
+  // holding a whole program, which isn't in the source, so only what's
+  // in it is counted.
+  if ( profile && line && stmt->execute != executeProfiled ) {
+    if ( !stmt->profile )
+      stmt->profile = newProfileCount( profile, line, true );
+    stmt->profile->execute = stmt->execute;
+    stmt->execute = executeProfiled;
+  } else if ( !profile && stmt->execute == executeProfiled ) {
+    stmt->execute = stmt->profile->execute;
+  }
+
+  if ( stmt->destroy == destroySimpleStmt ) {
+    SimpleStmt *this = (SimpleStmt *) stmt;
+    profileExpr( this->expr1, profile, line );
+    if ( this->expr2 )
+      profileExpr( this->expr2, profile, line );
+  } else if ( stmt->destroy == destroyCompound ) {
+    CompoundStmt *this = (CompoundStmt *) stmt;
+    for ( int i = 0; i < this->len; i++ )
+      profileTree( this->stmtList[ i ], profile, line );
+  } else if ( stmt->destroy == destroyConditional ) {
+    ConditionalStmt *this = (ConditionalStmt *) stmt;
+    profileExpr( this->cond, profile, line );
+    profileTree( this->body, profile, line );
+  } else if ( stmt->destroy == destroyAssignment ) {
+    AssignmentStmt *this = (AssignmentStmt *) stmt;
+    profileExpr( this->expr, profile, line );
+    if ( this->iexpr )
+      profileExpr( this->iexpr, profile, line );
+  }
+}
+
+void profileStmt( Stmt *stmt, Profile *profile )
+{
+  profileTree( stmt, profile, 0 );
+}
+
+///////////////////////////////////////////////////////////////////////
+// Serialization
+
+/** Kinds of node in a serialized tree.  Each node is written as its
+    kind and its line, then its operands, with each child written in
+    full where it appears.  That's the order the parser builds them in,
+    so a tree can be read back by calling the same make functions, and
+    it gets the same fused nodes the parser would have made. */
+typedef enum {
+  NODE_INT,
+  NODE_VAR,
+  NODE_SEQUENCE,
+
+  /** A sequence initializer with only literal elements, followed by
+      their values. */
+  NODE_CONSTANT,
+
+  /** Any SimpleExpr, followed by the instruction for its operator. */
+  NODE_OPERATOR,
+
+  NODE_PRINT,
+  NODE_PUSH,
+  NODE_COMPOUND,
+  NODE_IF,
+  NODE_WHILE,
+  NODE_ASSIGN,
+  NODE_ASSIGN_ELEMENT
+} NodeKind;
+
+/** Write an expression and everything in it.
+    @param expr expression to write.
+    @param line line to write for it.  A fused expression is written as
+    the one it replaced, with the fused expression's line.
+    @param out block to write to.
+*/
+static void saveExpr( Expr *expr, int line, Serial *out )
+{
+  if ( expr->destroy == destroyVarPair ) {
+    saveExpr( ( (VarPairExpr *) expr )->original, line, out );
+    return;
+  }
+
+  if ( expr->destroy == destroyLiteralInt ) {
+    putInt( out, NODE_INT );
+    putLine( out, line );
+    putInt( out, ( (LiteralInt *) expr )->val );
+  } else if ( expr->destroy == destroyVariable ) {
+    putInt( out, NODE_VAR );
+    putLine( out, line );
+    putSymbol( out, &( (VariableExpr *) expr )->sym );
+  } else if ( expr->destroy == destroySequence ) {
+    SequenceInitializerExpr *this = (SequenceInitializerExpr *) expr;
+    if ( this->constant ) {
+      putInt( out, NODE_CONSTANT );
+      putLine( out, line );
+      putInt( out, this->constant->len );
+      for ( int i = 0; i < this->constant->len; i++ )
+        putInt( out, getElement( this->constant, i ) );
+      return;
+    }
+
+    putInt( out, NODE_SEQUENCE );
+    putLine( out, line );
+    putInt( out, this->length );
+    for ( int i = 0; i < this->length; i++ )
+      saveExpr( this->elist[ i ], this->elist[ i ]->line, out );
+  } else {
+    SimpleExpr *this = (SimpleExpr *) expr;
+    putInt( out, NODE_OPERATOR );
+    putLine( out, line );
+    putInt( out, this->op );
+    saveExpr( this->expr1, this->expr1->line, out );
+    if ( this->expr2 )
+      saveExpr( this->expr2, this->expr2->line, out );
+  }
+}
+
+void saveStmt( Stmt *stmt, Serial *out )
+{
+  if ( stmt->destroy == destroySimpleStmt ) {
+    SimpleStmt *this = (SimpleStmt *) stmt;
+    putInt( out, this->op == OP_PRINT ? NODE_PRINT : NODE_PUSH );
+    putLine( out, stmt->line );
+    saveExpr( this->expr1, this->expr1->line, out );
+    if ( this->expr2 )
+      saveExpr( this->expr2, this->expr2->line, out );
+  } else if ( stmt->destroy == destroyCompound ) {
+    CompoundStmt *this = (CompoundStmt *) stmt;
+    putInt( out, NODE_COMPOUND );
+    putLine( out, stmt->line );
+    putInt( out, this->len );
+    for ( int i = 0; i < this->len; i++ )
+      saveStmt( this->stmtList[ i ], out );
+  } else if ( stmt->destroy == destroyConditional ) {
+    ConditionalStmt *this = (ConditionalStmt *) stmt;
+    putInt( out, stmt->compile == compileIf ? NODE_IF : NODE_WHILE );
+    putLine( out, stmt->line );
+    saveExpr( this->cond, this->cond->line, out );
+    saveStmt( this->body, out );
+  } else {
+    AssignmentStmt *this = (AssignmentStmt *) stmt;
+    putInt( out, this->iexpr ? NODE_ASSIGN_ELEMENT : NODE_ASSIGN );
+    putLine( out, stmt->line );
+    putSymbol( out, &this->sym );
+    if ( this->iexpr )
+      saveExpr( this->iexpr, this->iexpr->line, out );
+    saveExpr( this->expr, this->expr->line, out );
+  }
+}
+
+/** Read an expression written by saveExpr().
+    @param in block to read from.
+    @return the new expression.  If the block is bad, this is still a
+    complete tree that can be destroyed.
+*/
+static Expr *loadExpr( Serial *in )
+{
+  int kind = getInt( in );
+  int line = getLine( in );
+
+  Expr *expr;
+  if ( kind == NODE_INT ) {
+    expr = makeLiteralInt( getInt( in ) );
+  } else if ( kind == NODE_VAR ) {
+    expr = makeVariable( getSymbol( in ) );
+  } else if ( kind == NODE_SEQUENCE || kind == NODE_CONSTANT ) {
+    int len = getCount( in );
+    Element *elems = (Element *) malloc( ( len ? len : 1 ) *
+                                         sizeof( Element ) );
+    for ( int i = 0; i < len; i++ ) {
+      if ( kind == NODE_SEQUENCE )
+        elems[ i ] = (Element){ loadExpr( in ), 0 };
+      else
+        elems[ i ] = (Element){ NULL, getInt( in ) };
+    }
+    expr = makeSequenceInitializer( len, elems );
+    free( elems );
+  } else if ( kind == NODE_OPERATOR ) {
+    int op = getInt( in );
+    Expr *left = loadExpr( in );
+    if ( op == OP_LEN ) {
+      expr = makeLenExpr( left );
+    } else {
+      Expr *right = loadExpr( in );
+      switch ( op ) {
+      case OP_ADD: expr = makeAdd( left, right ); break;
+      case OP_SUB: expr = makeSub( left, right ); break;
+      case OP_MUL: expr = makeMul( left, right ); break;
+      case OP_DIV: expr = makeDiv( left, right ); break;
+      case OP_LESS: expr = makeLess( left, right ); break;
+      case OP_EQUALS: expr = makeEquals( left, right ); break;
+      case OP_AND: expr = makeAnd( left, right ); break;
+      case OP_OR: expr = makeOr( left, right ); break;
+      case OP_INDEX: expr = makeSequenceIndex( left, right ); break;
+      default:
+        in->bad = true;
+        expr = makeAdd( left, right );
+      }
+    }
+  } else {
+    in->bad = true;
+    expr = makeLiteralInt( 0 );
+  }
+
+  expr->line = line;
+  return expr;
+}
+
+Stmt *loadStmt( Serial *in )
+{
+  int kind = getInt( in );
+  int line = getLine( in );
+
+  Stmt *stmt;
+  if ( kind == NODE_PRINT ) {
+    stmt = makePrint( loadExpr( in ) );
+  } else if ( kind == NODE_PUSH ) {
+    Expr *sexpr = loadExpr( in );
+    Expr *vexpr = loadExpr( in );
+    stmt = makePush( sexpr, vexpr );
+  } else if ( kind == NODE_COMPOUND ) {
+    int len = getCount( in );
+    Stmt **stmtList = (Stmt **) malloc( ( len ? len : 1 ) *
+                                        sizeof( Stmt * ) );
+    for ( int i = 0; i < len; i++ )
+      stmtList[ i ] = loadStmt( in );
+    stmt = makeCompound( len, stmtList );
+    free( stmtList );
+  } else if ( kind == NODE_IF || kind == NODE_WHILE ) {
+    Expr *cond = loadExpr( in );
+    Stmt *body = loadStmt( in );
+    stmt = kind == NODE_IF ? makeIf( cond, body ) : makeWhile( cond, body );
+  } else if ( kind == NODE_ASSIGN || kind == NODE_ASSIGN_ELEMENT ) {
+    Symbol const *sym = getSymbol( in );
+    Expr *iexpr = kind == NODE_ASSIGN_ELEMENT ? loadExpr( in ) : NULL;
+    stmt = makeAssignment( sym, iexpr, loadExpr( in ) );
+  } else {
+    in->bad = true;
+    stmt = makePrint( makeLiteralInt( 0 ) );
+  }
+
+  stmt->line = line;
+  return stmt;
+}
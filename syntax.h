@@ -11,8 +11,23 @@
 #define _SYNTAX_H_
 
 #include "value.h"
-
-
+#include "arena.h"
+#include "profile.h"
+#include "serial.h"
+
+/** Short name for a block of bytecode, defined in vm.h.  Expressions and
+    statements know how to compile themselves into one of these. */
+typedef struct CodeStruct Code;
+
+/** Choose the arena the make functions below allocate expressions and
+    statements from.  Destroying an expression or statement frees any
+    other resources it holds, but its own memory is only released when
+    this arena is reset or freed.  If no arena is chosen, a default one
+    is created.
+    @param arena arena for new syntax objects.
+    @return the arena that was chosen before, so it can be restored.
+*/
+Arena *setSyntaxArena( Arena *arena );
 
 //////////////////////////////////////////////////////////////////////
 // Expr, an interface for an expression in the input program.
@@ -21,10 +36,13 @@
 typedef struct ExprStruct Expr;
 
 /** Representation for an Expr interface.  Classes implementing this
-    have these two fields as their first members.  They will set eval
+    have these five fields as their first members.  They will set eval
     to point to appropriate functions to evaluate the expression, based on
     what kind of expression it is.  They will set destroy to
-    point to a function that frees memory for their type of expresson.
+    point to a function that frees memory for their type of expresson,
+    and compile to a function that translates it to bytecode.  The
+    parser fills in the line, and the profile is only used while the
+    expression is being profiled.
 */
 struct ExprStruct {
   /** Pointer to a function to evaluate the given expression and
@@ -40,6 +58,20 @@ struct ExprStruct {
       @param expr expression to free.
   */
   void (*destroy)( Expr *expr );
+
+  /** Append bytecode that evaluates this expression and leaves its
+      value on top of the stack.
+      @param expr expression to compile.
+      @param code block of bytecode to add instructions to.
+  */
+  void (*compile)( Expr *expr, Code *code );
+
+  /** Line of the program this expression came from. */
+  int line;
+
+  /** Counts for profiling this expression, or NULL if it hasn't been
+      profiled. */
+  ProfileCount *profile;
 };
 
 /** Make a representation of a literal int value, a value that gives
@@ -123,24 +155,37 @@ Expr *makeAnd( Expr *left, Expr *right );
 Expr *makeOr( Expr *left, Expr *right );
 
 /** Make an expression that evaluates to a copy of the value of the
-    variable with the given name.  The variable's value will depend on
-    the Environment.
-    @param name Name of the variable 
+    given variable.  The variable's value will depend on the Environment.
+    @param sym Symbol the parser resolved for this variable.
     @return pointer to a new, dynamically allocated subclass of Expr.
  */
-Expr *makeVariable( char const *name );
+Expr *makeVariable( Symbol const *sym );
 
 
 /**********************Sequence Initializer operations*/
+/**
+ * One element for a sequence initializer.  A literal doesn't need an
+ * expression of its own, it can be given as just its value.
+*/
+typedef struct {
+  //Expression for the element, or NULL if it's a literal
+  Expr *expr;
+
+  //Value of a literal element
+  int val;
+} Element;
+
 /**
  * Make an expression that initializes a sequence.
  * Will evaluate every single one of the input expressions and then increase
- * length and capacity as is fit.
+ * length and capacity as is fit.  If every element is a literal, their
+ * values are packed into a sequence right away, and the expressions
+ * aren't kept.
  * @param len the intial length of the list
- * @param eList the list of elements to add into the sequence
+ * @param elems the list of elements to add into the sequence
  * @return a pointer to a new sequence expression.
 */
-Expr *makeSequenceInitializer( int len, Expr *elist[] );
+Expr *makeSequenceInitializer( int len, Element const elems[] );
 
 
 
@@ -171,11 +216,13 @@ Expr *makeSequenceIndex( Expr *aexpr, Expr *iexpr );
 typedef struct StmtStruct Stmt;
 
 /** Representation for the Stmt interface, a superclass for all types
-    of statements.  Classes implementing this have these two fields as
+    of statements.  Classes implementing this have these five fields as
     their first members.  They will set execute to point to an
     appropriate functions to execute the type of statement their
-    class represents, and they will set destroy to point to a function
-    that frees memory for their type of statement.
+    class represents, they will set destroy to point to a function
+    that frees memory for their type of statement, and they will set
+    compile to a function that translates it to bytecode.  The line and
+    profile are like the ones for Expr.
 */
 struct StmtStruct {
   /** Pointer to a function to execute the given staement.
@@ -189,6 +236,19 @@ struct StmtStruct {
       @param stmt statement to free.
   */
   void (*destroy)( Stmt *stmt );
+
+  /** Append bytecode that performs this statement.
+      @param stmt statement to compile.
+      @param code block of bytecode to add instructions to.
+  */
+  void (*compile)( Stmt *stmt, Code *code );
+
+  /** Line of the program this statement came from. */
+  int line;
+
+  /** Counts for profiling this statement, or NULL if it hasn't been
+      profiled. */
+  ProfileCount *profile;
 };
 
 /** Make a statement that evaluates the given argument and prints it
@@ -201,9 +261,10 @@ Stmt *makePrint( Expr *arg );
 /** Make a compound statement, representing the sequence of statements
     @param len number of statements in stmtList.
     @param stmtList list of statements making up this compound. The
-    compound statement will take ownership of this list of statements
-    and will be responsible for freeing all these statements when it
-    is destroyed.
+    compound statement keeps a copy of this list, so the caller still
+    owns the array itself.  The compound will take ownership of the
+    statements, and will be responsible for freeing them when it is
+    destroyed.
     @return a new statement that executes all the statements in
     stmtList, in order.
  */
@@ -245,13 +306,25 @@ Stmt *makePush( Expr *sexpr, Expr *vexpr );
 /** Make a representation of an assignment statement.  It is intended to
     work for assigning to a variable (if idx is null), or changing just
     one element in an array (if idx is non-null).
-    @param vname Name of the variable we're assigning to.
+    @param sym Symbol for the variable we're assigning to.
     @param iexpr If this is an assignment to an array element, this is the
     index for the target element, or null if not.
     @param expr Expression on the right-hand side of the assignemnt.
     @return A new statement object that can perform the assignment.
  */
-Stmt *makeAssignment( char const *name, Expr *iexpr, Expr *expr );
+Stmt *makeAssignment( Symbol const *sym, Expr *iexpr, Expr *expr );
+
+/** Prepare a statement for the tree-walking evaluator, just before it
+    runs.  Starting from the types variables have in the environment now,
+    this works out which variables can only hold ints while the statement
+    runs, and which parts of it can only compute ints.  Those parts are
+    switched to versions of eval and execute that skip type checks; the
+    rest go back to the general versions, so a statement can be
+    specialized again before each run.
+    @param stmt statement that's about to be executed.
+    @param env environment it will be executed in.
+*/
+void specializeStmt( Stmt *stmt, Environment *env );
 
 //////////////////////////////////////
 //Push statement
@@ -261,4 +334,34 @@ Stmt *makeAssignment( char const *name, Expr *iexpr, Expr *expr );
  * @return 
 */
 
+/** Start or stop profiling a statement and everything in it.  Starting
+    wraps the eval and execute functions of every node, so each call is
+    counted and timed in the profile.  Stopping puts back the functions
+    the nodes really use, and has to be done before the statement is
+    specialized again, since specializing looks at those functions.  The
+    counts stay in the profile.
+    @param stmt statement to profile.
+    @param profile profile to collect the counts in, or NULL to stop.
+*/
+void profileStmt( Stmt *stmt, Profile *profile );
+
+/** Write a statement and everything in it, in the form the compiled
+    script cache keeps.  Only the structure the parser built is written,
+    so this should be called before the statement is specialized or
+    profiled.
+    @param stmt statement to write.
+    @param out block to write it to.
+*/
+void saveStmt( Stmt *stmt, Serial *out );
+
+/** Build a statement from one written by saveStmt(), using the make
+    functions above, so it gets the same fused nodes as if it had been
+    parsed.  Variables are resolved in the current context.
+    @param in block to read from.
+    @return the new statement.  If in->bad is set afterward, the block
+    didn't hold a statement, and this is just something that can be
+    destroyed.
+*/
+Stmt *loadStmt( Serial *in );
+
 #endif
@@ -96,11 +96,11 @@ testInterpreter() {
   TESTNO=$1
   ESTATUS=$2
 
-  echo "Test $TESTNO"
+  echo "Test $TESTNO $FLAGS"
   rm -f output.txt stderr.txt
 
-  echo "   ./interpret prog-$TESTNO.txt > output.txt 2> stderr.txt"
-  ./interpret prog-$TESTNO.txt > output.txt 2> stderr.txt
+  echo "   ./interpret $FLAGS prog-$TESTNO.txt > output.txt 2> stderr.txt"
+  ./interpret $FLAGS prog-$TESTNO.txt > output.txt 2> stderr.txt
   ASTATUS=$?
 
   if ! checkStatus "$ESTATUS" "$ASTATUS" ||
@@ -111,7 +111,7 @@ testInterpreter() {
       return 1
   fi
 
-  echo "Test $TESTNO PASS"
+  echo "Test $TESTNO $FLAGS PASS"
   return 0
 }
 
@@ -119,27 +119,162 @@ testInterpreter() {
 make clean
 make
 
-# Run against the test inputs.
+# Run against the test inputs, once with the tree-walking evaluator
+# and once with the bytecode VM.
 if [ -x interpret ]; then
-    testInterpreter 01 0
-    testInterpreter 02 0
-    testInterpreter 03 0
-    testInterpreter 04 0
-    testInterpreter 05 0
-    testInterpreter 06 0
-    testInterpreter 07 0
-    testInterpreter 08 0
-    testInterpreter 09 0
-    testInterpreter 10 0
-    testInterpreter 11 0
-    testInterpreter 12 0
-    testInterpreter 13 0
-    testInterpreter 14 0
-    testInterpreter 15 0
+    for FLAGS in "" "--vm"; do
+      testInterpreter 01 0
+      testInterpreter 02 0
+      testInterpreter 03 0
+      testInterpreter 04 0
+      testInterpreter 05 0
+      testInterpreter 06 0
+      testInterpreter 07 0
+      testInterpreter 08 0
+      testInterpreter 09 0
+      testInterpreter 10 0
+      testInterpreter 11 0
+      testInterpreter 12 0
+      testInterpreter 13 0
+      testInterpreter 14 0
+      testInterpreter 15 0
+      testInterpreter 20 0
+      testInterpreter 21 0
+      testInterpreter 23 0
+      testInterpreter 24 0
+      testInterpreter 28 0
+      testInterpreter 32 0
+      testInterpreter 33 0
+      testInterpreter 37 0
+      testInterpreter 39 0
+      testInterpreter 40 0
+      testInterpreter ec-1 0
+      testInterpreter ec-2 0
+      testInterpreter 16 1
+      testInterpreter 17 1
+      testInterpreter 18 1
+      testInterpreter 19 1
+      testInterpreter 22 1
+      testInterpreter 30 1
+      testInterpreter 31 1
+      testInterpreter 42 1
+      testInterpreter 43 1
+    done
+
+    # Timing one run shouldn't change what a program prints before a
+    # syntax error.
+    for FLAGS in "--time" "--vm --time"; do
+      testInterpreter 43 1
+    done
+
+    # Programs that depend on value semantics for sequences.
+    for FLAGS in "--value-semantics" "--vm --value-semantics"; do
+      testInterpreter 25 0
+      testInterpreter 34 0
+    done
+
+    # Programs parsed once and run more than once.
+    for FLAGS in "--runs=2" "--vm --runs=2"; do
+      testInterpreter 26 0
+    done
+
+    # Programs loaded from the compiled script cache, once to fill it and
+    # again from the cached trees, which should be rewritten the same way.
+    rm -rf cache-test
+    for FLAGS in "--cache=cache-test" "--vm --cache=cache-test"; do
+      for PASS in 1 2; do
+        testInterpreter 21 0
+        testInterpreter 28 0
+        testInterpreter 31 1
+        testInterpreter 40 0
+      done
+    done
+    for PASS in 1 2; do
+      FLAGS="--stats --cache=cache-test"
+      testInterpreter 29 0
+    done
+    rm -rf cache-test
+
+    # A batch of programs, listed in a file, run on a pool of threads.
+    for FLAGS in "--batch" "--batch --vm --jobs=3"; do
+      testInterpreter 27 1
+    done
+
+    # Counters for the peephole rewrites and constant folding.
+    for FLAGS in "--stats" "--vm --stats"; do
+      testInterpreter 29 0
+      testInterpreter 38 0
+    done
+
+    # Memory accounting, which should find that everything was freed.
+    # Peak sizes depend on which environment is built in, so we just
+    # check that each kind was freed as often as it was allocated.
+    for FLAGS in "--mem-stats" "--vm --mem-stats"; do
+      echo "Test 41 $FLAGS"
+      ./interpret $FLAGS prog-41.txt > output.txt 2> stderr.txt
+      if checkStatus 0 "$?" &&
+         checkFile "Stdout output" "expected-41.txt" "output.txt"; then
+        if grep -q "^memory: .*, 0 bytes live$" stderr.txt &&
+           grep -q "^leaked sequences: 0$" stderr.txt &&
+           grep -q " allocated, " stderr.txt &&
+           ! sed -n -E 's/.*: ([0-9]+) allocated, ([0-9]+) freed.*/\1 \2/p' \
+               stderr.txt | awk '$1 != $2 { bad = 1 } END { exit !bad }'; then
+          echo "Test 41 $FLAGS PASS"
+        else
+          fail "FAILED - memory report in stderr.txt doesn't balance"
+        fi
+      fi
+    done
+
+    # Profiling shouldn't change what a program does.  The report has
+    # timings in it, so we just check that it's there, and that it only
+    # has lines from the source, even when it's for a whole program.
+    rm -rf cache-test
+    for FLAGS in "--profile" "--profile --cache=cache-test"; do
+      for TEST in "28 0" "31 1" "32 0"; do
+        set -- $TEST
+        echo "Test $1 $FLAGS"
+        ./interpret $FLAGS prog-$1.txt > output.txt 2> stderr.txt
+        if checkStatus "$2" "$?" &&
+           checkFile "Stdout output" "expected-$1.txt" "output.txt"; then
+          if grep -q "^profile: " stderr.txt &&
+             grep -q "^sequences: " stderr.txt &&
+             ! grep -q "^ *0 " stderr.txt; then
+            echo "Test $1 $FLAGS PASS"
+          else
+            fail "FAILED - no profile report in stderr.txt"
+          fi
+        fi
+      done
+    done
+    rm -rf cache-test
+
+    # Programs streamed through a pipe, run as they arrive.
+    for TEST in "14 0" "21 0" "28 0" "16 1" "22 1"; do
+      set -- $TEST
+      echo "Test $1 (streamed)"
+      echo "   cat prog-$1.txt | ./interpret - > output.txt 2> stderr.txt"
+      cat prog-$1.txt | ./interpret - > output.txt 2> stderr.txt
+      if checkStatus "$2" "$?" &&
+         checkFile "Stdout output" "expected-$1.txt" "output.txt" &&
+         checkFileOrEmpty "Stderr output" "message-$1.txt" "stderr.txt"; then
+        echo "Test $1 (streamed) PASS"
+      fi
+    done
+
+    # A program saves its variables, then another one starts from them.
+    for MODE in "" "--vm"; do
+      FLAGS="$MODE --save-env=env-35.img"
+      testInterpreter 35 0
+      FLAGS="$MODE --load-env=env-35.img"
+      testInterpreter 36 0
+    done
+    rm -f env-35.img
+
+    # Output written after every print should be the same.
+    FLAGS="--unbuffered"
+    testInterpreter 21 0
     testInterpreter 16 1
-    testInterpreter 17 1
-    testInterpreter 18 1
-    testInterpreter 19 1
 else
     fail "Since your program didn't compile, we couldn't test it"
 fi
@@ -6,9 +6,13 @@
  * Sequences of ints and the Environment of variables.
 */
 #include "value.h"
+#include "context.h"
+#include "kernel.h"
+#include "memory.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 
 
@@ -16,25 +20,345 @@
 // Sequence.
 
 
+/** Most spare sequence headers a context keeps for reuse. */
+#define MAX_SPARES 256
+
+/** Keep the context's counts of element storage up to date when a
+    sequence gets a block of memory for its elements or gives one up.
+    Elements kept in the header (see SMALL_BYTES) aren't counted.
+    @param oldCap elements of room it had, zero for none.
+    @param oldWidth bytes per element it had.
+    @param cap elements of room it has now, zero for none.
+    @param width bytes per element it has now.
+*/
+static void countStorage( int oldCap, int oldWidth, int cap, int width )
+{
+  Interp *interp = currentInterp();
+  interp->elementBytes += (long) cap * width - (long) oldCap * oldWidth;
+  interp->intElementBytes += ( (long) cap - oldCap ) * sizeof( int );
+
+  if ( interp->elementBytes > interp->maxElementBytes )
+    interp->maxElementBytes = interp->elementBytes;
+  if ( interp->intElementBytes > interp->maxIntElementBytes )
+    interp->maxIntElementBytes = interp->intElementBytes;
+}
+
+/** Return true if a sequence keeps its elements in its own header. */
+static bool isSmall( Sequence const *seq )
+{
+  return seq->seq == seq->small;
+}
+
+/** Return true if a sequence's elements are in a block of memory it
+    allocated, rather than in its header or borrowed from somewhere else
+    (see makeBorrowedSequence()).  Borrowed elements are the only ones
+    with no room counted for them. */
+static bool ownsBlock( Sequence const *seq )
+{
+  return !isSmall( seq ) && seq->cap > 0;
+}
+
+/** Get a sequence header, reusing a spare one if the context has any.
+    @return header with nothing filled in.
+*/
+static Sequence *newHeader()
+{
+  Interp *interp = currentInterp();
+  Sequence *seq = interp->spareSequences;
+  if ( seq ) {
+    interp->spareSequences = seq->owner;
+    interp->spareCount--;
+    countAlloc( MEM_HEADER, sizeof( Sequence ) );
+  } else {
+    seq = (Sequence *) countedMalloc( MEM_HEADER, sizeof( Sequence ) );
+  }
+
+  interp->sequencesMade++;
+  if ( interp->liveSequences )
+    addLiveSequence( interp, seq );
+  return seq;
+}
+
+/** Give up a sequence header, keeping it as a spare if the context
+    doesn't already have plenty.
+    @param seq header to free, which doesn't own anything anymore.
+*/
+static void freeHeader( Sequence *seq )
+{
+  Interp *interp = currentInterp();
+  interp->sequencesFreed++;
+  if ( interp->liveSequences )
+    removeLiveSequence( interp, seq );
+  if ( interp->spareCount >= MAX_SPARES ) {
+    countedFree( MEM_HEADER, seq, sizeof( Sequence ) );
+    return;
+  }
+  countFree( MEM_HEADER, sizeof( Sequence ) );
+
+  seq->owner = interp->spareSequences;
+  interp->spareSequences = seq;
+  interp->spareCount++;
+}
+
+void freeSpareSequences( Sequence *spares )
+{
+  // This is only done when the context is going away, so there's nothing
+  // left to count them in.
+  while ( spares ) {
+    Sequence *next = spares->owner;
+    free( spares );
+    spares = next;
+  }
+}
+
+/** Give a sequence new storage for at least cap elements of its current
+    width, in its header if they'll fit.  Whatever storage it had before
+    is left alone.
+    @param seq sequence getting the storage.
+    @param cap number of elements it should have room for.
+*/
+static void allocElements( Sequence *seq, int cap )
+{
+  if ( cap * seq->width <= SMALL_BYTES ) {
+    seq->seq = seq->small;
+    seq->cap = SMALL_BYTES / seq->width;
+  } else {
+    seq->seq = countedMalloc( MEM_ELEMENTS, (size_t) cap * seq->width );
+    seq->cap = cap;
+    countStorage( 0, seq->width, cap, seq->width );
+  }
+}
+
+/** Free the storage of a sequence that has its own elements.
+    @param seq sequence giving up its storage.
+*/
+static void freeElements( Sequence *seq )
+{
+  if ( ownsBlock( seq ) ) {
+    countStorage( seq->cap, seq->width, 0, seq->width );
+    countedFree( MEM_ELEMENTS, seq->seq, (size_t) seq->cap * seq->width );
+  }
+}
+
 Sequence *makeSequence()
 {
-  Sequence *seq = (Sequence *) malloc(sizeof(Sequence)); 
-  seq->cap = INIT_CAP;
+  return makeSequenceCap( INIT_CAP );
+}
+
+Sequence *makeSequenceCap( int cap )
+{
+  Sequence *seq = newHeader();
   seq->len = 0;
   seq->ref = 0;
-  seq->seq = (int *) malloc (seq->cap * sizeof(int));
+  seq->width = 1;
+  seq->owner = NULL;
+  allocElements( seq, cap );
   return seq; 
 }
 
+Sequence *makeSequenceView( Sequence *owner )
+{
+  Sequence *seq = newHeader();
+  seq->len = owner->len;
+  seq->cap = owner->len;
+  seq->ref = 0;
+  seq->width = owner->width;
+  seq->seq = owner->seq;
+  seq->owner = owner;
+  grabSequence( owner );
+  return seq;
+}
+
+Sequence *makeBorrowedSequence( void const *elements, int len, int width )
+{
+  Sequence *seq = newHeader();
+  seq->len = len;
+  seq->cap = 0;
+  seq->ref = 0;
+  seq->width = width;
+  seq->seq = (void *) elements;
+  seq->owner = NULL;
+  return seq;
+}
+
+Sequence *shareSequence( Sequence *seq )
+{
+  // Move our elements to a payload we can both view, unless we're
+  // already viewing one.
+  if ( !seq->owner ) {
+    Sequence *payload = newHeader();
+    payload->len = seq->len;
+    payload->cap = seq->cap;
+    payload->width = seq->width;
+    payload->seq = seq->seq;
+    payload->ref = 1;
+    payload->owner = NULL;
+
+    // Elements in our header have to move to the payload's.
+    if ( isSmall( seq ) ) {
+      memcpy( payload->small, seq->small, SMALL_BYTES );
+      payload->seq = payload->small;
+    }
+
+    seq->seq = payload->seq;
+    seq->cap = seq->len;
+    seq->owner = payload;
+  }
+
+  return makeSequenceView( seq->owner );
+}
+
+/** Give a view its own copy of the elements it shares with its payload.
+    @param seq view being copied.
+    @param cap capacity for the copy, at least the length of the view.
+*/
+static void copyView( Sequence *seq, int cap )
+{
+  Sequence *owner = seq->owner;
+  if ( owner->ref == 1 && ownsBlock( owner ) ) {
+    // Nobody else is using the payload, so we can just take its
+    // elements.
+    seq->seq = owner->seq;
+    seq->cap = owner->cap;
+    owner->seq = NULL;
+    if ( cap > seq->cap ) {
+      countStorage( seq->cap, seq->width, cap, seq->width );
+      seq->seq = countedRealloc( MEM_ELEMENTS, seq->seq,
+                                 (size_t) seq->cap * seq->width,
+                                 (size_t) cap * seq->width );
+      seq->cap = cap;
+    }
+  } else {
+    void const *elements = seq->seq;
+    allocElements( seq, cap );
+    memcpy( seq->seq, elements, (size_t) seq->len * seq->width );
+  }
+
+  seq->owner = NULL;
+  releaseSequence( owner );
+}
+
+void makeWritable( Sequence *seq )
+{
+  if ( seq->owner )
+    copyView( seq, seq->len );
+}
+
+void reserveSequence( Sequence *seq, int cap )
+{
+  if ( seq->owner ) {
+    copyView( seq, cap < seq->len ? seq->len : cap );
+  } else if ( cap > seq->cap && isSmall( seq ) ) {
+    // Outgrowing the header, so the elements move to a block of their own.
+    allocElements( seq, cap );
+    memcpy( seq->seq, seq->small, (size_t) seq->len * seq->width );
+  } else if ( cap > seq->cap ) {
+    countStorage( seq->cap, seq->width, cap, seq->width );
+    seq->seq = countedRealloc( MEM_ELEMENTS, seq->seq,
+                               (size_t) seq->cap * seq->width,
+                               (size_t) cap * seq->width );
+    seq->cap = cap;
+  }
+}
+
+void widenSequence( Sequence *seq, int width )
+{
+  assert( !seq->owner && width > seq->width );
+
+  // Convert into new storage.  Going from the old to the new width is
+  // just reading each element and storing it again.  Room for the same
+  // number of wider elements never fits in the header.
+  Sequence wide = *seq;
+  wide.width = width;
+  wide.seq = countedMalloc( MEM_ELEMENTS, (size_t) seq->cap * width );
+  countGrowth( MEM_ELEMENTS );
+  for ( int i = 0; i < seq->len; i++ )
+    setElement( &wide, i, getElement( seq, i ) );
+
+  freeElements( seq );
+  countStorage( 0, width, seq->cap, width );
+  seq->seq = wide.seq;
+  seq->width = width;
+}
+
+void appendInt( Sequence *seq, int val )
+{
+  if ( seq->owner || seq->len >= seq->cap )
+    reserveSequence( seq, seq->cap * DOUBLE_CAP );
+  setElement( seq, seq->len++, val );
+}
+
+void appendSequence( Sequence *seq, Sequence const *src )
+{
+  int n = src->len;
+  if ( seq->owner || seq->len + n > seq->cap ) {
+    int cap = seq->cap * DOUBLE_CAP;
+    reserveSequence( seq, cap < seq->len + n ? seq->len + n : cap );
+  }
+
+  // Our elements have to be at least as wide as the ones we're getting,
+  // then the same width is a plain copy.
+  if ( src->width > seq->width )
+    widenSequence( seq, src->width );
+  if ( src->width == seq->width ) {
+    memcpy( (char *) seq->seq + (size_t) seq->len * seq->width, src->seq,
+            (size_t) n * seq->width );
+  } else {
+    for ( int i = 0; i < n; i++ )
+      setElement( seq, seq->len + i, getElement( src, i ) );
+  }
+  seq->len += n;
+}
+
+Sequence *repeatSequence( Sequence const *src, int times )
+{
+  if ( times < 0 )
+    times = 0;
+
+  assert( times == 0 || src->len <= INT_MAX / times );
+  int total = src->len * times;
+  Sequence *seq = makeSequenceCap( total );
+  if ( total == 0 )
+    return seq;
+
+  // The copies are as wide as the original.
+  if ( src->width > seq->width )
+    widenSequence( seq, src->width );
+  int width = seq->width;
+
+  // Repeating one element is just a fill.
+  if ( src->len == 1 ) {
+    kernelFill( seq->seq, getElement( src, 0 ), total, width );
+    seq->len = total;
+    return seq;
+  }
+
+  // Copy the source once, then keep doubling what we've already built
+  // until the result is full.
+  char *elements = (char *) seq->seq;
+  memcpy( elements, src->seq, (size_t) src->len * width );
+  int done = src->len;
+  while ( done < total ) {
+    int n = done < total - done ? done : total - done;
+    memcpy( elements + (size_t) done * width, elements, (size_t) n * width );
+    done += n;
+  }
+
+  seq->len = total;
+  return seq;
+}
+
 void freeSequence( Sequence *seq )
 {
 
-  //Free all the expression
-  if(seq->seq != NULL){
-  free(seq->seq);
+  //A view only has a reference to its constant's elements
+  if(seq->owner){
+    releaseSequence(seq->owner);
+  } else if(seq->seq != NULL){
+  freeElements(seq);
   }
   
-  free(seq);
+  freeHeader(seq);
 }
 
 void grabSequence( Sequence *seq )
@@ -57,6 +381,169 @@ void releaseSequence( Sequence *seq )
 
 //////////////////////////////////////////////////////////////////////
 // Environment.
+//
+// There are three interchangeable representations for the environment,
+// selected at build time.  By default, variables are stored in an array
+// indexed by the slot the parser assigned.  Building with ENV_HASH
+// stores them in an open-addressed hash table keyed by name, and
+// ENV_LIST uses a simple list searched by name.
+
+#if defined( ENV_HASH ) && defined( ENV_LIST )
+#error "Only one of ENV_HASH and ENV_LIST can be selected"
+#endif
+
+unsigned hashName( char const *name, int len )
+{
+  // FNV-1a, good enough for short identifiers.
+  unsigned h = 2166136261u;
+  for ( int i = 0; i < len; i++ ) {
+    h ^= (unsigned char) name[ i ];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/** Release the value stored in a variable, if it's holding a reference
+    to a sequence.
+    @param val value the variable is about to stop holding.
+*/
+static void releaseValue( Value val )
+{
+  if ( val.vtype == SeqType )
+    releaseSequence( val.sval );
+}
+
+#if defined( ENV_HASH )
+
+/** One entry in the hash table. */
+typedef struct {
+  /** True if this entry holds a variable. */
+  bool used;
+
+  /** Hash of the name, so we only compare names when the hashes match. */
+  unsigned hash;
+
+  char name[ MAX_VAR_NAME + 1 ];
+  Value val;
+} VarRec;
+
+// Hidden implementation of the environment, an open-addressed table
+// with linear probing.  Variables are never removed, so we don't need
+// tombstones.
+struct EnvironmentStruct {
+  VarRec *table;
+
+  // Number of name/value pairs.
+  int len;
+
+  // Number of entries in the table, always a power of two.
+  int capacity;
+};
+
+// Initial number of entries in the hash table (a power of two).
+#define INIT_TABLE 16
+
+/** Find the table entry for the given symbol, or the empty entry where
+    it should go.
+    @param table table to search.
+    @param capacity number of entries in the table.
+    @param sym symbol we're looking for.
+    @return pointer to the matching or empty entry.
+*/
+static VarRec *findRec( VarRec *table, int capacity, Symbol const *sym )
+{
+  unsigned mask = capacity - 1;
+  unsigned pos = sym->hash & mask;
+  while ( table[ pos ].used &&
+          ( table[ pos ].hash != sym->hash ||
+            strcmp( table[ pos ].name, sym->name ) != 0 ) )
+    pos = ( pos + 1 ) & mask;
+  return &table[ pos ];
+}
+
+Environment *makeEnvironment()
+{
+  Environment *env = (Environment *) countedMalloc( MEM_ENVIRONMENT,
+                                                   sizeof( Environment ) );
+  env->capacity = INIT_TABLE;
+  env->len = 0;
+  env->table = (VarRec *) countedCalloc( MEM_ENVIRONMENT, env->capacity,
+                                         sizeof( VarRec ) );
+  return env;
+}
+
+Value lookupVariable( Environment *env, Symbol const *sym )
+{
+  VarRec *rec = findRec( env->table, env->capacity, sym );
+  if ( rec->used )
+    return rec->val;
+
+  // Return zero for uninitialized variables.
+  return (Value){ IntType, .ival = 0 };
+}
+
+void setVariable( Environment *env, Symbol const *sym, Value value )
+{
+  VarRec *rec = findRec( env->table, env->capacity, sym );
+  if ( rec->used ) {
+    releaseValue( rec->val );
+    rec->val = value;
+    return;
+  }
+
+  // Keep the table at most half full, so probe sequences stay short.
+  if ( ( env->len + 1 ) * DOUBLE_CAP > env->capacity ) {
+    int cap = env->capacity * DOUBLE_CAP;
+    VarRec *table = (VarRec *) countedCalloc( MEM_ENVIRONMENT, cap,
+                                              sizeof( VarRec ) );
+    countGrowth( MEM_ENVIRONMENT );
+
+    // Move every entry to its new home.  The stored hashes mean we
+    // don't have to look at the names again.
+    unsigned mask = cap - 1;
+    for ( int i = 0; i < env->capacity; i++ )
+      if ( env->table[ i ].used ) {
+        unsigned pos = env->table[ i ].hash & mask;
+        while ( table[ pos ].used )
+          pos = ( pos + 1 ) & mask;
+        table[ pos ] = env->table[ i ];
+      }
+
+    countedFree( MEM_ENVIRONMENT, env->table,
+                 env->capacity * sizeof( VarRec ) );
+    env->table = table;
+    env->capacity = cap;
+    rec = findRec( env->table, env->capacity, sym );
+  }
+
+  rec->used = true;
+  rec->hash = sym->hash;
+  strcpy( rec->name, sym->name );
+  rec->val = value;
+  env->len++;
+}
+
+void visitVariables( Environment *env,
+                     void (*visit)( char const *name, Value val, void *data ),
+                     void *data )
+{
+  for ( int i = 0; i < env->capacity; i++ )
+    if ( env->table[ i ].used )
+      visit( env->table[ i ].name, env->table[ i ].val, data );
+}
+
+void freeEnvironment( Environment *env )
+{
+  for ( int i = 0; i < env->capacity; i++ )
+    if ( env->table[ i ].used )
+      releaseValue( env->table[ i ].val );
+  countedFree( MEM_ENVIRONMENT, env->table,
+               env->capacity * sizeof( VarRec ) );
+
+  countedFree( MEM_ENVIRONMENT, env, sizeof( Environment ) );
+}
+
+#elif defined( ENV_LIST )
 
 typedef struct {
   char name[ MAX_VAR_NAME + 1 ];
@@ -76,65 +563,153 @@ struct EnvironmentStruct {
 
 Environment *makeEnvironment()
 {
-  Environment *env = (Environment *) malloc( sizeof( Environment ) );
+  Environment *env = (Environment *) countedMalloc( MEM_ENVIRONMENT,
+                                                   sizeof( Environment ) );
   env->capacity = INIT_CAP;
   env->len = 0;
-  env->vlist = (VarRec *) malloc( sizeof( VarRec ) * env->capacity );
+  env->vlist = (VarRec *) countedMalloc( MEM_ENVIRONMENT,
+                                         sizeof( VarRec ) * env->capacity );
   return env;
 }
 
-Value lookupVariable( Environment *env, char const *name )
+Value lookupVariable( Environment *env, Symbol const *sym )
 {
   // Linear search for a variable name, not too efficient.
   for ( int i = 0; i < env->len; i++ )
-    if ( strcmp( env->vlist[ i ].name, name ) == 0 )
+    if ( strcmp( env->vlist[ i ].name, sym->name ) == 0 )
       return env->vlist[ i ].val;
 
   // Return zero for uninitialized variables.
   return (Value){ IntType, .ival = 0 };
 }
 
-void setVariable( Environment *env, char const *name, Value value )
+void setVariable( Environment *env, Symbol const *sym, Value value )
 {
   int pos = 0;
-  while ( pos < env->len && strcmp( env->vlist[ pos ].name, name ) != 0 )
+  while ( pos < env->len && strcmp( env->vlist[ pos ].name, sym->name ) != 0 )
     pos++;
 
-  if ( pos >= env->len ) {
+  // Is this a new variable, or one that already existed?
+  if ( pos == env->len ) {
     if ( env->len >= env->capacity ) {
+      env->vlist = (VarRec *) countedRealloc( MEM_ENVIRONMENT, env->vlist,
+                                              sizeof( VarRec ) * env->capacity,
+                                              sizeof( VarRec ) * env->capacity
+                                              * DOUBLE_CAP );
       env->capacity *= DOUBLE_CAP;
-      env->vlist = (VarRec *) realloc( env->vlist, sizeof( VarRec ) * env->capacity );
     }
-  }
 
-  // Is this a new variable, or one that already existed?
-  if ( pos == env->len ) {
     pos = env->len++;
-    strcpy( env->vlist[ pos ].name, name );
+    strcpy( env->vlist[ pos ].name, sym->name );
+  } else {
+    releaseValue( env->vlist[ pos ].val );
   }
-  else{
-    //If this variable already exists we need to release the sequence if needed
-    if(env->vlist[pos].val.vtype == SeqType){
-      releaseSequence(env->vlist[pos].val.sval);
-    }
-  }
-  
-  
 
   env->vlist[ pos ].val = value;
 }
 
+void visitVariables( Environment *env,
+                     void (*visit)( char const *name, Value val, void *data ),
+                     void *data )
+{
+  for ( int i = 0; i < env->len; i++ )
+    visit( env->vlist[ i ].name, env->vlist[ i ].val, data );
+}
+
 void freeEnvironment( Environment *env )
 {
-  //Need a case for if the variable is actually a sequence
-  for(int i = 0; i < env->len; i++){
-    if(env->vlist[i].val.vtype == SeqType){
-      releaseSequence(env->vlist[i].val.sval);
+  for ( int i = 0; i < env->len; i++ )
+    releaseValue( env->vlist[ i ].val );
+  countedFree( MEM_ENVIRONMENT, env->vlist,
+               sizeof( VarRec ) * env->capacity );
+
+  countedFree( MEM_ENVIRONMENT, env, sizeof( Environment ) );
+}
+
+#else
+
+// Hidden implementation of the environment.  Variables are resolved to
+// slot numbers by the parser, so this is just an array of values indexed
+// by slot.
+struct EnvironmentStruct {
+  Value *vals;
+
+  // Number of slots that have storage (and an initial value).
+  int len;
+
+  // Capacity of the value array.
+  int capacity;
+};
+
+Environment *makeEnvironment()
+{
+  Environment *env = (Environment *) countedMalloc( MEM_ENVIRONMENT,
+                                                   sizeof( Environment ) );
+  env->capacity = INIT_CAP;
+  env->len = 0;
+  env->vals = (Value *) countedMalloc( MEM_ENVIRONMENT,
+                                       sizeof( Value ) * env->capacity );
+  return env;
+}
+
+Value lookupVariable( Environment *env, Symbol const *sym )
+{
+  // Return zero for uninitialized variables.
+  if ( sym->slot >= env->len )
+    return (Value){ IntType, .ival = 0 };
+
+  return env->vals[ sym->slot ];
+}
+
+void setVariable( Environment *env, Symbol const *sym, Value value )
+{
+  int pos = sym->slot;
+
+  // Make room for this slot if it's past the end of our array.
+  if ( pos >= env->len ) {
+    if ( pos >= env->capacity ) {
+      int cap = env->capacity;
+      while ( pos >= cap )
+        cap *= DOUBLE_CAP;
+      env->vals = (Value *) countedRealloc( MEM_ENVIRONMENT, env->vals,
+                                            sizeof( Value ) * env->capacity,
+                                            sizeof( Value ) * cap );
+      env->capacity = cap;
     }
-    
+
+    // Slots we skipped over hold uninitialized variables.
+    while ( env->len <= pos )
+      env->vals[ env->len++ ] = (Value){ IntType, .ival = 0 };
+  } else {
+    //If this variable already exists we need to release the sequence if needed
+    releaseValue( env->vals[ pos ] );
+  }
+
+  env->vals[ pos ] = value;
+}
+
+void visitVariables( Environment *env,
+                     void (*visit)( char const *name, Value val, void *data ),
+                     void *data )
+{
+  // Slots don't have names, so we go through the context's symbol table
+  // to find the name for each one.
+  Interp *interp = currentInterp();
+  for ( int i = 0; i < interp->symbolCap; i++ ) {
+    Symbol const *sym = interp->symbols[ i ];
+    if ( sym && sym->slot < env->len )
+      visit( sym->name, env->vals[ sym->slot ], data );
   }
-  free( env->vlist );
+}
+
+void freeEnvironment( Environment *env )
+{
+  //Need a case for if the variable is actually a sequence
+  for ( int i = 0; i < env->len; i++ )
+    releaseValue( env->vals[ i ] );
+  countedFree( MEM_ENVIRONMENT, env->vals, sizeof( Value ) * env->capacity );
 
-  free( env );
+  countedFree( MEM_ENVIRONMENT, env, sizeof( Environment ) );
 }
 
+#endif
@@ -14,29 +14,190 @@
 #define INIT_CAP 5
 /**Growth rate for reallocating memory*/
 #define DOUBLE_CAP 2
+/**Bytes of elements a sequence can keep in its own header*/
+#define SMALL_BYTES 16
 
 #include <stdbool.h>
+#include <stdint.h>
 
 /** Representation for a seqeunce of integers.  One type of value supported
     by the language. */
-typedef struct {
+typedef struct SequenceStruct {
   int len;
   int cap;
   
-  int *seq;
+  /** Elements of the sequence, width bytes each.  Every sequence starts
+      out with one byte per element, enough for character codes, and the
+      storage is widened the first time it's given an element that won't
+      fit.  Use getElement() and setElement() to get at them. */
+  void *seq;
+
+  /** Bytes per element: 1 for values 0 to 255, 2 for values that fit in
+      16 bits, or 4 for any int. */
+  int width;
+
   int ref;
+
+  /** If this sequence is a view, this is the payload it shares with
+      other sequences (a constant, or elements shared by value-semantics
+      assignment), and seq points to the payload's elements.  They're
+      copied the first time the view is changed.  Otherwise, it's NULL
+      and seq is our own.  While the sequence is a spare header waiting
+      to be reused, this links it to the next one. */
+  struct SequenceStruct *owner;
+
+  /** Storage for short sequences, so they don't need a separate block of
+      memory.  When seq points here, cap is as many elements of the
+      current width as will fit. */
+  unsigned char small[ SMALL_BYTES ];
 } Sequence;
 
+/** Return the number of bytes per element a sequence needs to hold the
+    given value.
+    @param val value to store.
+    @return 1, 2 or 4.
+*/
+static inline int elementWidth( int val )
+{
+  if ( val >= 0 && val <= UINT8_MAX )
+    return 1;
+  if ( val >= INT16_MIN && val <= INT16_MAX )
+    return 2;
+  return 4;
+}
+
+/** Return one element of a sequence, whatever width it's stored in.
+    @param seq sequence to look in.
+    @param i index of the element, which has to be in bounds.
+    @return value of the element.
+*/
+static inline int getElement( Sequence const *seq, int i )
+{
+  if ( seq->width == 1 )
+    return ( (uint8_t const *) seq->seq )[ i ];
+  if ( seq->width == 2 )
+    return ( (int16_t const *) seq->seq )[ i ];
+  return ( (int32_t const *) seq->seq )[ i ];
+}
+
+/** Give a sequence wider elements, converting the ones it has.  It has
+    to have storage of its own (see makeWritable()).
+    @param seq sequence to widen.
+    @param width new bytes per element, more than it has now.
+*/
+void widenSequence( Sequence *seq, int width );
+
+/** Change one element of a sequence, widening its storage if the value
+    won't fit.  It has to have storage of its own (see makeWritable()).
+    @param seq sequence to change.
+    @param i index of the element, which has to be in bounds.
+    @param val new value for the element.
+*/
+static inline void setElement( Sequence *seq, int i, int val )
+{
+  if ( elementWidth( val ) > seq->width )
+    widenSequence( seq, elementWidth( val ) );
+
+  if ( seq->width == 1 )
+    ( (uint8_t *) seq->seq )[ i ] = (uint8_t) val;
+  else if ( seq->width == 2 )
+    ( (int16_t *) seq->seq )[ i ] = (int16_t) val;
+  else
+    ( (int32_t *) seq->seq )[ i ] = val;
+}
+
 /** Create an empty sequence.
     @return pointer to the new, dynamically allocated sequence.
 */
 Sequence *makeSequence();
 
+/** Create an empty sequence with room for exactly the given number of
+    elements, for when the final length is known ahead of time.
+    @param cap number of elements to make room for.
+    @return pointer to the new, dynamically allocated sequence.
+*/
+Sequence *makeSequenceCap( int cap );
+
+/** Create a new sequence that shares the elements of a constant one,
+    without copying them.  Changing the view gives it a copy of its own
+    first, so the constant never changes.
+    @param owner constant sequence to share.  The view holds a reference
+    to it.
+    @return new sequence, with a reference count of zero.
+*/
+Sequence *makeSequenceView( Sequence *owner );
+
+/** Create a sequence for elements stored in memory it doesn't own, such
+    as an environment image mapped from a file.  It's only meant to be
+    the payload for views (see makeSequenceView()), so the elements are
+    never changed, and they're left alone when it's freed.
+    @param elements the sequence's elements, width bytes each.  They have
+    to stay where they are for as long as the sequence exists.
+    @param len number of elements.
+    @param width bytes per element.
+    @return new sequence, with a reference count of zero.
+*/
+Sequence *makeBorrowedSequence( void const *elements, int len, int width );
+
+/** Create a new sequence with the same elements as the given one, in
+    constant time.  Both sequences become views of a shared payload, and
+    whichever one changes first gets its own copy of the elements.
+    @param seq sequence to share.
+    @return new sequence, with a reference count of zero.
+*/
+Sequence *shareSequence( Sequence *seq );
+
+/** Make sure the elements of a sequence can be changed, copying them if
+    it's a view that shares them.  Everything that changes the elements of
+    a sequence calls this (or reserveSequence()) first.
+    @param seq sequence that's about to be changed.
+*/
+void makeWritable( Sequence *seq );
+
+/** Make sure the given sequence has room for at least cap elements,
+    growing its storage to exactly that size if it doesn't.
+    @param seq sequence to grow.
+    @param cap number of elements it should have room for.
+*/
+void reserveSequence( Sequence *seq, int cap );
+
+/** Add one element to the end of a sequence, doubling its capacity if
+    it's full.
+    @param seq sequence to add to.
+    @param val value to add.
+*/
+void appendInt( Sequence *seq, int val );
+
+/** Copy all the elements of one sequence to the end of another.  If the
+    sequence doesn't have room, its capacity is at least doubled, and
+    it's widened if the other one has wider elements.
+    @param seq sequence to add to.
+    @param src sequence with the elements to copy.  This may not be seq
+    itself.
+*/
+void appendSequence( Sequence *seq, Sequence const *src );
+
+/** Make a new sequence containing the given one repeated some number of
+    times.
+    @param src sequence to repeat.
+    @param times number of copies to make, zero or less for an empty
+    sequence.  The result has to have few enough elements for an int to
+    count.
+    @return new sequence, with a reference count of zero.
+*/
+Sequence *repeatSequence( Sequence const *src, int times );
+
 /** Free all the memory used to store the given sequence.
     @param seq sequence to free.
 */
 void freeSequence( Sequence *seq );
 
+/** Free a context's list of spare sequence headers, kept so freeing and
+    making sequences doesn't have to go to malloc every time.
+    @param spares first header in the list, linked by their owner fields.
+*/
+void freeSpareSequences( Sequence *spares );
+
 /** Add one to the reference count for the given sequence.
     @param seq sequence in which to increate the reference count.
 */
@@ -78,6 +239,20 @@ struct ValueStruct {
 // Maximum length of an identifier (variable) name.
 #define MAX_VAR_NAME 20
 
+/** A variable name resolved by the parser.  Every distinct name in the
+    program is given its own dense slot number, so the environment can
+    find a variable's value by index instead of searching by name. */
+typedef struct {
+  /** Index of this variable's value in the environment. */
+  int slot;
+
+  /** Hash of the name, computed once by hashName(). */
+  unsigned hash;
+
+  /** Name of the variable. */
+  char name[ MAX_VAR_NAME + 1 ];
+} Symbol;
+
 /**
    Short typename for the Environment structure.  Its definition is an
    implementation detail of the language, not visible to client code.
@@ -85,6 +260,15 @@ struct ValueStruct {
 typedef struct EnvironmentStruct Environment;
 
 
+/** Compute the hash code used to find a variable name in a hashed
+    environment.
+    @param name variable name to hash.  It doesn't need to be null
+    terminated.
+    @param len number of characters in the name.
+    @return hash code for the name.
+*/
+unsigned hashName( char const *name, int len );
+
 /** Create and return a new, empty environment object.
     @return new, dynamically allocated environment object.  The caller
     must eventually free this with freeEnvironemtn().
@@ -92,24 +276,35 @@ typedef struct EnvironmentStruct Environment;
 Environment *makeEnvironment();
 
 
-/** Lookup the variable with the given name in the environment and
-    return its value.  If the variable doesn't have a value, this
-    function returns null.
+/** Lookup the given variable in the environment and return its value.
+    If the variable doesn't have a value, this function returns an int
+    value of zero.
     @param env Environment object in which to lookup the variable.
-    @param name requested variable name.
-    @return the variable's value.  This is a pointer into the
-    environment's representation and should not be directly freed or
+    @param sym resolved symbol for the requested variable.
+    @return the variable's value.  If it's a sequence, the sequence is
+    still owned by the environment and should not be directly freed or
     modified by the caller.
 */
-Value lookupVariable( Environment *env, char const *name );
+Value lookupVariable( Environment *env, Symbol const *sym );
 
-/** In the given environment, set the named variable to store the given
+/** In the given environment, set the given variable to store the given
     value.
-    @param env Environment in which to store the variable name / value.
-    @param name of the variable to set the value for.
+    @param env Environment in which to store the variable value.
+    @param sym resolved symbol for the variable to set the value for.
     @param value new value for this variable.
 */
-void setVariable( Environment *env, char const *name, Value value );
+void setVariable( Environment *env, Symbol const *sym, Value value );
+
+/** Call a function for every variable an environment has a value for.
+    Variables are visited in no particular order.
+    @param env environment to look in.
+    @param visit function to call with each variable's name and value,
+    and the data pointer given here.
+    @param data pointer passed along to visit.
+*/
+void visitVariables( Environment *env,
+                     void (*visit)( char const *name, Value val, void *data ),
+                     void *data );
 
 /** Free all the memory associated with this environment.
     @param env environment to free memory for.
@@ -0,0 +1,384 @@
+/**
+ * @file vm.c
+ * @author Sean Hinton (sahinto2)
+ * Building blocks of compiled code, and the stack machine that runs it.
+ * When compiled with gcc (or clang), the dispatch loop uses computed goto
+ * so each instruction jumps straight to the next one's handler.
+*/
+#include "vm.h"
+#include "ops.h"
+#include "context.h"
+#include <stdlib.h>
+
+/** Change in stack depth for each opcode, used to work out how much stack
+    a block of code needs.  OP_SEQUENCE is handled separately, since it
+    depends on the operand. */
+static int const stackEffect[ OP_LIMIT ] = {
+  [ OP_HALT ] = 0,
+  [ OP_INT ] = 1,
+  [ OP_LOAD ] = 1,
+  [ OP_STORE ] = -1,
+  [ OP_APPEND ] = -1,
+  [ OP_STORE_ELEMENT ] = -2,
+  [ OP_ADD ] = -1,
+  [ OP_SUB ] = -1,
+  [ OP_MUL ] = -1,
+  [ OP_DIV ] = -1,
+  [ OP_LESS ] = -1,
+  [ OP_EQUALS ] = -1,
+  [ OP_AND ] = -1,
+  [ OP_OR ] = -1,
+  [ OP_REQUIRE_INT ] = 0,
+  [ OP_SEQUENCE ] = 0,
+  [ OP_CONSTANT ] = 1,
+  [ OP_LEN ] = 0,
+  [ OP_INDEX ] = -1,
+  [ OP_PRINT ] = -1,
+  [ OP_PUSH ] = -2,
+  [ OP_JUMP ] = 0,
+  [ OP_JUMP_FALSE ] = -1,
+};
+
+Code *makeCode()
+{
+  Code *code = (Code *) malloc( sizeof( Code ) );
+  code->cap = INIT_CAP;
+  code->len = 0;
+  code->instr = (Instr *) malloc( code->cap * sizeof( Instr ) );
+  code->depth = 0;
+  code->maxDepth = 0;
+  return code;
+}
+
+void freeCode( Code *code )
+{
+  free( code->instr );
+  free( code );
+}
+
+/** Add an instruction to the end of the code, keeping track of the stack
+    depth.  The caller fills in the operand.
+    @param code code to add the instruction to.
+    @param op opcode for the instruction.
+    @param effect change in stack depth caused by this instruction.
+    @return index of the new instruction.
+*/
+static int append( Code *code, OpCode op, int effect )
+{
+  if ( code->len >= code->cap ) {
+    code->cap *= DOUBLE_CAP;
+    code->instr = (Instr *) realloc( code->instr, code->cap * sizeof( Instr ) );
+  }
+
+  code->depth += effect;
+  if ( code->depth > code->maxDepth )
+    code->maxDepth = code->depth;
+
+  code->instr[ code->len ].op = op;
+  return code->len++;
+}
+
+int emit( Code *code, OpCode op )
+{
+  return append( code, op, stackEffect[ op ] );
+}
+
+int emitInt( Code *code, OpCode op, int ival )
+{
+  // A sequence pops all its elements and pushes the new sequence.
+  int effect = op == OP_SEQUENCE ? 1 - ival : stackEffect[ op ];
+  int pos = append( code, op, effect );
+  code->instr[ pos ].ival = ival;
+  return pos;
+}
+
+int emitSymbol( Code *code, OpCode op, Symbol const *sym )
+{
+  int pos = append( code, op, stackEffect[ op ] );
+  code->instr[ pos ].sym = sym;
+  return pos;
+}
+
+int emitConstant( Code *code, Sequence *constant )
+{
+  int pos = append( code, OP_CONSTANT, stackEffect[ OP_CONSTANT ] );
+  code->instr[ pos ].constant = constant;
+  return pos;
+}
+
+void patchJump( Code *code, int jump )
+{
+  code->instr[ jump ].target = code->len;
+}
+
+Code *compileStmt( Stmt *stmt )
+{
+  Code *code = makeCode();
+  stmt->compile( stmt, code );
+  emit( code, OP_HALT );
+  return code;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Dispatch loop
+
+#if defined( __GNUC__ )
+
+// With computed goto, every handler ends by jumping directly to the
+// handler for the next instruction.
+#define CASE( op ) do_##op
+#define DISPATCH() goto *labels[ ip->op ]
+#define NEXT() do { ip++; DISPATCH(); } while ( 0 )
+
+#else
+
+// Otherwise, it's a switch inside a loop.
+#define CASE( op ) case op
+#define DISPATCH() continue
+#define NEXT() do { ip++; continue; } while ( 0 )
+
+#endif
+
+/** True if both values are ints.  The common int-only cases of the
+    operators are handled right in the dispatch loop, without a call. */
+#define BOTH_INTS( a, b ) ( (a).vtype == IntType && (b).vtype == IntType )
+
+/** Record the end of the part of the stack in use before calling
+    something that might report an error, so the temporaries on it can
+    be freed (see releaseStack()). */
+#define SAVE_STACK( top ) ( interp->stackTop = ( top ) )
+
+/** Report a type mismatch unless the value just below top, the top of
+    the stack, is an int.  Only a failed check has to record the
+    stack. */
+#define REQUIRE_INT( top ) do {                 \
+    if ( (top)[ -1 ].vtype != IntType ) {       \
+      SAVE_STACK( top );                        \
+      reportTypeMismatch();                     \
+    }                                           \
+  } while ( 0 )
+
+void releaseStack( Interp *interp )
+{
+  if ( !interp->stackTop )
+    return;
+
+  // Sequences something else refers to are left alone, the rest were
+  // only on the stack.
+  for ( Value *v = interp->stack; v < interp->stackTop; v++ )
+    if ( v->vtype == SeqType && v->sval->ref == 0 ) {
+      grabSequence( v->sval );
+      releaseSequence( v->sval );
+    }
+  interp->stackTop = NULL;
+}
+
+void runCode( Code *code, Environment *env )
+{
+  // Stack of values, sp points to the next free element.  It belongs to
+  // the context, so it's reused from one run to the next.
+  Interp *interp = currentInterp();
+  if ( code->maxDepth + 1 > interp->stackCap ) {
+    interp->stackCap = code->maxDepth + 1;
+    interp->stack = (Value *) realloc( interp->stack,
+                                       interp->stackCap * sizeof( Value ) );
+  }
+  Value *stack = interp->stack;
+  Value *sp = stack;
+
+  Instr *ip = code->instr;
+
+#if defined( __GNUC__ )
+  static void *labels[ OP_LIMIT ] = {
+    [ OP_HALT ] = &&do_OP_HALT,
+    [ OP_INT ] = &&do_OP_INT,
+    [ OP_LOAD ] = &&do_OP_LOAD,
+    [ OP_STORE ] = &&do_OP_STORE,
+    [ OP_APPEND ] = &&do_OP_APPEND,
+    [ OP_STORE_ELEMENT ] = &&do_OP_STORE_ELEMENT,
+    [ OP_ADD ] = &&do_OP_ADD,
+    [ OP_SUB ] = &&do_OP_SUB,
+    [ OP_MUL ] = &&do_OP_MUL,
+    [ OP_DIV ] = &&do_OP_DIV,
+    [ OP_LESS ] = &&do_OP_LESS,
+    [ OP_EQUALS ] = &&do_OP_EQUALS,
+    [ OP_AND ] = &&do_OP_AND,
+    [ OP_OR ] = &&do_OP_OR,
+    [ OP_REQUIRE_INT ] = &&do_OP_REQUIRE_INT,
+    [ OP_SEQUENCE ] = &&do_OP_SEQUENCE,
+    [ OP_CONSTANT ] = &&do_OP_CONSTANT,
+    [ OP_LEN ] = &&do_OP_LEN,
+    [ OP_INDEX ] = &&do_OP_INDEX,
+    [ OP_PRINT ] = &&do_OP_PRINT,
+    [ OP_PUSH ] = &&do_OP_PUSH,
+    [ OP_JUMP ] = &&do_OP_JUMP,
+    [ OP_JUMP_FALSE ] = &&do_OP_JUMP_FALSE,
+  };
+  DISPATCH();
+#else
+  for ( ;; )
+    switch ( ip->op ) {
+#endif
+
+  CASE( OP_INT ):
+    *sp++ = (Value){ IntType, .ival = ip->ival };
+    NEXT();
+
+  CASE( OP_LOAD ):
+    *sp++ = lookupVariable( env, ip->sym );
+    NEXT();
+
+  CASE( OP_STORE ):
+    sp--;
+    assignVariable( env, ip->sym, sp[ 0 ] );
+    NEXT();
+
+  CASE( OP_APPEND ):
+    sp--;
+    appendVariable( env, ip->sym, sp[ 0 ] );
+    NEXT();
+
+  CASE( OP_STORE_ELEMENT ):
+    sp -= 2;
+    SAVE_STACK( sp + 2 );
+    assignElement( env, ip->sym, sp[ 1 ], sp[ 0 ] );
+    NEXT();
+
+  CASE( OP_ADD ):
+    sp--;
+    if ( BOTH_INTS( sp[ -1 ], sp[ 0 ] ) )
+      sp[ -1 ].ival = sp[ -1 ].ival + sp[ 0 ].ival;
+    else
+      sp[ -1 ] = addValues( sp[ -1 ], sp[ 0 ] );
+    NEXT();
+
+  CASE( OP_SUB ):
+    sp--;
+    if ( BOTH_INTS( sp[ -1 ], sp[ 0 ] ) )
+      sp[ -1 ].ival = sp[ -1 ].ival - sp[ 0 ].ival;
+    else {
+      SAVE_STACK( sp + 1 );
+      sp[ -1 ] = subValues( sp[ -1 ], sp[ 0 ] );
+    }
+    NEXT();
+
+  CASE( OP_MUL ):
+    sp--;
+    if ( BOTH_INTS( sp[ -1 ], sp[ 0 ] ) )
+      sp[ -1 ].ival = sp[ -1 ].ival * sp[ 0 ].ival;
+    else {
+      SAVE_STACK( sp + 1 );
+      sp[ -1 ] = mulValues( sp[ -1 ], sp[ 0 ] );
+    }
+    NEXT();
+
+  CASE( OP_DIV ):
+    sp--;
+    SAVE_STACK( sp + 1 );
+    sp[ -1 ] = divValues( sp[ -1 ], sp[ 0 ] );
+    NEXT();
+
+  CASE( OP_LESS ):
+    sp--;
+    if ( BOTH_INTS( sp[ -1 ], sp[ 0 ] ) )
+      sp[ -1 ].ival = sp[ -1 ].ival < sp[ 0 ].ival;
+    else {
+      SAVE_STACK( sp + 1 );
+      sp[ -1 ] = lessValues( sp[ -1 ], sp[ 0 ] );
+    }
+    NEXT();
+
+  CASE( OP_EQUALS ):
+    sp--;
+    if ( BOTH_INTS( sp[ -1 ], sp[ 0 ] ) )
+      sp[ -1 ].ival = sp[ -1 ].ival == sp[ 0 ].ival;
+    else {
+      SAVE_STACK( sp + 1 );
+      sp[ -1 ] = equalsValues( sp[ -1 ], sp[ 0 ] );
+    }
+    NEXT();
+
+  CASE( OP_AND ):
+    REQUIRE_INT( sp );
+    if ( sp[ -1 ].ival == 0 ) {
+      ip = code->instr + ip->target;
+      DISPATCH();
+    }
+    sp--;
+    NEXT();
+
+  CASE( OP_OR ):
+    REQUIRE_INT( sp );
+    if ( sp[ -1 ].ival ) {
+      ip = code->instr + ip->target;
+      DISPATCH();
+    }
+    sp--;
+    NEXT();
+
+  CASE( OP_REQUIRE_INT ):
+    REQUIRE_INT( sp );
+    NEXT();
+
+  CASE( OP_SEQUENCE ): {
+    // The elements are already checked, just copy them into a sequence.
+    int len = ip->ival;
+    Sequence *seq = makeSequenceCap( len );
+    sp -= len;
+    for ( int i = 0; i < len; i++ )
+      appendInt( seq, sp[ i ].ival );
+    *sp++ = (Value){ SeqType, .sval = seq };
+    NEXT();
+  }
+
+  CASE( OP_CONSTANT ):
+    *sp++ = (Value){ SeqType, .sval = makeSequenceView( ip->constant ) };
+    NEXT();
+
+  CASE( OP_LEN ):
+    SAVE_STACK( sp );
+    sp[ -1 ] = lenValue( sp[ -1 ] );
+    NEXT();
+
+  CASE( OP_INDEX ):
+    sp--;
+    SAVE_STACK( sp + 1 );
+    sp[ -1 ] = indexValue( sp[ -1 ], sp[ 0 ] );
+    NEXT();
+
+  CASE( OP_PRINT ):
+    sp--;
+    printValue( sp[ 0 ] );
+    NEXT();
+
+  CASE( OP_PUSH ):
+    sp -= 2;
+    SAVE_STACK( sp + 2 );
+    pushValue( sp[ 0 ], sp[ 1 ] );
+    NEXT();
+
+  CASE( OP_JUMP ):
+    ip = code->instr + ip->target;
+    DISPATCH();
+
+  CASE( OP_JUMP_FALSE ):
+    REQUIRE_INT( sp );
+    sp--;
+    if ( sp->ival == 0 ) {
+      ip = code->instr + ip->target;
+      DISPATCH();
+    }
+    NEXT();
+
+  CASE( OP_HALT ):
+#if !defined( __GNUC__ )
+    goto halt;
+  default:
+    goto halt;
+  }
+ halt:
+#endif
+  // Nothing on the stack needs freeing once we're done.
+  SAVE_STACK( NULL );
+  return;
+}
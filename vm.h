@@ -0,0 +1,197 @@
+/**
+  @file vm.h
+  @author Sean Hinton (sahinto2)
+
+  Bytecode representation of a program, and a stack machine to run it.
+  Statements are compiled to a linear array of instructions that
+  communicate through a stack of Values, instead of being executed by
+  walking the tree of Expr and Stmt objects.
+*/
+
+#ifndef _VM_H_
+#define _VM_H_
+
+#include "value.h"
+#include "interp.h"
+#include "syntax.h"
+
+/** Operations for the stack machine.  The comment on each describes
+    what it does to the stack. */
+typedef enum {
+  /** Stop running the code. */
+  OP_HALT,
+
+  /** Push the instruction's int operand. */
+  OP_INT,
+
+  /** Push the value of the instruction's variable. */
+  OP_LOAD,
+
+  /** Pop a value and store it in the instruction's variable. */
+  OP_STORE,
+
+  /** Pop a value and add it to the end of the instruction's variable,
+      for x = x + value.  This extends the sequence in place when it's
+      not shared. */
+  OP_APPEND,
+
+  /** Pop an index and a value (pushed before the index), and store the
+      value in that element of the instruction's variable. */
+  OP_STORE_ELEMENT,
+
+  /** Pop two operands and push the result of the operator. */
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_LESS,
+  OP_EQUALS,
+
+  /** Require an int on top of the stack.  If it's false (for OP_AND) or
+      true (for OP_OR), leave it there and jump to the target.
+      Otherwise, pop it and continue. */
+  OP_AND,
+  OP_OR,
+
+  /** Check that the value on top of the stack is an int. */
+  OP_REQUIRE_INT,
+
+  /** Pop the instruction's count of ints and push a new sequence
+      containing them. */
+  OP_SEQUENCE,
+
+  /** Push a new view of the instruction's constant sequence. */
+  OP_CONSTANT,
+
+  /** Pop a sequence and push its length. */
+  OP_LEN,
+
+  /** Pop an index and a sequence and push that element. */
+  OP_INDEX,
+
+  /** Pop a value and print it. */
+  OP_PRINT,
+
+  /** Pop an int and a sequence and add the int to the sequence. */
+  OP_PUSH,
+
+  /** Continue at the target instruction. */
+  OP_JUMP,
+
+  /** Pop an int condition and jump to the target if it's false. */
+  OP_JUMP_FALSE,
+
+  /** Number of operations, not a real opcode. */
+  OP_LIMIT
+} OpCode;
+
+/** One instruction, an opcode and an operand that depends on the
+    opcode. */
+typedef struct {
+  OpCode op;
+
+  union {
+    /** Literal value for OP_INT or element count for OP_SEQUENCE. */
+    int ival;
+
+    /** Index of the next instruction for jumps. */
+    int target;
+
+    /** Variable for loads and stores. */
+    Symbol const *sym;
+
+    /** Constant sequence for OP_CONSTANT. */
+    Sequence *constant;
+  };
+} Instr;
+
+/** A block of compiled code.  It refers to symbols and (for
+    OP_CONSTANT) constant sequences in the tree it was compiled from, so
+    that tree must not be destroyed while the code is still in use. */
+struct CodeStruct {
+  /** Resizable array of instructions. */
+  Instr *instr;
+
+  /** Number of instructions. */
+  int len;
+
+  /** Capacity of the instruction array. */
+  int cap;
+
+  /** Stack depth at the end of the code emitted so far. */
+  int depth;
+
+  /** Largest stack depth this code can reach. */
+  int maxDepth;
+};
+
+/** Make a new, empty block of code.
+    @return new, dynamically allocated code object.
+*/
+Code *makeCode();
+
+/** Free the memory for this block of code.
+    @param code code to free.
+*/
+void freeCode( Code *code );
+
+/** Add an instruction with no operand.
+    @param code code to add the instruction to.
+    @param op opcode for the instruction.
+    @return index of the new instruction.
+*/
+int emit( Code *code, OpCode op );
+
+/** Add an instruction with an int operand, for literals, element counts
+    or jump targets.
+    @param code code to add the instruction to.
+    @param op opcode for the instruction.
+    @param ival operand for the instruction.
+    @return index of the new instruction.
+*/
+int emitInt( Code *code, OpCode op, int ival );
+
+/** Add an instruction that loads or stores a variable.
+    @param code code to add the instruction to.
+    @param op opcode for the instruction.
+    @param sym variable the instruction uses.  This must stay valid
+    while the code is used.
+    @return index of the new instruction.
+*/
+int emitSymbol( Code *code, OpCode op, Symbol const *sym );
+
+/** Add an OP_CONSTANT instruction for the given constant sequence.
+    @param code code to add the instruction to.
+    @param constant sequence to push views of.  This must stay valid
+    while the code is used.
+    @return index of the new instruction.
+*/
+int emitConstant( Code *code, Sequence *constant );
+
+/** Make a previously emitted jump continue at the end of the code
+    emitted so far.
+    @param code code containing the jump.
+    @param jump index of the jump instruction.
+*/
+void patchJump( Code *code, int jump );
+
+/** Compile a statement into a new block of code, ending with OP_HALT.
+    @param stmt statement to compile.
+    @return new code for the statement.
+*/
+Code *compileStmt( Stmt *stmt );
+
+/** Run a block of code.
+    @param code code to run.
+    @param env current values of all variables.
+*/
+void runCode( Code *code, Environment *env );
+
+/** Free the temporary sequences left on the VM's stack when an error
+    stopped the code it was running.  This does nothing if the VM wasn't
+    running.
+    @param interp context the error was raised in.
+*/
+void releaseStack( Interp *interp );
+
+#endif